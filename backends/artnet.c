@@ -199,6 +199,10 @@ static int artnet_configure_instance(instance* inst, char* option, char* value){
 		data->realtime = strtoul(value, NULL, 10);
 		return 0;
 	}
+	else if(!strcmp(option, "full-frames")){
+		data->full_frames = strtoul(value, NULL, 10);
+		return 0;
+	}
 
 	LOGPF("Unknown instance option %s for instance %s", option, inst->name);
 	return 1;
@@ -222,6 +226,11 @@ static channel* artnet_channel(instance* inst, char* spec, uint8_t flags){
 		LOGPF("Channel %s.%s mapped for output, but instance is not configured for output (missing destination)", inst->name, spec);
 	}
 
+	//track the highest slot used for output to trim transmitted frames
+	if((flags & mmchannel_output) && data->data.out_len <= chan_a){
+		data->data.out_len = chan_a + 1;
+	}
+
 	//secondary channel setup
 	if(*spec_next == '+'){
 		chan_b = strtoul(spec_next + 1, NULL, 10);
@@ -231,6 +240,10 @@ static channel* artnet_channel(instance* inst, char* spec, uint8_t flags){
 		}
 		chan_b--;
 
+		if((flags & mmchannel_output) && data->data.out_len <= chan_b){
+			data->data.out_len = chan_b + 1;
+		}
+
 		//if mapped mode differs, bail
 		if(IS_ACTIVE(data->data.map[chan_b]) && data->data.map[chan_b] != (MAP_FINE | chan_a)){
 			LOGPF("Fine channel already mapped for spec %s", spec);
@@ -255,6 +268,9 @@ static channel* artnet_channel(instance* inst, char* spec, uint8_t flags){
 
 static int artnet_transmit(instance* inst, artnet_output_universe* output){
 	artnet_instance_data* data = (artnet_instance_data*) inst->impl;
+	//the spec requires an even slot count of at least 2
+	uint16_t slots = data->full_frames ? 512 : (data->data.out_len + 1) & ~1;
+	slots = slots ? slots : 2;
 
 	//build output frame
 	artnet_dmx frame = {
@@ -265,12 +281,12 @@ static int artnet_transmit(instance* inst, artnet_output_universe* output){
 		.port = 0,
 		.universe = data->uni,
 		.net = data->net,
-		.length = htobe16(512),
+		.length = htobe16(slots),
 		.data = {0}
 	};
-	memcpy(frame.data, data->data.out, 512);
+	memcpy(frame.data, data->data.out, slots);
 
-	if(sendto(global_cfg.fd[data->fd_index].fd, (uint8_t*) &frame, sizeof(frame), 0, (struct sockaddr*) &data->dest_addr, data->dest_len) < 0){
+	if(sendto(global_cfg.fd[data->fd_index].fd, (uint8_t*) &frame, sizeof(frame) - (512 - slots), 0, (struct sockaddr*) &data->dest_addr, data->dest_len) < 0){
 		#ifdef _WIN32
 		if(WSAGetLastError() != WSAEWOULDBLOCK){
 		#else
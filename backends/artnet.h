@@ -36,6 +36,7 @@ static int artnet_shutdown(size_t n, instance** inst);
 
 typedef struct /*_artnet_universe_model*/ {
 	uint8_t seq;
+	uint16_t out_len;
 	uint8_t in[512];
 	uint8_t out[512];
 	uint16_t map[512];
@@ -51,6 +52,7 @@ typedef struct /*_artnet_instance_model*/ {
 	size_t fd_index;
 	uint64_t last_input;
 	uint8_t realtime;
+	uint8_t full_frames;
 } artnet_instance_data;
 
 typedef union /*_artnet_instance_id*/ {
@@ -1,23 +1,23 @@
 #define BACKEND_NAME "jack"
 
 #include <string.h>
+#include <math.h>
 #include <signal.h>
 #include <sys/types.h>
-#include <sys/socket.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifdef __linux__
+	#include <sys/eventfd.h>
+#endif
 
+#include "libmmbackend.h"
 #include "jack.h"
 #include <jack/midiport.h>
 #include <jack/metadata.h>
 
 #define JACKEY_SIGNAL_TYPE "http://jackaudio.org/metadata/signal-type"
 
-#ifdef __APPLE__
-	#ifndef PTHREAD_MUTEX_ADAPTIVE_NP
-		#define PTHREAD_MUTEX_ADAPTIVE_NP PTHREAD_MUTEX_DEFAULT
-	#endif
-#endif
-
 static struct /*_mmjack_backend_cfg*/ {
 	unsigned verbosity;
 	volatile sig_atomic_t jack_shutdown;
@@ -59,25 +59,25 @@ static void mmjack_message_print(const char* msg){
 static void mmjack_message_ignore(const char* msg){
 }
 
-static int mmjack_midiqueue_append(mmjack_port* port, mmjack_channel_ident ident, uint16_t value){
-	//append events
-	if(port->queue_len == port->queue_alloc){
-		//extend the queue
-		port->queue = realloc(port->queue, (port->queue_len + JACK_MIDIQUEUE_CHUNK) * sizeof(mmjack_midiqueue));
-		if(!port->queue){
-			LOG("Failed to allocate memory");
-			return 1;
-		}
-		port->queue_alloc += JACK_MIDIQUEUE_CHUNK;
+//may be called from the process callback, so this must neither block nor allocate
+static int mmjack_queue_push(mmjack_port* port, void* element){
+	if(mmbackend_ring_push(&port->queue, element)){
+		__atomic_add_fetch(&port->overflow, 1, __ATOMIC_RELAXED);
+		return 1;
 	}
-
-	port->queue[port->queue_len].ident.label = ident.label;
-	port->queue[port->queue_len].raw = value;
-	port->queue_len++;
-	DBGPF("Appended event to queue for %s, now at %" PRIsize_t " entries", port->name, port->queue_len);
 	return 0;
 }
 
+static int mmjack_midiqueue_append(mmjack_port* port, mmjack_channel_ident ident, uint16_t value, jack_nframes_t frame){
+	mmjack_event event = {
+		.ident.label = ident.label,
+		.raw = value,
+		.frame = frame
+	};
+
+	return mmjack_queue_push(port, &event);
+}
+
 static void mmjack_process_midiout(void* buffer, size_t sample_offset, uint8_t type, uint8_t channel, uint8_t control, uint16_t value){
 	jack_midi_data_t* event_data = jack_midi_event_reserve(buffer, sample_offset, (type == midi_aftertouch || type == midi_program) ? 2 : 3);
 
@@ -159,17 +159,43 @@ static void mmjack_handle_epn(mmjack_port* port, uint8_t chan, uint16_t control,
 		ident.fields.sub_control = port->epn_control[chan];
 
 		//ident.fields.port set on output in mmjack_handle_midi
-		mmjack_midiqueue_append(port, ident, port->epn_value[chan]);
+		mmjack_midiqueue_append(port, ident, port->epn_value[chan], 0);
 	}
 }
 
+/*
+ * Fetch the next output event due in the current cycle into port->next and calculate its sample offset.
+ * Events queued during the last cycle are written with one period of latency.
+ * Returns 1 if no further events are due in this cycle.
+ */
+static int mmjack_schedule_next(mmjack_port* port, jack_nframes_t cycle_start, size_t nframes, size_t* frame){
+	int64_t offset;
+
+	if(!port->pending && mmbackend_ring_pop(&port->queue, &port->next)){
+		return 1;
+	}
+
+	offset = (int32_t) (port->next.frame + nframes - cycle_start);
+	//events queued after this cycle started are held for the next one
+	if(offset >= (int64_t) nframes && offset < 2 * (int64_t) nframes){
+		port->pending = 1;
+		return 1;
+	}
+	port->pending = 0;
+
+	//JACK requires events in order, late events are written as early as possible
+	*frame = max(*frame, (size_t) clamp(offset, (int64_t) nframes - 1, 0));
+	return 0;
+}
+
 static int mmjack_process_midi(instance* inst, mmjack_port* port, size_t nframes, size_t* mark){
 	mmjack_instance_data* data = (mmjack_instance_data*) inst->impl;
 	void* buffer = jack_port_get_buffer(port->port, nframes);
 	jack_nframes_t event_count = jack_midi_get_event_count(buffer);
 	jack_midi_event_t event;
 	mmjack_channel_ident ident;
-	size_t u, frame;
+	jack_nframes_t cycle_start;
+	size_t u, frame, events = 0;
 	uint16_t value;
 
 	if(port->input){
@@ -206,9 +232,8 @@ static int mmjack_process_midi(instance* inst, mmjack_port* port, size_t nframes
 				}
 
 				//append midi data
-				mmjack_midiqueue_append(port, ident, value);
+				mmjack_midiqueue_append(port, ident, value, event.time);
 			}
-			port->mark = 1;
 			*mark = 1;
 		}
 	}
@@ -216,55 +241,282 @@ static int mmjack_process_midi(instance* inst, mmjack_port* port, size_t nframes
 		//clear buffer
 		jack_midi_clear_buffer(buffer);
 
+		cycle_start = jack_last_frame_time(data->client);
 		frame = 0;
-		for(u = 0; u < port->queue_len; u++){
-			ident.label = port->queue[u].ident.label;
+		while(!mmjack_schedule_next(port, cycle_start, nframes, &frame)){
+			ident.label = port->next.ident.label;
+			events++;
 
 			if(ident.fields.sub_type == midi_rpn
 					|| ident.fields.sub_type == midi_nrpn){
 				//transmit parameter number
-				mmjack_process_midiout(buffer, frame++, midi_cc, ident.fields.sub_channel, (ident.fields.sub_type == midi_rpn) ? 101 : 99, (ident.fields.sub_control >> 7) & 0x7F);
-				mmjack_process_midiout(buffer, frame++, midi_cc, ident.fields.sub_channel, (ident.fields.sub_type == midi_rpn) ? 100 : 98, ident.fields.sub_control & 0x7F);
+				mmjack_process_midiout(buffer, frame, midi_cc, ident.fields.sub_channel, (ident.fields.sub_type == midi_rpn) ? 101 : 99, (ident.fields.sub_control >> 7) & 0x7F);
+				mmjack_process_midiout(buffer, frame, midi_cc, ident.fields.sub_channel, (ident.fields.sub_type == midi_rpn) ? 100 : 98, ident.fields.sub_control & 0x7F);
 
 				//transmit parameter value
-				mmjack_process_midiout(buffer, frame++, midi_cc, ident.fields.sub_channel, 6, (port->queue[u].raw >> 7) & 0x7F);
-				mmjack_process_midiout(buffer, frame++, midi_cc, ident.fields.sub_channel, 38, port->queue[u].raw & 0x7F);
+				mmjack_process_midiout(buffer, frame, midi_cc, ident.fields.sub_channel, 6, (port->next.raw >> 7) & 0x7F);
+				mmjack_process_midiout(buffer, frame, midi_cc, ident.fields.sub_channel, 38, port->next.raw & 0x7F);
 
 				if(!data->midi_epn_tx_short){
 					//clear active parameter
-					mmjack_process_midiout(buffer, frame++, midi_cc, ident.fields.sub_channel, 101, 127);
-					mmjack_process_midiout(buffer, frame++, midi_cc, ident.fields.sub_channel, 100, 127);
+					mmjack_process_midiout(buffer, frame, midi_cc, ident.fields.sub_channel, 101, 127);
+					mmjack_process_midiout(buffer, frame, midi_cc, ident.fields.sub_channel, 100, 127);
 				}
 			}
 			else{
-				mmjack_process_midiout(buffer, frame++, ident.fields.sub_type, ident.fields.sub_channel, ident.fields.sub_control, port->queue[u].raw);
+				mmjack_process_midiout(buffer, frame, ident.fields.sub_type, ident.fields.sub_channel, ident.fields.sub_control, port->next.raw);
 			}
 		}
 
-		if(frame){
-			DBGPF("Wrote %" PRIsize_t " MIDI events to port %s", frame, port->name);
+		if(events){
+			DBGPF("Wrote %" PRIsize_t " MIDI events to port %s", events, port->name);
 		}
-		port->queue_len = 0;
 	}
 	return 0;
 }
 
+//mean over a block of samples, compiled to vector instructions where available
+static double mmjack_cv_mean(jack_default_audio_sample_t* samples, size_t n){
+	mmjack_cv_vector sum = {0};
+	float lanes[4];
+	size_t u = 0, lane;
+	double mean = 0;
+
+	for(; u + 4 <= n; u += 4){
+		sum += *((mmjack_cv_vector*) (samples + u));
+	}
+
+	//reduce the lanes
+	for(lane = 0; lane < 4; lane++){
+		mean += sum[lane];
+	}
+
+	//handle the remaining samples
+	memcpy(lanes, samples + u, (n - u) * sizeof(float));
+	for(lane = 0; lane < n - u; lane++){
+		mean += lanes[lane];
+	}
+
+	return mean / n;
+}
+
 static int mmjack_process_cv(instance* inst, mmjack_port* port, size_t nframes, size_t* mark){
 	jack_default_audio_sample_t* audio_buffer = jack_port_get_buffer(port->port, nframes);
+	size_t u, block = port->block ? min(port->block, nframes) : nframes, length;
+	double mean, target, step;
+
+	if(port->input){
+		//decimate to the control rate, passing the block means to the main thread if they changed
+		for(u = 0; u < nframes; u += block){
+			length = min(block, nframes - u);
+			mean = mmjack_cv_mean(audio_buffer + u, length);
+
+			if(fabs(mean - port->last) > port->threshold){
+				port->last = mean;
+				mmjack_queue_push(port, &port->last);
+				*mark = 1;
+			}
+		}
+	}
+	else{
+		//apply the most recent value set by the main thread
+		target = port->last;
+		while(!mmbackend_ring_pop(&port->queue, &target)){
+		}
+
+		//ramp to the new value over the period to avoid steps in the output
+		step = port->step ? 0 : (target - port->last) / nframes;
+		for(u = 0; u < nframes; u++){
+			audio_buffer[u] = port->step ? target : port->last + step * (u + 1);
+		}
+		port->last = target;
+	}
+	return 0;
+}
+
+//length of a padded OSC string including the terminator, 0 if unterminated
+static size_t mmjack_osc_string(uint8_t* data, size_t length){
 	size_t u;
 
+	for(u = 0; u < length; u++){
+		if(!data[u]){
+			return min((u + 4) & ~((size_t) 3), length);
+		}
+	}
+	return 0;
+}
+
+//parse an OSC packet within the process callback, queueing all numeric arguments of mapped paths
+static void mmjack_osc_parse(mmjack_port* port, uint8_t* data, size_t length, jack_nframes_t time, size_t depth){
+	size_t offset, path, path_length, types_length, arg, skip;
+	uint32_t element;
+	uint64_t element64;
+	union {
+		uint32_t u32;
+		int32_t i32;
+		float f;
+		uint64_t u64;
+		int64_t i64;
+		double d;
+	} raw;
+	double range = port->max - port->min;
+	mmjack_event event = {
+		.frame = time
+	};
+
+	//bundle elements are processed immediately, ignoring the timetag
+	if(length >= 16 && !memcmp(data, "#bundle", 8)){
+		if(depth >= JACK_OSC_BUNDLE_DEPTH){
+			return;
+		}
+
+		for(offset = 16; offset + 4 <= length; offset += 4 + element){
+			memcpy(&element, data + offset, 4);
+			element = be32toh(element);
+			if(element > length - offset - 4){
+				return;
+			}
+			mmjack_osc_parse(port, data + offset + 4, element, time, depth + 1);
+		}
+		return;
+	}
+
+	path_length = mmjack_osc_string(data, length);
+	if(!path_length || path_length >= length || data[path_length] != ','){
+		return;
+	}
+
+	for(path = 0; path < port->paths; path++){
+		if(!strcmp((char*) data, port->path[path])){
+			break;
+		}
+	}
+
+	types_length = mmjack_osc_string(data + path_length, length - path_length);
+	if(path == port->paths || !types_length){
+		return;
+	}
+
+	event.ident.fields.sub_control = path;
+	offset = path_length + types_length;
+	for(arg = 1; data[path_length + arg] && arg <= 256; arg++){
+		event.ident.fields.sub_channel = arg - 1;
+		skip = 0;
+		switch(data[path_length + arg]){
+			case 'i':
+			case 'f':
+				if(offset + 4 > length){
+					return;
+				}
+				memcpy(&raw.u32, data + offset, 4);
+				raw.u32 = be32toh(raw.u32);
+				event.value = ((data[path_length + arg] == 'i') ? (double) raw.i32 : (double) raw.f) - port->min;
+				event.value /= range;
+				offset += 4;
+				break;
+			case 'h':
+			case 'd':
+				if(offset + 8 > length){
+					return;
+				}
+				memcpy(&raw.u64, data + offset, 8);
+				raw.u64 = be64toh(raw.u64);
+				event.value = ((data[path_length + arg] == 'h') ? (double) raw.i64 : raw.d) - port->min;
+				event.value /= range;
+				offset += 8;
+				break;
+			case 'T':
+				event.value = 1.0;
+				break;
+			case 'F':
+				event.value = 0.0;
+				break;
+			case 'N':
+			case 'I':
+				continue;
+			case 'c':
+			case 'r':
+			case 'm':
+				skip = 4;
+				break;
+			case 't':
+				skip = 8;
+				break;
+			case 's':
+			case 'S':
+				skip = mmjack_osc_string(data + offset, length - offset);
+				if(!skip){
+					return;
+				}
+				break;
+			case 'b':
+				if(offset + 4 > length){
+					return;
+				}
+				memcpy(&element, data + offset, 4);
+				element64 = be32toh(element);
+				skip = 4 + ((element64 + 3) & ~((uint64_t) 3));
+				break;
+			default:
+				//unknown type, the remaining arguments can not be located
+				return;
+		}
+
+		if(skip){
+			if(offset + skip > length){
+				return;
+			}
+			offset += skip;
+			continue;
+		}
+
+		event.value = clamp(event.value, 1.0, 0.0);
+		mmjack_queue_push(port, &event);
+	}
+}
+
+static int mmjack_process_osc(instance* inst, mmjack_port* port, size_t nframes, size_t* mark){
+	mmjack_instance_data* data = (mmjack_instance_data*) inst->impl;
+	void* buffer = jack_port_get_buffer(port->port, nframes);
+	jack_nframes_t event_count = jack_midi_get_event_count(buffer), cycle_start;
+	jack_midi_event_t event;
+	jack_midi_data_t* message;
+	size_t u, frame = 0, path_length, padded_length;
+	union {
+		uint32_t u32;
+		float f;
+	} value;
+
 	if(port->input){
-		//read updated data into the local buffer
-		//FIXME maybe we don't want to always use the first sample...
-		if((double) audio_buffer[0] != port->last){
-			port->last = audio_buffer[0];
-			port->mark = 1;
+		for(u = 0; u < event_count; u++){
+			jack_midi_event_get(&event, buffer, u);
+			mmjack_osc_parse(port, event.buffer, event.size, event.time, 0);
+		}
+
+		if(event_count){
 			*mark = 1;
 		}
 	}
 	else{
-		for(u = 0; u < nframes; u++){
-			audio_buffer[u] = port->last;
+		jack_midi_clear_buffer(buffer);
+
+		cycle_start = jack_last_frame_time(data->client);
+		while(!mmjack_schedule_next(port, cycle_start, nframes, &frame)){
+			//build a message with a single float argument
+			path_length = strlen(port->path[port->next.ident.fields.sub_control]);
+			padded_length = (path_length + 4) & ~((size_t) 3);
+			message = jack_midi_event_reserve(buffer, frame, padded_length + 8);
+			if(!message){
+				LOG("Failed to reserve OSC stream data");
+				continue;
+			}
+
+			memset(message, 0, padded_length + 8);
+			memcpy(message, port->path[port->next.ident.fields.sub_control], path_length);
+			memcpy(message + padded_length, ",f", 2);
+			value.f = port->min + (port->max - port->min) * port->next.value;
+			value.u32 = htobe32(value.u32);
+			memcpy(message + padded_length + 4, &value.u32, 4);
 		}
 	}
 	return 0;
@@ -275,11 +527,15 @@ static int mmjack_process(jack_nframes_t nframes, void* instp){
 	mmjack_instance_data* data = (mmjack_instance_data*) inst->impl;
 	size_t p, mark = 0;
 	int rv = 0;
+	#ifdef __linux__
+	uint64_t notification = 1;
+	#else
+	uint8_t notification = 'c';
+	#endif
 
 	//DBGPF("jack callback for %d frames on %s", nframes, inst->name);
 
 	for(p = 0; p < data->ports; p++){
-		pthread_mutex_lock(&data->port[p].lock);
 		switch(data->port[p].type){
 			case port_midi:
 				//DBGPF("Handling MIDI port %s.%s", inst->name, data->port[p].name);
@@ -289,18 +545,19 @@ static int mmjack_process(jack_nframes_t nframes, void* instp){
 				//DBGPF("Handling CV port %s.%s", inst->name, data->port[p].name);
 				rv |= mmjack_process_cv(inst, data->port + p, nframes, &mark);
 				break;
+			case port_osc:
+				rv |= mmjack_process_osc(inst, data->port + p, nframes, &mark);
+				break;
 			default:
 				LOG("Unhandled port type in processing callback");
-				pthread_mutex_unlock(&data->port[p].lock);
 				return 1;
 		}
-		pthread_mutex_unlock(&data->port[p].lock);
 	}
 
-	//notify the main thread
+	//notify the main thread, a full pipe or counter already guarantees a wakeup
 	if(mark){
 		DBGPF("Notifying handler thread for instance %s", inst->name);
-		if(send(data->fd, "c", 1, 0) != 1){
+		if(write(data->notify_fd, &notification, sizeof(notification)) != sizeof(notification)){
 			DBGPF("Failed to notify main thread on %s", inst->name);
 		}
 	}
@@ -361,6 +618,25 @@ static int mmjack_parse_portconfig(mmjack_port* port, char* spec){
 			}
 			port->max = strtod(token, NULL);
 		}
+		else if(!strcmp(token, "rate")){
+			token = strtok(NULL, " ");
+			if(!token){
+				LOGPF("Port %s configuration missing argument", port->name);
+				return 1;
+			}
+			port->rate = strtod(token, NULL);
+		}
+		else if(!strcmp(token, "threshold")){
+			token = strtok(NULL, " ");
+			if(!token){
+				LOGPF("Port %s configuration missing argument", port->name);
+				return 1;
+			}
+			port->threshold = strtod(token, NULL);
+		}
+		else if(!strcmp(token, "step")){
+			port->step = 1;
+		}
 		else if(!strcmp(token, "min")){
 			token = strtok(NULL, " ");
 			if(!token){
@@ -420,12 +696,12 @@ static int mmjack_configure_instance(instance* inst, char* option, char* value){
 	}
 
 	//add port to registry
-	//TODO for OSC ports we need to configure subchannels for each message
 	data->port = realloc(data->port, (data->ports + 1) * sizeof(mmjack_port));
 	if(!data->port){
 		LOG("Failed to allocate memory");
 		return 1;
 	}
+	memset(data->port + data->ports, 0, sizeof(mmjack_port));
 	data->port[data->ports].name = strdup(option);
 	if(!data->port[data->ports].name){
 		LOG("Failed to allocate memory");
@@ -439,11 +715,14 @@ static int mmjack_configure_instance(instance* inst, char* option, char* value){
 }
 
 static int mmjack_instance(instance* inst){
-	inst->impl = calloc(1, sizeof(mmjack_instance_data));
-	if(!inst->impl){
+	mmjack_instance_data* data = calloc(1, sizeof(mmjack_instance_data));
+	if(!data){
 		LOG("Failed to allocate memory");
 		return 1;
 	}
+
+	data->fd = data->notify_fd = -1;
+	inst->impl = data;
 	return 0;
 }
 
@@ -521,6 +800,61 @@ static int mmjack_parse_midispec(mmjack_channel_ident* ident, char* spec){
 	return 0;
 }
 
+static int mmjack_parse_oscspec(instance* inst, mmjack_port* port, mmjack_channel_ident* ident, char* spec){
+	mmjack_instance_data* data = (mmjack_instance_data*) inst->impl;
+	char* separator = NULL;
+	size_t u, length;
+
+	if(*spec != '.' || spec[1] != '/'){
+		LOGPF("Invalid OSC path specification %s.%s%s", inst->name, port->name, spec);
+		return 1;
+	}
+	spec++;
+
+	//the argument index may be appended as with the osc backend
+	separator = strchr(spec, ':');
+	length = separator ? separator - spec : strlen(spec);
+	if(separator){
+		ident->fields.sub_channel = strtoul(separator + 1, NULL, 10);
+	}
+
+	for(u = 0; u < port->paths; u++){
+		if(strlen(port->path[u]) == length && !strncmp(port->path[u], spec, length)){
+			break;
+		}
+	}
+
+	if(u == port->paths){
+		//the process callback reads the path list without locking
+		if(data->client){
+			LOGPF("OSC paths can not be added to port %s.%s while running", inst->name, port->name);
+			return 1;
+		}
+
+		if(port->paths > 0xFFFF){
+			LOGPF("Too many OSC paths on port %s.%s", inst->name, port->name);
+			return 1;
+		}
+
+		port->path = realloc(port->path, (port->paths + 1) * sizeof(char*));
+		if(!port->path){
+			LOG("Failed to allocate memory");
+			port->paths = 0;
+			return 1;
+		}
+
+		port->path[u] = strndup(spec, length);
+		if(!port->path[u]){
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		port->paths++;
+	}
+
+	ident->fields.sub_control = u;
+	return 0;
+}
+
 static channel* mmjack_channel(instance* inst, char* spec, uint8_t flags){
 	mmjack_instance_data* data = (mmjack_instance_data*) inst->impl;
 	mmjack_channel_ident ident = {
@@ -549,7 +883,9 @@ static channel* mmjack_channel(instance* inst, char* spec, uint8_t flags){
 		}
 	}
 	else if(data->port[u].type == port_osc){
-		//TODO parse osc subspec
+		if(mmjack_parse_oscspec(inst, data->port + u, &ident, spec + strlen(data->port[u].name))){
+			return NULL;
+		}
 	}
 
 	return mm_channel(inst, ident.label, 1);
@@ -560,9 +896,12 @@ static int mmjack_set(instance* inst, size_t num, channel** c, channel_value* v)
 	mmjack_channel_ident ident = {
 		.label = 0
 	};
-	size_t u;
-	double range;
+	size_t u, dropped = 0;
+	double range, cv;
 	uint16_t value;
+	mmjack_event event = {
+		.raw = 0
+	};
 
 	for(u = 0; u < num; u++){
 		ident.label = c[u]->ident;
@@ -573,12 +912,12 @@ static int mmjack_set(instance* inst, size_t num, channel** c, channel_value* v)
 		}
 		range = data->port[ident.fields.port].max - data->port[ident.fields.port].min;
 
-		pthread_mutex_lock(&data->port[ident.fields.port].lock);
 		switch(data->port[ident.fields.port].type){
 			case port_cv:
 				//scale value to given range
-				data->port[ident.fields.port].last = (range * v[u].normalised) + data->port[ident.fields.port].min;
-				DBGPF("CV port %s updated to %f", data->port[ident.fields.port].name, data->port[ident.fields.port].last);
+				cv = (range * v[u].normalised) + data->port[ident.fields.port].min;
+				DBGPF("CV port %s updated to %f", data->port[ident.fields.port].name, cv);
+				dropped += mmjack_queue_push(data->port + ident.fields.port, &cv);
 				break;
 			case port_midi:
 				value = v[u].normalised * 127.0;
@@ -588,79 +927,108 @@ static int mmjack_set(instance* inst, size_t num, channel** c, channel_value* v)
 					value = ((uint16_t)(v[u].normalised * 16383.0));
 				}
 
-				if(mmjack_midiqueue_append(data->port + ident.fields.port, ident, value)){
-					pthread_mutex_unlock(&data->port[ident.fields.port].lock);
-					return 1;
-				}
+				//timestamp the event to schedule it at the same position within the next cycle
+				dropped += mmjack_midiqueue_append(data->port + ident.fields.port, ident, value, jack_frame_time(data->client));
+				break;
+			case port_osc:
+				event.ident.label = ident.label;
+				event.value = v[u].normalised;
+				event.frame = jack_frame_time(data->client);
+				dropped += mmjack_queue_push(data->port + ident.fields.port, &event);
 				break;
 			default:
 				LOGPF("No handler implemented for port type %s.%s", inst->name, data->port[ident.fields.port].name);
 				break;
 		}
-		pthread_mutex_unlock(&data->port[ident.fields.port].lock);
 	}
 
+	if(dropped){
+		LOGPF("Dropped %" PRIsize_t " output events on %s, queue full", dropped, inst->name);
+	}
 	return 0;
 }
 
 static void mmjack_handle_midi(instance* inst, size_t index, mmjack_port* port){
-	size_t u;
+	size_t events = 0;
+	mmjack_event queued;
 	channel* chan = NULL;
 	channel_value val;
 
-	for(u = 0; u < port->queue_len; u++){
-		port->queue[u].ident.fields.port = index;
-		chan = mm_channel(inst, port->queue[u].ident.label, 0);
+	for(; !mmbackend_ring_pop(&port->queue, &queued); events++){
+		queued.ident.fields.port = index;
+		chan = mm_channel(inst, queued.ident.label, 0);
 		if(chan){
-			if(port->queue[u].ident.fields.sub_type == midi_pitchbend
-					|| port->queue[u].ident.fields.sub_type == midi_rpn
-					|| port->queue[u].ident.fields.sub_type == midi_nrpn){
-				val.normalised = ((double)port->queue[u].raw) / 16383.0;
+			if(queued.ident.fields.sub_type == midi_pitchbend
+					|| queued.ident.fields.sub_type == midi_rpn
+					|| queued.ident.fields.sub_type == midi_nrpn){
+				val.normalised = ((double)queued.raw) / 16383.0;
 			}
 			else{
-				val.normalised = ((double)port->queue[u].raw) / 127.0;
+				val.normalised = ((double)queued.raw) / 127.0;
 			}
 			DBGPF("Pushing MIDI channel %d type %02X control %d value %f raw %d label %" PRIu64,
-					port->queue[u].ident.fields.sub_channel,
-					port->queue[u].ident.fields.sub_type,
-					port->queue[u].ident.fields.sub_control,
+					queued.ident.fields.sub_channel,
+					queued.ident.fields.sub_type,
+					queued.ident.fields.sub_control,
 					val.normalised,
-					port->queue[u].raw,
-					port->queue[u].ident.label);
+					queued.raw,
+					queued.ident.label);
 			if(mm_channel_event(chan, val)){
 				LOGPF("Failed to push MIDI event to core on port %s.%s", inst->name, port->name);
 			}
 		}
 	}
 
-	if(port->queue_len){
-		DBGPF("Pushed %" PRIsize_t " MIDI events to core for port %s.%s", port->queue_len, inst->name, port->name);
+	if(events){
+		DBGPF("Pushed %" PRIsize_t " MIDI events to core for port %s.%s", events, inst->name, port->name);
+	}
+}
+
+static void mmjack_handle_osc(instance* inst, size_t index, mmjack_port* port){
+	mmjack_event queued;
+	channel* chan = NULL;
+	channel_value val;
+
+	while(!mmbackend_ring_pop(&port->queue, &queued)){
+		queued.ident.fields.port = index;
+		chan = mm_channel(inst, queued.ident.label, 0);
+		if(chan){
+			val.normalised = queued.value;
+			DBGPF("Pushing OSC path %s argument %d value %f", port->path[queued.ident.fields.sub_control], queued.ident.fields.sub_channel, val.normalised);
+			if(mm_channel_event(chan, val)){
+				LOGPF("Failed to push OSC event to core on port %s.%s", inst->name, port->name);
+			}
+		}
 	}
-	port->queue_len = 0;
 }
 
 static void mmjack_handle_cv(instance* inst, size_t index, mmjack_port* port){
 	mmjack_channel_ident ident = {
 		.fields.port = index
 	};
-	double range;
+	double range, sample;
 	channel_value val;
 
 	channel* chan = mm_channel(inst, ident.label, 0);
 	if(!chan){
 		//this might happen if a channel is registered but not mapped
 		DBGPF("Failed to match CV channel %s.%s to core channel", inst->name, port->name);
+		//discard the queued samples
+		while(!mmbackend_ring_pop(&port->queue, &sample)){
+		}
 		return;
 	}
 
-	//normalize value
 	range = port->max - port->min;
-	val.normalised = port->last - port->min;
-	val.normalised /= range;
-	val.normalised = clamp(val.normalised, 1.0, 0.0);
-	DBGPF("Pushing CV channel %s value %f raw %f min %f max %f", port->name, val.normalised, port->last, port->min, port->max);
-	if(mm_channel_event(chan, val)){
-		LOGPF("Failed to push CV event to core for %s.%s", inst->name, port->name);
+	while(!mmbackend_ring_pop(&port->queue, &sample)){
+		//normalize value
+		val.normalised = sample - port->min;
+		val.normalised /= range;
+		val.normalised = clamp(val.normalised, 1.0, 0.0);
+		DBGPF("Pushing CV channel %s value %f raw %f min %f max %f", port->name, val.normalised, sample, port->min, port->max);
+		if(mm_channel_event(chan, val)){
+			LOGPF("Failed to push CV event to core for %s.%s", inst->name, port->name);
+		}
 	}
 }
 
@@ -668,21 +1036,25 @@ static int mmjack_handle(size_t num, managed_fd* fds){
 	size_t u, p;
 	instance* inst = NULL;
 	mmjack_instance_data* data = NULL;
-	ssize_t bytes;
-	uint8_t recv_buf[1024];
+	uint64_t overflow;
+	uint8_t recv_buf[64];
 
 	for(u = 0; u < num; u++){
 		inst = (instance*) fds[u].impl;
 		data = (mmjack_instance_data*) inst->impl;
-		bytes = recv(fds[u].fd, recv_buf, sizeof(recv_buf), 0);
-		if(bytes < 0){
-			LOGPF("Failed to receive on feedback socket for instance %s", inst->name);
+		//reset the notification, the queues are drained completely below
+		if(read(fds[u].fd, recv_buf, sizeof(recv_buf)) < 0 && errno != EAGAIN){
+			LOGPF("Failed to read notification for instance %s: %s", inst->name, strerror(errno));
 			return 1;
 		}
 
 		for(p = 0; p < data->ports; p++){
-			if(data->port[p].input && data->port[p].mark){
-				pthread_mutex_lock(&data->port[p].lock);
+			overflow = __atomic_exchange_n(&data->port[p].overflow, 0, __ATOMIC_RELAXED);
+			if(overflow && data->port[p].input){
+				LOGPF("Dropped %" PRIu64 " input events on port %s.%s, queue full", overflow, inst->name, data->port[p].name);
+			}
+
+			if(data->port[p].input){
 				switch(data->port[p].type){
 					case port_cv:
 						mmjack_handle_cv(inst, p, data->port + p);
@@ -690,13 +1062,13 @@ static int mmjack_handle(size_t num, managed_fd* fds){
 					case port_midi:
 						mmjack_handle_midi(inst, p, data->port + p);
 						break;
+					case port_osc:
+						mmjack_handle_osc(inst, p, data->port + p);
+						break;
 					default:
 						LOGPF("Output handler not implemented for unknown channel type on %s.%s", inst->name, data->port[p].name);
 						break;
 				}
-
-				data->port[p].mark = 0;
-				pthread_mutex_unlock(&data->port[p].lock);
 			}
 		}
 	}
@@ -708,10 +1080,29 @@ static int mmjack_handle(size_t num, managed_fd* fds){
 	return 0;
 }
 
+static int mmjack_notify_open(mmjack_instance_data* data){
+	#ifdef __linux__
+	data->fd = data->notify_fd = eventfd(0, EFD_NONBLOCK);
+	return (data->fd < 0) ? 1 : 0;
+	#else
+	int notify[2];
+	if(pipe(notify)){
+		return 1;
+	}
+
+	data->fd = notify[0];
+	data->notify_fd = notify[1];
+	if(fcntl(data->fd, F_SETFL, fcntl(data->fd, F_GETFL, 0) | O_NONBLOCK) < 0
+			|| fcntl(data->notify_fd, F_SETFL, fcntl(data->notify_fd, F_GETFL, 0) | O_NONBLOCK) < 0){
+		return 1;
+	}
+	return 0;
+	#endif
+}
+
 static int mmjack_start(size_t n, instance** inst){
-	int rv = 1, feedback_fd[2];
+	int rv = 1;
 	size_t u, p;
-	pthread_mutexattr_t mutex_attr;
 	mmjack_instance_data* data = NULL;
 	jack_status_t error;
 
@@ -725,13 +1116,6 @@ static int mmjack_start(size_t n, instance** inst){
 		jack_set_info_function(mmjack_message_print);
 	}
 
-	//prepare mutex attributes because the initializer macro for adaptive mutexes is a GNU extension...
-	if(pthread_mutexattr_init(&mutex_attr)
-			|| pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_ADAPTIVE_NP)){
-		LOG("Failed to initialize mutex attributes");
-		goto bail;
-	}
-
 	for(u = 0; u < n; u++){
 		data = (mmjack_instance_data*) inst[u]->impl;
 
@@ -747,14 +1131,13 @@ static int mmjack_start(size_t n, instance** inst){
 			goto bail;
 		}
 
-		//set up the feedback fd
-		if(socketpair(AF_LOCAL, SOCK_DGRAM, 0, feedback_fd)){
-			LOG("Failed to create feedback socket pair");
+		//set up the notification fd, the process callback must never block on it
+		if(mmjack_notify_open(data)){
+			LOGPF("Failed to create notification descriptor for instance %s: %s", inst[u]->name, strerror(errno));
 			goto bail;
 		}
 
-		data->fd = feedback_fd[0];
-		if(mm_manage_fd(feedback_fd[1], BACKEND_NAME, 1, inst[u])){
+		if(mm_manage_fd(data->fd, BACKEND_NAME, 1, inst[u])){
 			LOG("Failed to register feedback FD with core");
 			goto bail;
 		}
@@ -767,14 +1150,26 @@ static int mmjack_start(size_t n, instance** inst){
 
 		//create and initialize jack ports
 		for(p = 0; p < data->ports; p++){
-			if(pthread_mutex_init(&(data->port[p].lock), &mutex_attr)){
-				LOG("Failed to create port mutex");
+			if(mmbackend_ring_init(&data->port[p].queue, JACK_QUEUE_LENGTH,
+						(data->port[p].type == port_cv) ? sizeof(double) : sizeof(mmjack_event))){
 				goto bail;
 			}
 
+			//calculate the CV analysis block length for the control rate
+			if(data->port[p].type == port_cv && data->port[p].rate > 0){
+				data->port[p].block = max(1, jack_get_sample_rate(data->client) / data->port[p].rate);
+			}
+
+			//OSC values are mapped from the unit range by default
+			if(data->port[p].type == port_osc && data->port[p].max == data->port[p].min){
+				data->port[p].min = 0.0;
+				data->port[p].max = 1.0;
+			}
+
 			data->port[p].port = jack_port_register(data->client,
 					data->port[p].name,
-					(data->port[p].type == port_cv) ? JACK_DEFAULT_AUDIO_TYPE : JACK_DEFAULT_MIDI_TYPE,
+					(data->port[p].type == port_cv) ? JACK_DEFAULT_AUDIO_TYPE
+						: ((data->port[p].type == port_osc) ? JACK_DEFAULT_OSC_TYPE : JACK_DEFAULT_MIDI_TYPE),
 					data->port[p].input ? JackPortIsInput : JackPortIsOutput,
 					0);
 
@@ -796,12 +1191,11 @@ static int mmjack_start(size_t n, instance** inst){
 	LOGPF("Registered %" PRIsize_t " descriptors to core", n);
 	rv = 0;
 bail:
-	pthread_mutexattr_destroy(&mutex_attr);
 	return rv;
 }
 
 static int mmjack_shutdown(size_t n, instance** inst){
-	size_t u, p;
+	size_t u, p, c;
 	mmjack_instance_data* data = NULL;
 
 	for(u = 0; u < n; u++){
@@ -821,11 +1215,14 @@ static int mmjack_shutdown(size_t n, instance** inst){
 			free(data->port[p].name);
 			data->port[p].name = NULL;
 
-			free(data->port[p].queue);
-			data->port[p].queue = NULL;
-			data->port[p].queue_alloc = data->port[p].queue_len = 0;
+			for(c = 0; c < data->port[p].paths; c++){
+				free(data->port[p].path[c]);
+			}
+			free(data->port[p].path);
+			data->port[p].path = NULL;
+			data->port[p].paths = 0;
 
-			pthread_mutex_destroy(&data->port[p].lock);
+			mmbackend_ring_free(&data->port[p].queue);
 		}
 
 		//terminate jack connection
@@ -838,8 +1235,13 @@ static int mmjack_shutdown(size_t n, instance** inst){
 		data->server_name = NULL;
 		free(data->client_name);
 		data->client_name = NULL;
-		close(data->fd);
-		data->fd = -1;
+		if(data->notify_fd >= 0 && data->notify_fd != data->fd){
+			close(data->notify_fd);
+		}
+		if(data->fd >= 0){
+			close(data->fd);
+		}
+		data->fd = data->notify_fd = -1;
 
 		free(inst[u]->impl);
 	}
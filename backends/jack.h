@@ -1,6 +1,5 @@
 #include "midimonster.h"
 #include <jack/jack.h>
-#include <pthread.h>
 
 MM_PLUGIN_API int init();
 static int mmjack_configure(char* option, char* value);
@@ -14,7 +13,15 @@ static int mmjack_shutdown(size_t n, instance** inst);
 
 #define JACK_DEFAULT_CLIENT_NAME "MIDIMonster"
 #define JACK_DEFAULT_SERVER_NAME "default"
-#define JACK_MIDIQUEUE_CHUNK 10
+//events buffered per port between the JACK process callback and the main thread
+#define JACK_QUEUE_LENGTH 1024
+//maximum nesting depth for incoming OSC bundles
+#define JACK_OSC_BUNDLE_DEPTH 4
+
+//jack2 defines this since 1.9.13
+#ifndef JACK_DEFAULT_OSC_TYPE
+	#define JACK_DEFAULT_OSC_TYPE "8 bit raw OSC"
+#endif
 
 #define EPN_NRPN 8
 #define EPN_PARAMETER_HI 4
@@ -43,6 +50,9 @@ typedef union {
 	uint64_t label;
 } mmjack_channel_ident;
 
+//float vector for CV buffer averaging, unaligned access is needed since JACK buffers are only sample-aligned
+typedef float mmjack_cv_vector __attribute__((vector_size(16), aligned(4), __may_alias__));
+
 typedef enum /*_mmjack_port_type*/ {
 	port_none = 0,
 	port_midi,
@@ -50,10 +60,15 @@ typedef enum /*_mmjack_port_type*/ {
 	port_cv
 } mmjack_port_type;
 
-typedef struct /*_mmjack_midiqueue_entry*/ {
+typedef struct /*_mmjack_event*/ {
 	mmjack_channel_ident ident;
+	//MIDI value
 	uint16_t raw;
-} mmjack_midiqueue;
+	//JACK frame time of the event
+	jack_nframes_t frame;
+	//normalised OSC argument value
+	double value;
+} mmjack_event;
 
 typedef struct /*_mmjack_port_data*/ {
 	char* name;
@@ -63,24 +78,38 @@ typedef struct /*_mmjack_port_data*/ {
 
 	double max;
 	double min;
-	uint8_t mark;
+	//last CV value, only accessed from the process callback
 	double last;
+	//CV input control rate (events per second, 0 for once per period) and change threshold
+	double rate;
+	double threshold;
+	size_t block;
+	//disable CV output ramps
+	uint8_t step;
 
-	size_t queue_len;
-	size_t queue_alloc;
-	mmjack_midiqueue* queue;
+	//lock-free event queue, filled by the process callback for inputs and by the main thread for outputs
+	mmbackend_ring queue;
+	//events dropped because the queue was full
+	uint64_t overflow;
+	//output event scheduled for a later cycle, only accessed from the process callback
+	uint8_t pending;
+	mmjack_event next;
 
 	uint16_t epn_control[16];
 	uint16_t epn_value[16];
 	uint8_t epn_status[16];
 
-	pthread_mutex_t lock;
+	//OSC paths mapped on this port, indexed by ident.fields.sub_control
+	size_t paths;
+	char** path;
 } mmjack_port;
 
 typedef struct /*_jack_instance_data*/ {
 	char* server_name;
 	char* client_name;
+	//wakeup descriptor registered to the core and the descriptor signaled from the process callback
 	int fd;
+	int notify_fd;
 
 	uint8_t midi_epn_tx_short;
 
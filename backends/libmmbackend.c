@@ -1,5 +1,9 @@
 #include "libmmbackend.h"
+//core API used for managing descriptor interest
+#include "../midimonster.h"
 
+#undef LOGPF
+#undef LOG
 #define LOGPF(format, ...) fprintf(stderr, "libmmbe\t" format "\n", __VA_ARGS__)
 #define LOG(message) fprintf(stderr, "libmmbe\t%s\n", (message))
 
@@ -175,6 +179,13 @@ int mmbackend_socket(char* host, char* port, int socktype, uint8_t listener, uin
 			LOGPF("Failed to %s dualstack operations on socket: %s", dualstack ? "enable" : "disable", mmbackend_socket_strerror(errno));
 		}
 
+		#ifdef SO_REUSEPORT
+		yes = 1;
+		if(listener > 1 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void*) &yes, sizeof(yes)) < 0){
+			LOGPF("Failed to enable SO_REUSEPORT on socket: %s", mmbackend_socket_strerror(errno));
+		}
+		#endif
+
 		if(mcast){
 			yes = 1;
 			if(setsockopt(fd, SOL_SOCKET, SO_BROADCAST, (void*) &yes, sizeof(yes)) < 0){
@@ -230,6 +241,54 @@ int mmbackend_socket(char* host, char* port, int socktype, uint8_t listener, uin
 	return fd;
 }
 
+int mmbackend_socket_connect(struct sockaddr_storage* addr, socklen_t len, uint8_t* pending){
+	int fd = socket(addr->ss_family, SOCK_STREAM, 0), status;
+	#ifdef _WIN32
+	u_long mode = 1;
+	#endif
+
+	*pending = 0;
+	if(fd < 0){
+		LOGPF("Failed to create socket: %s", mmbackend_socket_strerror(errno));
+		return -1;
+	}
+
+	//set nonblocking before connecting
+	#ifdef _WIN32
+	if(ioctlsocket(fd, FIONBIO, &mode) != NO_ERROR){
+	#else
+	if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0){
+	#endif
+		LOGPF("Failed to set socket nonblocking: %s", mmbackend_socket_strerror(errno));
+		closesocket(fd);
+		return -1;
+	}
+
+	status = connect(fd, (struct sockaddr*) addr, len);
+	#ifdef _WIN32
+	if(status < 0 && WSAGetLastError() != WSAEWOULDBLOCK){
+	#else
+	if(status < 0 && errno != EINPROGRESS){
+	#endif
+		LOGPF("Failed to connect: %s", mmbackend_socket_strerror(errno));
+		closesocket(fd);
+		return -1;
+	}
+
+	*pending = status ? 1 : 0;
+	return fd;
+}
+
+int mmbackend_socket_connected(int fd){
+	int error = 0;
+	socklen_t error_len = sizeof(error);
+
+	if(getsockopt(fd, SOL_SOCKET, SO_ERROR, (void*) &error, &error_len)){
+		return errno ? errno : 1;
+	}
+	return error;
+}
+
 int mmbackend_send(int fd, uint8_t* data, size_t length){
 	ssize_t total = 0, sent;
 	while(total < length){
@@ -251,6 +310,423 @@ int mmbackend_send_str(int fd, char* data){
 	return mmbackend_send(fd, (uint8_t*) data, strlen(data));
 }
 
+//returns the number of bytes written, -1 on failure
+static ssize_t mmbackend_queue_write(int fd, uint8_t* data, size_t length){
+	int flags = 0;
+	ssize_t sent;
+
+	//report closed connections as errors instead of raising SIGPIPE
+	#ifdef MSG_NOSIGNAL
+	flags = MSG_NOSIGNAL;
+	#endif
+
+	#ifndef LIBMMBACKEND_TCP_TORTURE
+	sent = send(fd, data, length, flags);
+	#else
+	sent = send(fd, data, 1, flags);
+	#endif
+
+	if(sent < 0){
+		#ifdef _WIN32
+		if(WSAGetLastError() == WSAEWOULDBLOCK){
+		#else
+		if(errno == EAGAIN || errno == EWOULDBLOCK){
+		#endif
+			return 0;
+		}
+		LOGPF("Failed to send: %s", mmbackend_socket_strerror(errno));
+		return -1;
+	}
+	return sent;
+}
+
+static void mmbackend_queue_interest(mmbackend_queue* queue, uint8_t writable){
+	if(queue->writable != writable){
+		mm_manage_fd(queue->fd, queue->backend, mmfd_read | (writable ? mmfd_write : 0), queue->impl);
+		queue->writable = writable;
+	}
+}
+
+void mmbackend_queue_init(mmbackend_queue* queue, int fd, char* backend, void* impl, size_t high_water, mmbackend_queue_policy policy){
+	queue->fd = fd;
+	queue->backend = backend;
+	queue->impl = impl;
+	queue->high_water = high_water;
+	queue->policy = policy;
+
+	queue->head = queue->length = 0;
+	queue->messages = 0;
+	queue->writable = 0;
+}
+
+int mmbackend_queue_send(mmbackend_queue* queue, uint8_t* data, size_t length, uint64_t key){
+	size_t u, pending = queue->length - queue->head;
+	ssize_t sent = 0;
+
+	if(key){
+		//merge with a queued message that has not been started yet
+		for(u = 0; u < queue->messages; u++){
+			if(queue->message[u].key == key
+					&& queue->message[u].offset >= queue->head
+					&& queue->message[u].length == length){
+				memcpy(queue->data + queue->message[u].offset, data, length);
+				return 0;
+			}
+		}
+	}
+
+	if(!pending){
+		sent = mmbackend_queue_write(queue->fd, data, length);
+		if(sent < 0){
+			return 1;
+		}
+		else if(sent == length){
+			return 0;
+		}
+		//the remainder needs to be queued regardless of the limit to keep the stream intact
+	}
+	else if(queue->high_water && pending + length > queue->high_water){
+		if(queue->policy == mmbackend_queue_fail){
+			LOGPF("Output queue exceeded %" PRIsize_t " bytes", queue->high_water);
+			return 1;
+		}
+		queue->dropped++;
+		return 2;
+	}
+
+	//compact the buffer when the unsent data would not fit behind the sent part
+	if(queue->head && queue->length + length - sent > queue->alloc){
+		memmove(queue->data, queue->data + queue->head, pending);
+		for(u = 0; u < queue->messages; u++){
+			if(queue->message[u].offset >= queue->head){
+				queue->message[u].offset -= queue->head;
+			}
+			else{
+				//already started, can not be merged anymore
+				queue->message[u] = queue->message[queue->messages - 1];
+				queue->messages--;
+				u--;
+			}
+		}
+		queue->length = pending;
+		queue->head = 0;
+	}
+
+	if(queue->length + length - sent > queue->alloc){
+		queue->data = realloc(queue->data, max(queue->length + length - sent, 2 * queue->alloc));
+		if(!queue->data){
+			queue->alloc = queue->head = queue->length = 0;
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		queue->alloc = max(queue->length + length - sent, 2 * queue->alloc);
+	}
+
+	if(key && !sent){
+		queue->message = realloc(queue->message, (queue->messages + 1) * sizeof(mmbackend_queue_message));
+		if(!queue->message){
+			queue->messages = 0;
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		queue->message[queue->messages].key = key;
+		queue->message[queue->messages].offset = queue->length;
+		queue->message[queue->messages].length = length;
+		queue->messages++;
+	}
+
+	memcpy(queue->data + queue->length, data + sent, length - sent);
+	queue->length += length - sent;
+	mmbackend_queue_interest(queue, 1);
+	return 0;
+}
+
+int mmbackend_queue_flush(mmbackend_queue* queue){
+	ssize_t sent;
+
+	while(queue->head < queue->length){
+		sent = mmbackend_queue_write(queue->fd, queue->data + queue->head, queue->length - queue->head);
+		if(sent < 0){
+			return 1;
+		}
+		else if(!sent){
+			//wait for the next writability notification
+			return 0;
+		}
+		queue->head += sent;
+	}
+
+	queue->head = queue->length = 0;
+	queue->messages = 0;
+	mmbackend_queue_interest(queue, 0);
+	return 0;
+}
+
+size_t mmbackend_queue_pending(mmbackend_queue* queue){
+	return queue->length - queue->head;
+}
+
+void mmbackend_queue_free(mmbackend_queue* queue){
+	free(queue->data);
+	free(queue->message);
+	queue->data = NULL;
+	queue->message = NULL;
+	queue->alloc = queue->head = queue->length = 0;
+	queue->messages = 0;
+}
+
+int mmbackend_ring_init(mmbackend_ring* ring, size_t capacity, size_t element_size){
+	size_t size = 1;
+
+	//round up to allow masking instead of modulo operations
+	for(; size < capacity; size <<= 1){
+	}
+
+	ring->data = calloc(size, element_size);
+	if(!ring->data){
+		LOG("Failed to allocate memory");
+		return 1;
+	}
+
+	ring->capacity = size;
+	ring->element_size = element_size;
+	ring->head = 0;
+	ring->tail = 0;
+	return 0;
+}
+
+int mmbackend_ring_push(mmbackend_ring* ring, void* element){
+	size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+	if(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->capacity){
+		return 1;
+	}
+
+	memcpy(ring->data + (head & (ring->capacity - 1)) * ring->element_size, element, ring->element_size);
+	//publish the element only after it has been written
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int mmbackend_ring_pop(mmbackend_ring* ring, void* element){
+	size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+	if(tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)){
+		return 1;
+	}
+
+	memcpy(element, ring->data + (tail & (ring->capacity - 1)) * ring->element_size, ring->element_size);
+	//release the slot only after it has been read
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void mmbackend_ring_free(mmbackend_ring* ring){
+	free(ring->data);
+	ring->data = NULL;
+	ring->capacity = 0;
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+void mmbackend_stream_init(mmbackend_stream* stream, size_t limit){
+	stream->limit = limit;
+	stream->head = stream->parsed = stream->tail = 0;
+	stream->fragment_opcode = 0;
+	stream->fragment_offset = stream->fragment_length = 0;
+}
+
+//release data handed out by the last extraction
+static void mmbackend_stream_release(mmbackend_stream* stream){
+	//parts of a fragmented message need to stay in place
+	if(!stream->fragment_opcode){
+		stream->head = stream->parsed;
+	}
+
+	if(stream->head == stream->tail){
+		stream->head = stream->parsed = stream->tail = 0;
+	}
+}
+
+ssize_t mmbackend_stream_recv(mmbackend_stream* stream, int fd){
+	ssize_t bytes_read;
+	size_t size;
+
+	mmbackend_stream_release(stream);
+
+	if(stream->alloc - stream->tail < MMBACKEND_STREAM_CHUNK){
+		//move pending data to the front
+		if(stream->head){
+			memmove(stream->data, stream->data + stream->head, stream->tail - stream->head);
+			stream->parsed -= stream->head;
+			stream->tail -= stream->head;
+			stream->fragment_offset -= stream->fragment_opcode ? stream->head : 0;
+			stream->head = 0;
+		}
+
+		//grow the buffer if that did not free enough space
+		if(stream->alloc - stream->tail < MMBACKEND_STREAM_CHUNK){
+			size = min(stream->alloc ? stream->alloc * 2 : MMBACKEND_STREAM_CHUNK, stream->limit);
+			if(size <= stream->tail){
+				LOG("Stream buffer limit exceeded");
+				return -1;
+			}
+
+			if(size > stream->alloc){
+				stream->data = realloc(stream->data, size);
+				if(!stream->data){
+					stream->alloc = 0;
+					mmbackend_stream_init(stream, stream->limit);
+					LOG("Failed to allocate memory");
+					return -1;
+				}
+				stream->alloc = size;
+			}
+		}
+	}
+
+	bytes_read = recv(fd, (char*) stream->data + stream->tail, stream->alloc - stream->tail, 0);
+	if(bytes_read > 0){
+		stream->tail += bytes_read;
+	}
+	return bytes_read;
+}
+
+int mmbackend_stream_line(mmbackend_stream* stream, char** line, size_t* length){
+	size_t n;
+
+	mmbackend_stream_release(stream);
+
+	for(n = stream->parsed; n + 1 < stream->tail; n++){
+		if(stream->data[n] == '\r' && stream->data[n + 1] == '\n'){
+			*line = (char*) stream->data + stream->parsed;
+			*length = n - stream->parsed;
+			stream->parsed = n + 2;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int mmbackend_stream_ws(mmbackend_stream* stream, mmbackend_ws_frame* frame){
+	uint8_t* header = NULL, *mask = NULL, *payload = NULL, opcode, fin;
+	size_t available, header_length, n;
+	uint64_t payload_length;
+
+	mmbackend_stream_release(stream);
+
+	//non-final fragments are merged without returning
+	while(1){
+		header = stream->data + stream->parsed;
+		available = stream->tail - stream->parsed;
+		if(available < 2){
+			return 0;
+		}
+
+		fin = header[0] & 0x80;
+		opcode = header[0] & 0x0F;
+		payload_length = header[1] & 0x7F;
+		header_length = 2;
+
+		//extended payload lengths are transmitted in network byte order
+		if(payload_length == 126){
+			if(available < 4){
+				return 0;
+			}
+			payload_length = (header[2] << 8) | header[3];
+			header_length = 4;
+		}
+		else if(payload_length == 127){
+			if(available < 10){
+				return 0;
+			}
+			for(payload_length = 0, n = 2; n < 10; n++){
+				payload_length = (payload_length << 8) | header[n];
+			}
+			header_length = 10;
+		}
+
+		mask = NULL;
+		if(header[1] & 0x80){
+			mask = header + header_length;
+			header_length += 4;
+		}
+
+		//complete messages need to fit into the buffer
+		if(payload_length > stream->limit
+				|| stream->parsed - stream->head + header_length + payload_length > stream->limit){
+			LOG("Websocket message exceeds buffer limit");
+			return -1;
+		}
+
+		if(available < header_length + payload_length){
+			return 0;
+		}
+
+		payload = header + header_length;
+		stream->parsed += header_length + payload_length;
+		if(mask){
+			for(n = 0; n < payload_length; n++){
+				payload[n] ^= mask[n % 4];
+			}
+		}
+
+		//control frames may be interleaved with fragments
+		if(opcode & 0x08){
+			if(!fin || payload_length > 125){
+				LOG("Invalid websocket control frame");
+				return -1;
+			}
+			break;
+		}
+
+		if(opcode == mmbackend_ws_continuation){
+			if(!stream->fragment_opcode){
+				LOG("Unexpected websocket continuation frame");
+				return -1;
+			}
+
+			//append to the message in place, overwriting the intermediate frame header
+			memmove(stream->data + stream->fragment_offset + stream->fragment_length, payload, payload_length);
+			stream->fragment_length += payload_length;
+			if(!fin){
+				continue;
+			}
+
+			frame->opcode = stream->fragment_opcode;
+			frame->payload = stream->data + stream->fragment_offset;
+			frame->length = stream->fragment_length;
+			stream->fragment_opcode = 0;
+			return 1;
+		}
+
+		if(stream->fragment_opcode){
+			LOG("Fragmented websocket message interrupted");
+			return -1;
+		}
+
+		if(!fin){
+			stream->fragment_opcode = opcode;
+			stream->fragment_offset = payload - stream->data;
+			stream->fragment_length = payload_length;
+			continue;
+		}
+		break;
+	}
+
+	frame->opcode = opcode;
+	frame->payload = payload;
+	frame->length = payload_length;
+	return 1;
+}
+
+void mmbackend_stream_free(mmbackend_stream* stream){
+	free(stream->data);
+	stream->data = NULL;
+	stream->alloc = 0;
+	mmbackend_stream_init(stream, stream->limit);
+}
+
 json_type json_identify(char* json, size_t length){
 	size_t n;
 
@@ -680,3 +1156,276 @@ char* json_array_strdup(char* json, uint64_t key){
 	}
 	return rv;
 }
+
+static size_t json_index_skip(json_index* index, size_t offset){
+	for(; offset < index->length && isspace(index->json[offset]); offset++){
+	}
+	return offset;
+}
+
+static int json_index_reserve(json_index* index){
+	if(index->tokens == index->alloc){
+		index->token = realloc(index->token, (index->alloc + JSON_INDEX_CHUNK) * sizeof(json_token));
+		if(!index->token){
+			index->alloc = index->tokens = 0;
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		index->alloc += JSON_INDEX_CHUNK;
+	}
+	return 0;
+}
+
+//returns the offset following the value or 0 on failure
+static size_t json_index_value(json_index* index, size_t offset, size_t depth){
+	char* json = index->json, terminator;
+	size_t current, end;
+
+	offset = json_index_skip(index, offset);
+	if(offset >= index->length || depth > JSON_INDEX_DEPTH
+			|| json_index_reserve(index)){
+		return 0;
+	}
+
+	current = index->tokens++;
+	index->token[current].type = JSON_INVALID;
+	index->token[current].offset = offset;
+	index->token[current].children = 0;
+
+	switch(json[offset]){
+		case '{':
+		case '[':
+			index->token[current].type = (json[offset] == '{') ? JSON_OBJECT : JSON_ARRAY;
+			terminator = (json[offset] == '{') ? '}' : ']';
+			offset = json_index_skip(index, offset + 1);
+			if(offset < index->length && json[offset] == terminator){
+				offset++;
+				break;
+			}
+
+			while(1){
+				if(index->token[current].type == JSON_OBJECT){
+					//member key
+					offset = json_index_skip(index, offset);
+					if(offset >= index->length || json[offset] != '"'){
+						return 0;
+					}
+					offset = json_index_value(index, offset, depth + 1);
+					if(!offset){
+						return 0;
+					}
+					offset = json_index_skip(index, offset);
+					if(offset >= index->length || json[offset] != ':'){
+						return 0;
+					}
+					offset++;
+				}
+
+				offset = json_index_value(index, offset, depth + 1);
+				if(!offset){
+					return 0;
+				}
+				index->token[current].children++;
+
+				offset = json_index_skip(index, offset);
+				if(offset >= index->length){
+					return 0;
+				}
+				else if(json[offset] == terminator){
+					offset++;
+					break;
+				}
+				else if(json[offset] != ','){
+					return 0;
+				}
+				offset++;
+			}
+			break;
+		case '"':
+			//find terminating quotation mark, skipping escaped characters
+			for(end = offset + 1; end < index->length && json[end] != '"'; end++){
+				if(json[end] == '\\'){
+					end++;
+				}
+			}
+			if(end >= index->length){
+				return 0;
+			}
+			index->token[current].type = JSON_STRING;
+			index->token[current].offset = offset + 1;
+			index->token[current].length = end - offset - 1;
+			index->token[current].next = index->tokens;
+			return end + 1;
+		default:
+			if(index->length - offset >= 4 && !strncmp(json + offset, "null", 4)){
+				index->token[current].type = JSON_NULL;
+				offset += 4;
+			}
+			else if(index->length - offset >= 4 && !strncmp(json + offset, "true", 4)){
+				index->token[current].type = JSON_BOOL;
+				offset += 4;
+			}
+			else if(index->length - offset >= 5 && !strncmp(json + offset, "false", 5)){
+				index->token[current].type = JSON_BOOL;
+				offset += 5;
+			}
+			else if(json[offset] == '-' || isdigit(json[offset])){
+				index->token[current].type = JSON_NUMBER;
+				for(offset++; offset < index->length &&
+						(isdigit(json[offset])
+						 || json[offset] == '+'
+						 || json[offset] == '-'
+						 || json[offset] == '.'
+						 || tolower(json[offset]) == 'e'); offset++){
+				}
+			}
+			else{
+				return 0;
+			}
+	}
+
+	index->token[current].length = offset - index->token[current].offset;
+	index->token[current].next = index->tokens;
+	return offset;
+}
+
+int json_index_parse(json_index* index, char* json, size_t length){
+	size_t offset;
+
+	index->json = json;
+	index->length = length;
+	index->tokens = 0;
+
+	//token 0 is reserved to signal absent values
+	if(json_index_reserve(index)){
+		return 1;
+	}
+	index->token[0].type = JSON_INVALID;
+	index->token[0].offset = index->token[0].length = index->token[0].children = 0;
+	index->token[0].next = JSON_INDEX_ROOT;
+	index->tokens = JSON_INDEX_ROOT;
+
+	offset = json_index_value(index, 0, 0);
+	//only trailing whitespace is permitted after the document
+	if(!offset || json_index_skip(index, offset) != length){
+		index->tokens = 0;
+		return 1;
+	}
+	return 0;
+}
+
+json_type json_index_type(json_index* index, size_t token){
+	if(!token || token >= index->tokens){
+		return JSON_INVALID;
+	}
+	return index->token[token].type;
+}
+
+size_t json_index_obj(json_index* index, size_t token, char* key){
+	size_t member, n, key_length = strlen(key);
+
+	if(json_index_type(index, token) != JSON_OBJECT){
+		return 0;
+	}
+
+	//members are stored as key token followed by the value
+	for(n = 0, member = token + 1; n < index->token[token].children; n++){
+		if(index->token[member].length == key_length
+				&& !memcmp(index->json + index->token[member].offset, key, key_length)){
+			return member + 1;
+		}
+		member = index->token[member + 1].next;
+	}
+	return 0;
+}
+
+size_t json_index_array(json_index* index, size_t token, uint64_t key){
+	size_t element, n;
+
+	if(json_index_type(index, token) != JSON_ARRAY
+			|| key >= index->token[token].children){
+		return 0;
+	}
+
+	for(n = 0, element = token + 1; n < key; n++){
+		element = index->token[element].next;
+	}
+	return element;
+}
+
+size_t json_index_first(json_index* index, size_t parent){
+	if(!json_index_type(index, parent) || !index->token[parent].children){
+		return 0;
+	}
+	return (index->token[parent].type == JSON_OBJECT) ? parent + 2 : parent + 1;
+}
+
+size_t json_index_next(json_index* index, size_t parent, size_t token){
+	size_t next;
+
+	if(!json_index_type(index, token) || !json_index_type(index, parent)){
+		return 0;
+	}
+
+	next = index->token[token].next;
+	if(next >= index->token[parent].next){
+		return 0;
+	}
+	return (index->token[parent].type == JSON_OBJECT) ? next + 1 : next;
+}
+
+uint8_t json_index_bool(json_index* index, size_t token, uint8_t fallback){
+	if(json_index_type(index, token) != JSON_BOOL){
+		return fallback;
+	}
+	return (index->json[index->token[token].offset] == 't') ? 1 : 0;
+}
+
+int64_t json_index_int(json_index* index, size_t token, int64_t fallback){
+	char number[JSON_INDEX_NUMBER] = "";
+
+	if(json_index_type(index, token) != JSON_NUMBER){
+		return fallback;
+	}
+	//the document is not necessarily terminated
+	memcpy(number, index->json + index->token[token].offset, min(index->token[token].length, sizeof(number) - 1));
+	return strtoll(number, NULL, 10);
+}
+
+double json_index_double(json_index* index, size_t token, double fallback){
+	char number[JSON_INDEX_NUMBER] = "";
+
+	if(json_index_type(index, token) != JSON_NUMBER){
+		return fallback;
+	}
+	memcpy(number, index->json + index->token[token].offset, min(index->token[token].length, sizeof(number) - 1));
+	return strtod(number, NULL);
+}
+
+char* json_index_str(json_index* index, size_t token, size_t* length){
+	if(json_index_type(index, token) != JSON_STRING){
+		return NULL;
+	}
+	if(length){
+		*length = index->token[token].length;
+	}
+	return index->json + index->token[token].offset;
+}
+
+char* json_index_strdup(json_index* index, size_t token){
+	size_t len = 0;
+	char* value = json_index_str(index, token, &len), *rv = NULL;
+	if(value){
+		rv = calloc(len + 1, sizeof(char));
+		if(rv){
+			memcpy(rv, value, len);
+		}
+	}
+	return rv;
+}
+
+void json_index_free(json_index* index){
+	free(index->token);
+	index->token = NULL;
+	index->alloc = index->tokens = 0;
+}
@@ -70,10 +70,28 @@ int mmbackend_parse_sockaddr(char* host, char* port, struct sockaddr_storage* ad
 
 /* 
  * Create a socket of given type and mode for a bind / connect host.
+ * Setting listener to 2 additionally enables SO_REUSEPORT (where available),
+ * allowing multiple sockets to be bound to the same address and port.
  * Returns -1 on failure, a valid file descriptor for the socket on success.
  */
 int mmbackend_socket(char* host, char* port, int socktype, uint8_t listener, uint8_t mcast, uint8_t dualstack);
 
+/*
+ * Start a nonblocking stream connection to an address resolved in advance
+ * (e.g. via mmbackend_parse_sockaddr), without waiting for it to be established.
+ * Returns -1 on failure, a valid nonblocking file descriptor on success.
+ * If the connection is still in progress, `pending` is set to 1 and the
+ * descriptor becomes writable once the attempt completes, at which point
+ * mmbackend_socket_connected should be called to check the result.
+ */
+int mmbackend_socket_connect(struct sockaddr_storage* addr, socklen_t len, uint8_t* pending);
+
+/*
+ * Check the result of a pending connection attempt started by mmbackend_socket_connect.
+ * Returns 0 if the connection was established, an error number otherwise.
+ */
+int mmbackend_socket_connected(int fd);
+
 /*
  * Send arbitrary data over multiple writes if necessary
  * Returns 1 on failure, 0 on success.
@@ -85,6 +103,203 @@ int mmbackend_send(int fd, uint8_t* data, size_t length);
  */
 int mmbackend_send_str(int fd, char* data);
 
+/** Nonblocking output queues **/
+
+/*
+ * Policies applied when data is submitted to an output queue
+ * holding more than its high-water mark
+ */
+typedef enum {
+	//discard the new message
+	mmbackend_queue_drop = 0,
+	//report a failure, usually resulting in the connection being reset
+	mmbackend_queue_fail
+} mmbackend_queue_policy;
+
+typedef struct /*_mmbackend_queue_message*/ {
+	uint64_t key;
+	size_t offset;
+	size_t length;
+} mmbackend_queue_message;
+
+/*
+ * Outbound buffer for a nonblocking stream socket.
+ * Data that can not be written immediately is kept in the queue and written
+ * once the core signals the descriptor as writable. The queue adds write
+ * interest to the descriptor registration while data is pending and
+ * removes it when drained, keeping read interest. The descriptor should be
+ * registered with the core by the backend before submitting data.
+ * Messages submitted with a non-zero key replace a queued message
+ * with the same key and length that has not been started yet.
+ */
+typedef struct /*_mmbackend_queue*/ {
+	int fd;
+	char* backend;
+	void* impl;
+	size_t high_water;
+	mmbackend_queue_policy policy;
+
+	uint8_t* data;
+	size_t head;
+	size_t length;
+	size_t alloc;
+	uint8_t writable;
+
+	size_t messages;
+	mmbackend_queue_message* message;
+	size_t dropped;
+} mmbackend_queue;
+
+/*
+ * (Re-)Initialize a queue for a descriptor, discarding any queued data.
+ * `backend` and `impl` are passed to mm_manage_fd when changing the
+ * descriptor interest. A high-water mark of 0 disables the limit.
+ * Storage is retained across re-initialization, so the structure must be
+ * zeroed before it is initialized for the first time.
+ */
+void mmbackend_queue_init(mmbackend_queue* queue, int fd, char* backend, void* impl, size_t high_water, mmbackend_queue_policy policy);
+
+/*
+ * Write data to the queue descriptor, buffering anything that can not be sent immediately.
+ * Returns 0 on success, 1 on socket failure or when the queue is full with the
+ * mmbackend_queue_fail policy, 2 if the message was dropped.
+ */
+int mmbackend_queue_send(mmbackend_queue* queue, uint8_t* data, size_t length, uint64_t key);
+
+/*
+ * Write as much queued data as possible. To be called when the core
+ * signals the descriptor as writable.
+ * Returns 0 on success, 1 on socket failure.
+ */
+int mmbackend_queue_flush(mmbackend_queue* queue);
+
+/*
+ * Return the number of bytes waiting to be written
+ */
+size_t mmbackend_queue_pending(mmbackend_queue* queue);
+
+/*
+ * Release all storage associated with a queue
+ */
+void mmbackend_queue_free(mmbackend_queue* queue);
+
+
+/** Single-producer single-consumer ring buffer **/
+
+/*
+ * Lock-free queue of fixed-size elements for passing data from exactly
+ * one producer thread to exactly one consumer thread.
+ * The capacity is rounded up to the next power of two.
+ */
+typedef struct /*_mmbackend_ring*/ {
+	uint8_t* data;
+	size_t capacity;
+	size_t element_size;
+	size_t head;
+	size_t tail;
+} mmbackend_ring;
+
+/*
+ * Allocate the storage for a ring buffer
+ * Returns 0 on success, 1 on failure
+ */
+int mmbackend_ring_init(mmbackend_ring* ring, size_t capacity, size_t element_size);
+
+/*
+ * Copy an element into the ring buffer (producer side)
+ * Returns 0 on success, 1 if the ring buffer is full
+ */
+int mmbackend_ring_push(mmbackend_ring* ring, void* element);
+
+/*
+ * Copy the oldest element out of the ring buffer (consumer side)
+ * Returns 0 on success, 1 if the ring buffer is empty
+ */
+int mmbackend_ring_pop(mmbackend_ring* ring, void* element);
+
+/*
+ * Release the storage of a ring buffer
+ */
+void mmbackend_ring_free(mmbackend_ring* ring);
+
+/** Stream receive buffers **/
+
+//initial allocation and minimum free space for a receive call
+#define MMBACKEND_STREAM_CHUNK 4096
+
+/*
+ * Receive buffer for stream connections. Data is consumed from the front and
+ * the buffer is only compacted when the space at the end runs out, so any
+ * extracted line or message can be handed out as a view into the buffer.
+ * Views stay valid until the next call to any mmbackend_stream_* function.
+ */
+typedef struct /*_mmbackend_stream*/ {
+	uint8_t* data;
+	size_t alloc;
+	size_t limit;
+	//first byte still in use
+	size_t head;
+	//first byte not yet parsed
+	size_t parsed;
+	//end of received data
+	size_t tail;
+
+	//websocket message reassembly state
+	uint8_t fragment_opcode;
+	size_t fragment_offset;
+	size_t fragment_length;
+} mmbackend_stream;
+
+typedef enum /*_mmbackend_ws_opcode*/ {
+	mmbackend_ws_continuation = 0,
+	mmbackend_ws_text = 1,
+	mmbackend_ws_binary = 2,
+	mmbackend_ws_close = 8,
+	mmbackend_ws_ping = 9,
+	mmbackend_ws_pong = 10
+} mmbackend_ws_opcode;
+
+typedef struct /*_mmbackend_ws_frame*/ {
+	mmbackend_ws_opcode opcode;
+	uint8_t* payload;
+	size_t length;
+} mmbackend_ws_frame;
+
+/*
+ * Reset a stream buffer, eg. for a new connection. Buffered data is discarded,
+ * storage is retained. `limit` sets the maximum amount of buffered data,
+ * which is also the maximum size of a single message.
+ * As storage is retained, the structure must be zeroed before the first call.
+ */
+void mmbackend_stream_init(mmbackend_stream* stream, size_t limit);
+
+/*
+ * Read available data from a stream socket into the buffer
+ * Returns the number of bytes read, 0 if the peer closed the connection
+ * and -1 on failure (errno is set for socket errors, failures
+ * to allocate within the limit are logged)
+ */
+ssize_t mmbackend_stream_recv(mmbackend_stream* stream, int fd);
+
+/*
+ * Extract the next CRLF-terminated line (without the terminator)
+ * Returns 1 if a line was extracted, 0 if more data is required
+ */
+int mmbackend_stream_line(mmbackend_stream* stream, char** line, size_t* length);
+
+/*
+ * Extract the next complete websocket message. Fragmented messages are
+ * reassembled in place, control frames interleaved with fragments are
+ * returned as they arrive. Masked payloads are unmasked.
+ * Returns 1 if a message was extracted, 0 if more data is required
+ * and -1 on protocol violations or messages exceeding the limit.
+ */
+int mmbackend_stream_ws(mmbackend_stream* stream, mmbackend_ws_frame* frame);
+
+/*
+ * Release all storage associated with a stream buffer
+ */
+void mmbackend_stream_free(mmbackend_stream* stream);
 
 /** JSON parsing **/
 
@@ -156,3 +371,82 @@ char* json_obj_str(char* json, char* key, size_t* length);
 char* json_obj_strdup(char* json, char* key);
 char* json_array_str(char* json, uint64_t key, size_t* length);
 char* json_array_strdup(char* json, uint64_t key);
+
+/** Indexed JSON parsing **/
+
+//number of tokens to allocate at once
+#define JSON_INDEX_CHUNK 256
+//maximum container nesting accepted by the parser
+#define JSON_INDEX_DEPTH 64
+#define JSON_INDEX_ROOT 1
+//maximum length of a number token
+#define JSON_INDEX_NUMBER 64
+
+typedef struct /*_json_token*/ {
+	json_type type;
+	//data offset within the document, strings exclude the quotes
+	size_t offset;
+	size_t length;
+	//number of elements (arrays) or members (objects)
+	size_t children;
+	//index of the first token following this one and all its children
+	size_t next;
+} json_token;
+
+typedef struct /*_json_index*/ {
+	char* json;
+	size_t length;
+	size_t tokens;
+	size_t alloc;
+	json_token* token;
+} json_index;
+
+/*
+ * Tokenize a JSON document of `length` bytes in a single pass,
+ * building a flat index of all contained values (in document order, object keys
+ * preceding their values). The token storage is retained across calls.
+ * The document need not be terminated, but must remain valid while the index is in use.
+ * Returns 0 on success, 1 on failure (ie. parse failures)
+ */
+int json_index_parse(json_index* index, char* json, size_t length);
+
+/*
+ * The document root is stored at token JSON_INDEX_ROOT.
+ * Token 0 is reserved, all queries return it to signal absence
+ * of the requested value and accept it as input.
+ */
+
+/*
+ * Look up the value token for `key` within the object / the element
+ * `key` within the array at `token`
+ */
+size_t json_index_obj(json_index* index, size_t token, char* key);
+size_t json_index_array(json_index* index, size_t token, uint64_t key);
+
+/*
+ * Iterate the values contained in the array / object at `parent`
+ */
+size_t json_index_first(json_index* index, size_t parent);
+size_t json_index_next(json_index* index, size_t parent, size_t token);
+
+/*
+ * Fetch the type / value of a token, returning JSON_INVALID / `fallback`
+ * when the token is not present or has a different type
+ */
+json_type json_index_type(json_index* index, size_t token);
+uint8_t json_index_bool(json_index* index, size_t token, uint8_t fallback);
+int64_t json_index_int(json_index* index, size_t token, int64_t fallback);
+double json_index_double(json_index* index, size_t token, double fallback);
+
+/*
+ * Fetch a string token. The returned pointer references the document,
+ * escape sequences are not resolved.
+ * json_index_strdup returns a newly-allocated, terminated copy.
+ */
+char* json_index_str(json_index* index, size_t token, size_t* length);
+char* json_index_strdup(json_index* index, size_t token);
+
+/*
+ * Release the token storage of an index
+ */
+void json_index_free(json_index* index);
@@ -11,8 +11,6 @@
 #include "libmmbackend.h"
 #include "maweb.h"
 
-#define WS_LEN(a) ((a) & 0x7F)
-#define WS_OP(a) ((a) & 0x0F)
 #define WS_FLAG_FIN 0x80
 #define WS_FLAG_MASK 0x80
 
@@ -20,7 +18,9 @@ static void maweb_disconnect(instance* inst);
 
 static uint64_t last_keepalive = 0;
 static uint64_t update_interval = 0;
-static uint64_t last_update = 0;
+static uint64_t idle_interval = MAWEB_POLL_IDLE;
+static uint64_t poll_window = MAWEB_POLL_WINDOW;
+static uint64_t next_poll = 0;
 static uint64_t quiet_mode = 0;
 
 static maweb_command_key cmdline_keys[] = {
@@ -133,9 +133,50 @@ static int channel_comparator(const void* raw_a, const void* raw_b){
 	return a->index - b->index;
 }
 
+static maweb_exec_state* maweb_exec_lookup(maweb_instance_data* data, uint16_t page, uint16_t index, uint8_t create){
+	size_t n, slot;
+
+	if(!data->execs){
+		return NULL;
+	}
+
+	slot = (page * 211 + index * 31) & (data->execs - 1);
+	for(n = 0; n < data->execs; n++){
+		if(!data->exec[slot].used){
+			if(!create){
+				return NULL;
+			}
+			data->exec[slot].used = 1;
+			data->exec[slot].page = page;
+			data->exec[slot].index = index;
+			data->exec[slot].hash = 0;
+			return data->exec + slot;
+		}
+		if(data->exec[slot].page == page && data->exec[slot].index == index){
+			return data->exec + slot;
+		}
+		slot = (slot + 1) & (data->execs - 1);
+	}
+	return NULL;
+}
+
+static uint64_t maweb_hash(char* data, size_t length){
+	//FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	size_t n;
+
+	for(n = 0; n < length; n++){
+		hash ^= (uint8_t) data[n];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
 static uint32_t maweb_interval(){
-	if(update_interval){
-		return update_interval - (last_update % update_interval);
+	uint64_t now = mm_timestamp();
+
+	if(next_poll){
+		return (next_poll > now) ? (next_poll - now) : 1;
 	}
 	return 0;
 }
@@ -145,6 +186,18 @@ static int maweb_configure(char* option, char* value){
 		update_interval = strtoul(value, NULL, 10);
 		return 0;
 	}
+	else if(!strcmp(option, "idle")){
+		idle_interval = strtoul(value, NULL, 10);
+		return 0;
+	}
+	else if(!strcmp(option, "window")){
+		poll_window = strtoul(value, NULL, 10);
+		if(!poll_window){
+			LOG("Request window must be at least 1");
+			return 1;
+		}
+		return 0;
+	}
 	else if(!strcmp(option, "quiet")){
 		quiet_mode = strtoul(value, NULL, 10);
 		return 0;
@@ -234,13 +287,7 @@ static int maweb_instance(instance* inst){
 
 	data->fd = -1;
 	data->state = ws_closed;
-	data->buffer = calloc(MAWEB_RECV_CHUNK, sizeof(uint8_t));
-	if(!data->buffer){
-		LOG("Failed to allocate memory");
-		free(data);
-		return 1;
-	}
-	data->allocated = MAWEB_RECV_CHUNK;
+	mmbackend_stream_init(&(data->stream), MAWEB_RECV_LIMIT);
 
 	inst->impl = data;
 	return 0;
@@ -350,8 +397,20 @@ static int maweb_send_frame(instance* inst, maweb_operation op, uint8_t* payload
 	//send a zero masking key because masking is stupid
 	header_bytes += 4;
 
-	if(mmbackend_send(data->fd, frame_header, header_bytes)
-			|| mmbackend_send(data->fd, payload, len)){
+	//assemble the frame so it is queued as a whole
+	if(header_bytes + len > data->xmit_alloc){
+		data->xmit = realloc(data->xmit, header_bytes + len);
+		if(!data->xmit){
+			data->xmit_alloc = 0;
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		data->xmit_alloc = header_bytes + len;
+	}
+	memcpy(data->xmit, frame_header, header_bytes);
+	memcpy(data->xmit + header_bytes, payload, len);
+
+	if(mmbackend_queue_send(&(data->queue), data->xmit, header_bytes + len, 0)){
 		LOGPF("Failed to send on instance %s, assuming connection failure", inst->name);
 		maweb_disconnect(inst);
 		return 1;
@@ -360,13 +419,24 @@ static int maweb_send_frame(instance* inst, maweb_operation op, uint8_t* payload
 	return 0;
 }
 
-static int maweb_process_playback(instance* inst, int64_t page, maweb_channel_type metatype, char* payload, size_t payload_length){
+static int maweb_process_playback(instance* inst, int64_t page, maweb_channel_type metatype, json_index* json, size_t item, uint8_t* active){
 	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
-	size_t exec_blocks = json_obj_offset(payload, (metatype == 2) ? "executorBlocks" : "bottomButtons"), offset, block = 0, control;
-	int64_t exec_index = json_obj_int(payload, "iExec", 191);
+	size_t exec_blocks = json_index_obj(json, item, (metatype == 2) ? "executorBlocks" : "bottomButtons"), block, control;
+	int64_t exec_index = json_index_int(json, json_index_obj(json, item, "iExec"), 191);
+	int64_t running = json_index_int(json, json_index_obj(json, item, "isRun"), 0);
+	maweb_exec_state* state = maweb_exec_lookup(data, page - 1, exec_index, 0);
+	uint64_t hash = maweb_hash(json->json + json->token[item].offset, json->token[item].length);
 	ssize_t channel_index;
 	channel_value evt;
 
+	//skip executors that did not change since the last update
+	if(state){
+		if(state->hash == hash){
+			return 0;
+		}
+		state->hash = hash;
+	}
+
 	if(!exec_blocks){
 		if(metatype == 3){
 			//ignore unused buttons
@@ -378,20 +448,21 @@ static int maweb_process_playback(instance* inst, int64_t page, maweb_channel_ty
 
 	//the bottomButtons key has an additional subentry
 	if(metatype == 3){
-		exec_blocks += json_obj_offset(payload + exec_blocks, "items");
+		exec_blocks = json_index_obj(json, exec_blocks, "items");
 	}
 
 	//iterate over executor blocks
-	for(offset = json_array_offset(payload + exec_blocks, block); offset; offset = json_array_offset(payload + exec_blocks, block)){
-		control = exec_blocks + offset + json_obj_offset(payload + exec_blocks + offset, "fader");
+	for(block = json_index_first(json, exec_blocks); block; block = json_index_next(json, exec_blocks, block)){
+		control = json_index_obj(json, json_index_obj(json, block, "fader"), "v");
 
 		channel_index = maweb_channel_index(data, exec_fader, page - 1, exec_index);
 		if(channel_index >= 0){
 			if(!data->channel[channel_index].input_blocked){
-				evt.normalised = json_obj_double(payload + control, "v", 0.0);
+				evt.normalised = json_index_double(json, control, 0.0);
 				if(evt.normalised != data->channel[channel_index].in){
 					mm_channel_event(mm_channel(inst, channel_index, 0), evt);
 					data->channel[channel_index].in = evt.normalised;
+					*active = 1;
 				}
 			}
 			else{
@@ -403,10 +474,11 @@ static int maweb_process_playback(instance* inst, int64_t page, maweb_channel_ty
 		channel_index = maweb_channel_index(data, exec_button, page - 1, exec_index);
 		if(channel_index >= 0){
 			if(!data->channel[channel_index].input_blocked){
-				evt.normalised = json_obj_int(payload, "isRun", 0);
+				evt.normalised = running;
 				if(evt.normalised != data->channel[channel_index].in){
 					mm_channel_event(mm_channel(inst, channel_index, 0), evt);
 					data->channel[channel_index].in = evt.normalised;
+					*active = 1;
 				}
 			}
 			else{
@@ -414,78 +486,108 @@ static int maweb_process_playback(instance* inst, int64_t page, maweb_channel_ty
 			}
 		}
 
-		DBGPF("Page %" PRIu64 " exec %" PRIu64 " value %f running %" PRIu64, page, exec_index, json_obj_double(payload + control, "v", 0.0), json_obj_int(payload, "isRun", 0));
+		DBGPF("Page %" PRIu64 " exec %" PRIu64 " value %f running %" PRIu64, page, exec_index, json_index_double(json, control, 0.0), running);
 		exec_index++;
-		block++;
 	}
 
 	return 0;
 }
 
-static int maweb_process_playbacks(instance* inst, int64_t page, char* payload, size_t payload_length){
+//release the inflight poll block answered by a playback response and schedule its next poll
+static void maweb_poll_release(maweb_instance_data* data, int64_t page, uint8_t active){
+	maweb_poll_block* block = NULL;
+	uint64_t now = mm_timestamp();
+	size_t n;
+
+	//responses arrive in order, match the oldest request for this page (or any page if the response is unusable)
+	for(n = 0; n < data->poll_blocks; n++){
+		if(data->poll[n].inflight && (!page || data->poll[n].page == page - 1)
+				&& (!block || data->poll[n].sequence < block->sequence)){
+			block = data->poll + n;
+		}
+	}
+
+	if(block){
+		block->inflight = 0;
+		data->updates_inflight--;
+
+		//poll active blocks at the base interval, back off on idle ones
+		if(active){
+			block->interval = update_interval;
+		}
+		else{
+			block->interval = block->interval ? (block->interval * 2) : MAWEB_POLL_BACKOFF;
+			block->interval = max(block->interval, update_interval);
+			block->interval = min(block->interval, max(idle_interval, update_interval));
+		}
+		block->due = now + block->interval;
+	}
+}
+
+static int maweb_process_playbacks(instance* inst, int64_t page, json_index* json){
 	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
-	size_t base_offset = json_obj_offset(payload, "itemGroups"), group_offset, subgroup_offset, item_offset;
-	uint64_t group = 0, subgroup, item, metatype;
+	size_t groups = json_index_obj(json, JSON_INDEX_ROOT, "itemGroups"), group, items, subgroup, item;
+	uint64_t metatype;
+	uint8_t active = 0;
 
 	if(!page){
 		LOG("Received playbacks for invalid page");
+		maweb_poll_release(data, 0, 0);
 		return 0;
 	}
 
-	if(!base_offset){
+	if(!groups){
 		LOG("Playback data missing item key");
+		maweb_poll_release(data, page, 0);
 		return 0;
 	}
 
 	//iterate .itemGroups
-	for(group_offset = json_array_offset(payload + base_offset, group);
-			group_offset;
-			group_offset = json_array_offset(payload + base_offset, group)){
-		metatype = json_obj_int(payload + base_offset + group_offset, "itemsType", 0);
+	for(group = json_index_first(json, groups); group; group = json_index_next(json, groups, group)){
+		metatype = json_index_int(json, json_index_obj(json, group, "itemsType"), 0);
 		//iterate .itemGroups.items
-		//FIXME this is problematic if there is no "items" key
-		group_offset = group_offset + json_obj_offset(payload + base_offset + group_offset, "items");
-		if(group_offset){
-			subgroup = 0;
-			group_offset += base_offset;
-			for(subgroup_offset = json_array_offset(payload + group_offset, subgroup);
-					subgroup_offset;
-					subgroup_offset = json_array_offset(payload + group_offset, subgroup)){
-				//iterate .itemGroups.items[n]
-				item = 0;
-				subgroup_offset += group_offset;
-				for(item_offset = json_array_offset(payload + subgroup_offset, item);
-						item_offset;
-						item_offset = json_array_offset(payload + subgroup_offset, item)){
-					maweb_process_playback(inst, page, metatype,
-							payload + subgroup_offset + item_offset,
-							payload_length - subgroup_offset - item_offset);
-					item++;
-				}
-				subgroup++;
+		items = json_index_obj(json, group, "items");
+		for(subgroup = json_index_first(json, items); subgroup; subgroup = json_index_next(json, items, subgroup)){
+			//iterate .itemGroups.items[n]
+			for(item = json_index_first(json, subgroup); item; item = json_index_next(json, subgroup, item)){
+				maweb_process_playback(inst, page, metatype, json, item, &active);
 			}
 		}
-		group++;
 	}
 
-	data->updates_inflight--;
+	maweb_poll_release(data, page, active);
 	DBGPF("Playback message processing done, %" PRIu64 " updates inflight on %s", data->updates_inflight, inst->name);
 	return 0;
 }
 
-static int maweb_request_playbacks(instance* inst){
+static void maweb_poll_free(maweb_instance_data* data){
+	size_t n;
+
+	for(n = 0; n < data->poll_blocks; n++){
+		free(data->poll[n].request);
+	}
+	free(data->poll);
+	data->poll = NULL;
+	data->poll_blocks = 0;
+	data->poll_next = 0;
+	data->next_poll = 0;
+	data->updates_inflight = 0;
+}
+
+//build the playback request list for the mapped executors, depends on the peer type
+static int maweb_poll_setup(instance* inst){
 	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
 	char xmit_buffer[MAWEB_XMIT_CHUNK];
-	int rv = 0;
+	maweb_poll_block* block = NULL;
 
 	char item_indices[1024] = "[300,400,500]", item_counts[1024] = "[16,16,16]", item_types[1024] = "[3,3,3]";
 	size_t page_index = 0, view = 3, channel = 0, offsets[3], channel_offset, channels;
 
-	if(data->updates_inflight){
-		if(quiet_mode < 1){
-			LOGPF("Skipping update request on %s, %" PRIu64 " updates still inflight - consider raising the interval time", inst->name, data->updates_inflight);
-		}
-		return 0;
+	maweb_poll_free(data);
+
+	//force events for all executors on the next update
+	for(channel = 0; channel < data->execs; channel++){
+		data->exec[channel].hash = 0;
 	}
 
 	//only request faders and buttons
@@ -550,10 +652,25 @@ static int maweb_request_playbacks(instance* inst){
 				data->channel[channel + channel_offset - 1].type, data->channel[channel + channel_offset - 1].page, data->channel[channel + channel_offset - 1].index,
 				data->channel[channel + channel_offset].type, data->channel[channel + channel_offset].page, data->channel[channel + channel_offset].index);
 
+		data->poll = realloc(data->poll, (data->poll_blocks + 1) * sizeof(maweb_poll_block));
+		if(!data->poll){
+			data->poll_blocks = 0;
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		block = data->poll + data->poll_blocks;
+		data->poll_blocks++;
+
+		memset(block, 0, sizeof(maweb_poll_block));
+		block->page = page_index;
+		block->first = data->channel[channel].index;
+		block->last = data->channel[channel + channel_offset - 1].index;
+		block->interval = update_interval;
+
 		//advance base channel
 		channel += channel_offset - 1;
 
-		//send current request
+		//store the request, the session is appended when sending
 		snprintf(xmit_buffer, sizeof(xmit_buffer),
 				"{"
 				"\"requestType\":\"playbacks\","
@@ -564,41 +681,148 @@ static int maweb_request_playbacks(instance* inst){
 				"\"view\":%" PRIsize_t ","
 				"\"execButtonViewMode\":2,"	//extended
 				"\"buttonsViewMode\":0,"	//get vfader for button execs
-				"\"session\":%" PRIu64
-				"}",
+				"\"session\":",
 				item_indices,
 				item_counts,
 				page_index,
 				item_types,
-				view,
-				data->session);
-		maweb_send_frame(inst, ws_text, (uint8_t*) xmit_buffer, strlen(xmit_buffer));
+				view);
+		block->request = strdup(xmit_buffer);
+		if(!block->request){
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+	}
+
+	DBGPF("Polling %" PRIsize_t " executor blocks on %s", data->poll_blocks, inst->name);
+	return 0;
+}
+
+//send due playback requests up to the configured pipeline window
+static int maweb_request_playbacks(instance* inst){
+	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
+	char xmit_buffer[MAWEB_XMIT_CHUNK];
+	uint64_t now = mm_timestamp(), due;
+	maweb_poll_block* block = NULL;
+	size_t n, u;
+
+	data->next_poll = 0;
+	if(!data->login || !data->poll_blocks){
+		return 0;
+	}
+
+	//requests may get lost, do not stall the pipeline forever
+	for(n = 0; n < data->poll_blocks; n++){
+		block = data->poll + n;
+		if(block->inflight && now - block->sent >= MAWEB_POLL_TIMEOUT){
+			if(quiet_mode < 1){
+				LOGPF("Playback request for page %d on %s timed out", block->page + 1, inst->name);
+			}
+			block->inflight = 0;
+			block->due = now;
+			data->updates_inflight--;
+		}
+	}
+
+	//serve due blocks round-robin so a fast block can not starve the others
+	for(u = 0; u < data->poll_blocks && data->updates_inflight < poll_window; u++){
+		n = (data->poll_next + u) % data->poll_blocks;
+		block = data->poll + n;
+		if(block->inflight || block->due > now){
+			continue;
+		}
+
+		snprintf(xmit_buffer, sizeof(xmit_buffer), "%s%" PRIu64 "}", block->request, data->session);
 		DBGPF("Poll request: %s", xmit_buffer);
+		block->inflight = 1;
+		block->sent = now;
+		block->sequence = data->poll_sequence++;
 		data->updates_inflight++;
+		data->poll_next = n + 1;
+		if(maweb_send_frame(inst, ws_text, (uint8_t*) xmit_buffer, strlen(xmit_buffer))){
+			//connection has been reset
+			return 1;
+		}
 	}
 
-	DBGPF("Poll request handling done, %" PRIu64 " updates requested on %s", data->updates_inflight, inst->name);
-	return rv;
+	//calculate the next time the scheduler needs to run
+	for(n = 0; n < data->poll_blocks; n++){
+		block = data->poll + n;
+		if(block->inflight){
+			due = block->sent + MAWEB_POLL_TIMEOUT;
+		}
+		else if(data->updates_inflight < poll_window){
+			due = block->due;
+		}
+		else{
+			//the next response reschedules
+			continue;
+		}
+		data->next_poll = data->next_poll ? min(data->next_poll, due) : due;
+	}
+
+	if(data->next_poll && (!next_poll || data->next_poll < next_poll)){
+		next_poll = data->next_poll;
+	}
+
+	DBGPF("Poll request handling done, %" PRIu64 " updates inflight on %s", data->updates_inflight, inst->name);
+	return 0;
+}
+
+//an output on an executor block makes feedback likely, poll it at the base rate
+static void maweb_poll_activity(maweb_instance_data* data, maweb_channel_data* chan){
+	uint64_t now = mm_timestamp();
+	size_t n;
+
+	for(n = 0; n < data->poll_blocks; n++){
+		if(data->poll[n].page == chan->page
+				&& data->poll[n].first <= chan->index
+				&& data->poll[n].last >= chan->index){
+			data->poll[n].interval = update_interval;
+			data->poll[n].due = min(data->poll[n].due, now + update_interval);
+		}
+	}
+
+	//executors may span multiple controls, invalidate the whole page
+	//to have the input filtering see the next update
+	for(n = 0; n < data->execs; n++){
+		if(data->exec[n].page == chan->page){
+			data->exec[n].hash = 0;
+		}
+	}
+
+	if(!next_poll || now + update_interval < next_poll){
+		next_poll = now + update_interval;
+	}
 }
 
 static int maweb_handle_message(instance* inst, char* payload, size_t payload_length){
 	char xmit_buffer[MAWEB_XMIT_CHUNK];
 	int64_t session = 0;
 	char* field;
+	size_t field_length = 0;
 	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
+	json_index* json = &(data->json);
 
-	//query this early to save on unnecessary parser passes with stupid-huge data messages
-	if(json_obj(payload, "responseType") == JSON_STRING){
-		field = json_obj_str(payload, "responseType", NULL);
-		if(!strncmp(field, "login", 5)){
-			if(json_obj_bool(payload, "result", 0)){
+	//tokenize once, all further queries only walk the index
+	if(json_index_parse(json, payload, payload_length)){
+		LOGPF("Failed to parse message on %s", inst->name);
+		DBGPF("Unparseable message (%" PRIsize_t "): %.*s", payload_length, (int) payload_length, payload);
+		return 0;
+	}
+
+	field = json_index_str(json, json_index_obj(json, JSON_INDEX_ROOT, "responseType"), &field_length);
+	if(field){
+		if(field_length == 5 && !strncmp(field, "login", 5)){
+			if(json_index_bool(json, json_index_obj(json, JSON_INDEX_ROOT, "result"), 0)){
 				LOG("Login successful");
 				data->login = 1;
 
 				//initially request playbacks
-				if(!update_interval){
-					maweb_request_playbacks(inst);
+				if(maweb_poll_setup(inst)){
+					return 1;
 				}
+				maweb_request_playbacks(inst);
 			}
 			else{
 				data->login = 0;
@@ -613,22 +837,20 @@ static int maweb_handle_message(instance* inst, char* payload, size_t payload_le
 				return 0;
 			}
 		}
-		if(!strncmp(field, "playbacks", 9)){
-			if(maweb_process_playbacks(inst, json_obj_int(payload, "iPage", 0), payload, payload_length)){
+		if(field_length == 9 && !strncmp(field, "playbacks", 9)){
+			if(maweb_process_playbacks(inst, json_index_int(json, json_index_obj(json, JSON_INDEX_ROOT, "iPage"), 0), json)){
 				LOG("Failed to handle/request input data");
 			}
 
-			//request playbacks again if configured
-			if(!update_interval && data->login && !data->updates_inflight){
-				maweb_request_playbacks(inst);
-			}
+			//request further updates
+			maweb_request_playbacks(inst);
 			return 0;
 		}
 	}
 
-	DBGPF("Incoming message (%" PRIsize_t "): %s", payload_length, payload);
-	if(json_obj(payload, "session") == JSON_NUMBER){
-		session = json_obj_int(payload, "session", data->session);
+	DBGPF("Incoming message (%" PRIsize_t "): %.*s", payload_length, (int) payload_length, payload);
+	if(json_index_type(json, json_index_obj(json, JSON_INDEX_ROOT, "session")) == JSON_NUMBER){
+		session = json_index_int(json, json_index_obj(json, JSON_INDEX_ROOT, "session"), data->session);
 		if(session < 0){
 			LOG("Invalid web remote session identifier received, closing connection");
 			maweb_disconnect(inst);
@@ -640,22 +862,25 @@ static int maweb_handle_message(instance* inst, char* payload, size_t payload_le
 		data->session = session;
 	}
 
-	if(json_obj_bool(payload, "forceLogin", 0)){
+	if(json_index_bool(json, json_index_obj(json, JSON_INDEX_ROOT, "forceLogin"), 0)){
 		LOG("Sending user credentials");
 		snprintf(xmit_buffer, sizeof(xmit_buffer),
 				"{\"requestType\":\"login\",\"username\":\"%s\",\"password\":\"%s\",\"session\":%" PRIu64 "}",
 				(data->peer_type == peer_dot2) ? "remote" : data->user, data->pass ? data->pass : MAWEB_DEFAULT_PASSWORD, data->session);
 		maweb_send_frame(inst, ws_text, (uint8_t*) xmit_buffer, strlen(xmit_buffer));
 	}
-	if(json_obj(payload, "status") && json_obj(payload, "appType")){
+	if(json_index_obj(json, JSON_INDEX_ROOT, "status") && json_index_obj(json, JSON_INDEX_ROOT, "appType")){
 		LOG("Connection established");
-		field = json_obj_str(payload, "appType", NULL);
-		if(!strncmp(field, "dot2", 4)){
+		field = json_index_str(json, json_index_obj(json, JSON_INDEX_ROOT, "appType"), &field_length);
+		if(!field){
+			field_length = 0;
+		}
+		if(field_length >= 4 && !strncmp(field, "dot2", 4)){
 			data->peer_type = peer_dot2;
 			//the dot2 can't handle lua commands
 			data->cmdline = cmd_remote;
 		}
-		else if(!strncmp(field, "gma2", 4)){
+		else if(field_length >= 4 && !strncmp(field, "gma2", 4)){
 			data->peer_type = peer_ma2;
 		}
 		maweb_send_frame(inst, ws_text, (uint8_t*) "{\"session\":0}", 13);
@@ -672,26 +897,61 @@ static void maweb_disconnect(instance* inst){
 		//close the session if one is active
 		if(data->session > 0){
 			snprintf(xmit_buffer, sizeof(xmit_buffer), "{\"requestType\":\"close\",\"session\":%" PRIu64 "}", data->session);
+			//a failure to send this calls back into this function
+			data->session = -1;
 			maweb_send_frame(inst, ws_text, (uint8_t*) xmit_buffer, strlen(xmit_buffer));
 		}
 
 		mm_manage_fd(data->fd, BACKEND_NAME, 0, NULL);
 		close(data->fd);
 	}
+	mmbackend_queue_init(&(data->queue), -1, BACKEND_NAME, inst, MAWEB_XMIT_LIMIT, mmbackend_queue_fail);
 
 	data->fd = -1;
+	data->connecting = 0;
 	data->state = ws_closed;
 	data->login = 0;
 	data->session = -1;
 	data->peer_type = peer_unidentified;
-	data->offset = 0;
-	data->updates_inflight = 0;
+	mmbackend_stream_init(&(data->stream), MAWEB_RECV_LIMIT);
+	maweb_poll_free(data);
+}
+
+//send the websocket handshake once the connection is established
+static int maweb_connected(instance* inst){
+	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
+	int error = mmbackend_socket_connected(data->fd);
+	char* handshake = "GET /?ma=1 HTTP/1.1\r\n"
+		"Connection: Upgrade\r\n"
+		"Upgrade: websocket\r\n"
+		"Sec-WebSocket-Version: 13\r\n"
+		//the websocket key probably should not be hardcoded, but this is not security critical
+		//and the whole websocket 'accept key' dance is plenty stupid as it is
+		"Sec-WebSocket-Key: rbEQrXMEvCm4ZUjkj6juBQ==\r\n"
+		"\r\n";
+
+	if(error){
+		LOGPF("Failed to connect instance %s: %s", inst->name, mmbackend_socket_strerror(error));
+		return 1;
+	}
+
+	if(data->connecting){
+		data->connecting = 0;
+		mm_manage_fd(data->fd, BACKEND_NAME, mmfd_read, (void*) inst);
+	}
+
+	if(mmbackend_queue_send(&(data->queue), (uint8_t*) handshake, strlen(handshake), 0)){
+		LOG("Failed to communicate with peer");
+		return 1;
+	}
+	return 0;
 }
 
 static int maweb_connect(instance* inst){
 	int rv = 1;
 	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
-	if(!data->host || !data->host[data->next_host]){
+
+	if(!data->addr_len || !data->addr_len[data->next_host]){
 		LOGPF("Invalid host configuration on instance %s, host %" PRIsize_t, inst->name, data->next_host + 1);
 		goto bail;
 	}
@@ -701,30 +961,21 @@ static int maweb_connect(instance* inst){
 
 	LOGPF("Connecting to host %" PRIsize_t " of %" PRIsize_t " on %s", data->next_host + 1, data->hosts, inst->name);
 
-	data->fd = mmbackend_socket(data->host[data->next_host],
-			data->port[data->next_host] ? data->port[data->next_host] : MAWEB_DEFAULT_PORT,
-			SOCK_STREAM, 0, 0, 1);
-
+	//connect without blocking, the handshake is sent once the connection is established
+	data->fd = mmbackend_socket_connect(data->addr + data->next_host, data->addr_len[data->next_host], &(data->connecting));
 	if(data->fd < 0){
 		goto bail;
 	}
 
-	data->state = ws_new;
-	if(mmbackend_send_str(data->fd, "GET /?ma=1 HTTP/1.1\r\n")
-			|| mmbackend_send_str(data->fd, "Connection: Upgrade\r\n")
-			|| mmbackend_send_str(data->fd, "Upgrade: websocket\r\n")
-			|| mmbackend_send_str(data->fd, "Sec-WebSocket-Version: 13\r\n")
-			//the websocket key probably should not be hardcoded, but this is not security critical
-			//and the whole websocket 'accept key' dance is plenty stupid as it is
-			|| mmbackend_send_str(data->fd, "Sec-WebSocket-Key: rbEQrXMEvCm4ZUjkj6juBQ==\r\n")
-			|| mmbackend_send_str(data->fd, "\r\n")){
-		LOG("Failed to communicate with peer");
+	//register new fd, a pending connection becomes writable when it completes
+	if(mm_manage_fd(data->fd, BACKEND_NAME, mmfd_read | (data->connecting ? mmfd_write : 0), (void*) inst)){
+		LOG("Failed to register FD");
 		goto bail;
 	}
+	mmbackend_queue_init(&(data->queue), data->fd, BACKEND_NAME, inst, MAWEB_XMIT_LIMIT, mmbackend_queue_fail);
 
-	//register new fd
-	if(mm_manage_fd(data->fd, BACKEND_NAME, 1, (void*) inst)){
-		LOG("Failed to register FD");
+	data->state = ws_new;
+	if(!data->connecting && maweb_connected(inst)){
 		goto bail;
 	}
 
@@ -735,127 +986,73 @@ bail:
 	return rv;
 }
 
-static ssize_t maweb_handle_lines(instance* inst, ssize_t bytes_read){
+static int maweb_handle_line(instance* inst, char* line, size_t length){
 	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
-	size_t n, begin = 0;
 
-	for(n = 0; n < bytes_read - 1; n++){
-		if(!strncmp((char*) data->buffer + data->offset + n, "\r\n", 2)){
-			if(data->state == ws_new){
-				if(!strncmp((char*) data->buffer, "HTTP/1.1 101", 12)){
-					data->state = ws_http;
-				}
-				else{
-					LOGPF("Invalid HTTP response for instance %s", inst->name);
-					return -1;
-				}
-			}
-			else{
-				//ignore all http stuff until the end of headers since we don't actually care...
-				if(n == begin){
-					data->state = ws_open;
-				}
-			}
-			begin = n + 2;
+	if(data->state == ws_new){
+		if(length < 12 || strncmp(line, "HTTP/1.1 101", 12)){
+			LOGPF("Invalid HTTP response for instance %s", inst->name);
+			return 1;
 		}
+		data->state = ws_http;
 	}
-
-	return data->offset + begin;
+	//ignore all http stuff until the end of headers since we don't actually care...
+	else if(!length){
+		data->state = ws_open;
+	}
+	return 0;
 }
 
-static int maweb_establish(instance* inst){
+//try all hosts once, a pending connection attempt that fails resumes the round with the next host
+static int maweb_establish(instance* inst, uint8_t resume){
 	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
-	size_t start = data->next_host;
+
+	if(!resume){
+		data->first_host = data->next_host;
+	}
+	else if(data->next_host == data->first_host){
+		//all hosts failed, keepalive starts the next round
+		maweb_disconnect(inst);
+		return 1;
+	}
 
 	do{
 		if(!maweb_connect(inst)){
 			break;
 		}
-	} while(data->next_host != start);
+	} while(data->next_host != data->first_host);
 
 	return data->state != ws_closed ? 0 : 1;
 }
 
-static ssize_t maweb_handle_ws(instance* inst, ssize_t bytes_read){
-	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
-	size_t header_length = 2;
-	uint64_t payload_length = 0;
-	uint16_t* payload_len16 = (uint16_t*) (data->buffer + 2);
-	uint64_t* payload_len64 = (uint64_t*) (data->buffer + 2);
-	uint8_t* payload = data->buffer + 2;
-	uint8_t terminator_temp = 0;
-
-	if(data->offset + bytes_read < 2){
-		return 0;
-	}
-
-	//using varint as payload length is stupid, but some people seem to think otherwise...
-	payload_length = WS_LEN(data->buffer[1]);
-	switch(payload_length){
-		case 126:
-			if(data->offset + bytes_read < 4){
-				return 0;
-			}
-			payload_length = htobe16(*payload_len16);
-			payload = data->buffer + 4;
-			header_length = 4;
-			break;
-		case 127:
-			if(data->offset + bytes_read < 10){
-				return 0;
-			}
-			payload_length = htobe64(*payload_len64);
-			payload = data->buffer + 10;
-			header_length = 10;
-			break;
-		default:
-			break;
-	}
-
-	if(data->offset + bytes_read < header_length + payload_length){
-		return 0;
-	}
-
-	switch(WS_OP(data->buffer[0])){
-		case ws_text:
-			//terminate message
-			terminator_temp = payload[payload_length];
-			payload[payload_length] = 0;
-			if(maweb_handle_message(inst, (char*) payload, payload_length)){
-				return data->offset + bytes_read;
-			}
-			payload[payload_length] = terminator_temp;
-			break;
-		case ws_ping:
+static int maweb_handle_frame(instance* inst, mmbackend_ws_frame* frame){
+	switch(frame->opcode){
+		case mmbackend_ws_text:
+			return maweb_handle_message(inst, (char*) frame->payload, frame->length);
+		case mmbackend_ws_ping:
 			//answer server ping with a pong
-			if(maweb_send_frame(inst, ws_pong, payload, payload_length)){
+			if(maweb_send_frame(inst, ws_pong, frame->payload, frame->length)){
 				LOG("Failed to send pong");
 			}
-			return header_length + payload_length;
+			return 0;
+		case mmbackend_ws_close:
+			LOGPF("Connection closed by peer on %s", inst->name);
+			return 1;
 		default:
-			LOGPF("Unhandled frame type %02X", WS_OP(data->buffer[0]));
-			//this is somewhat dicey, it might be better to handle only header + payload length for known but unhandled types
-			return data->offset + bytes_read;
+			LOGPF("Unhandled frame type %02X", frame->opcode);
+			return 0;
 	}
-
-	return header_length + payload_length;
 }
 
 static int maweb_handle_fd(instance* inst){
 	maweb_instance_data* data = (maweb_instance_data*) inst->impl;
-	ssize_t bytes_read, bytes_left = data->allocated - data->offset, bytes_handled = 0;
-
-	if(bytes_left < 3){
-		data->buffer = realloc(data->buffer, (data->allocated + MAWEB_RECV_CHUNK) * sizeof(uint8_t));
-		if(!data->buffer){
-			LOG("Failed to allocate memory");
-			return -1;
-		}
-		data->allocated += MAWEB_RECV_CHUNK;
-		bytes_left += MAWEB_RECV_CHUNK;
-	}
+	mmbackend_ws_frame frame;
+	ssize_t bytes_read;
+	char* line = NULL;
+	size_t length;
+	int rv;
 
-	bytes_read = recv(data->fd, data->buffer + data->offset, bytes_left - 1, 0);
+	bytes_read = mmbackend_stream_recv(&(data->stream), data->fd);
 	if(bytes_read < 0){
 		LOGPF("Failed to receive on %s: %s", inst->name, mmbackend_socket_strerror(errno));
 		return 1;
@@ -865,38 +1062,30 @@ static int maweb_handle_fd(instance* inst){
 		return 1;
 	}
 
-	do{
-		switch(data->state){
-			case ws_new:
-			case ws_http:
-				bytes_handled = maweb_handle_lines(inst, bytes_read);
-				break;
-			case ws_open:
-				bytes_handled = maweb_handle_ws(inst, bytes_read);
-				break;
-			case ws_closed:
-				bytes_handled = data->offset + bytes_read;
-				break;
+	//handle the http upgrade response
+	while((data->state == ws_new || data->state == ws_http)
+			&& mmbackend_stream_line(&(data->stream), &line, &length)){
+		if(maweb_handle_line(inst, line, length)){
+			return 1;
 		}
+	}
 
-		if(bytes_handled < 0){
-			bytes_handled = data->offset + bytes_read;
-			data->offset = 0;
-			LOG("Failed to handle incoming data");
+	//handlers may reset the connection, which also resets the stream
+	while(data->state == ws_open){
+		rv = mmbackend_stream_ws(&(data->stream), &frame);
+		if(rv < 0){
+			LOGPF("Failed to handle incoming data on %s", inst->name);
 			return 1;
 		}
-		else if(bytes_handled == 0){
-			 break;
+		else if(!rv){
+			break;
 		}
 
-		memmove(data->buffer, data->buffer + bytes_handled, (data->offset + bytes_read) - bytes_handled);
-
-		bytes_handled -= data->offset;
-		bytes_read -= bytes_handled;
-		data->offset = 0;
-	} while(bytes_read > 0);
+		if(maweb_handle_frame(inst, &frame)){
+			return 1;
+		}
+	}
 
-	data->offset += bytes_read;
 	return 0;
 }
 
@@ -1004,6 +1193,10 @@ static int maweb_set(instance* inst, size_t num, channel** c, channel_value* v){
 		}
 		DBGPF("Command out %s", xmit_buffer);
 		maweb_send_frame(inst, ws_text, (uint8_t*) xmit_buffer, strlen(xmit_buffer));
+
+		if(chan->type < cmdline){
+			maweb_poll_activity(data, chan);
+		}
 	}
 	return 0;
 }
@@ -1029,7 +1222,7 @@ static int maweb_keepalive(){
 		}
 		else if(data->state == ws_closed){
 			//try to reconnect to any remote
-			if(maweb_establish(inst[u])){
+			if(maweb_establish(inst[u], 0)){
 				LOGPF("Failed to reconnect to any host on %s, will retry in %d seconds", inst[u]->name, MAWEB_CONNECTION_KEEPALIVE / 1000);
 			}
 		}
@@ -1042,7 +1235,6 @@ static int maweb_keepalive(){
 static int maweb_poll(){
 	size_t n, u;
 	instance** inst = NULL;
-	maweb_instance_data* data = NULL;
 
 	//fetch all defined instances
 	if(mm_backend_instances(BACKEND_NAME, &n, &inst)){
@@ -1050,12 +1242,10 @@ static int maweb_poll(){
 		return 1;
 	}
 
-	//send data polls for logged-in instances
+	//run the request scheduler for all instances, this recalculates the next poll time
+	next_poll = 0;
 	for(u = 0; u < n; u++){
-		data = (maweb_instance_data*) inst[u]->impl;
-		if(data->login){
-			maweb_request_playbacks(inst[u]);
-		}
+		maweb_request_playbacks(inst[u]);
 	}
 
 	free(inst);
@@ -1065,13 +1255,34 @@ static int maweb_poll(){
 static int maweb_handle(size_t num, managed_fd* fds){
 	size_t n = 0;
 	int rv = 0;
+	uint8_t connecting;
+	maweb_instance_data* data = NULL;
 
 	for(n = 0; n < num; n++){
-		rv = maweb_handle_fd((instance*) fds[n].impl);
+		data = (maweb_instance_data*) ((instance*) fds[n].impl)->impl;
+
+		//continue writing queued frames, failures are handled like receive failures
+		rv = 0;
+		connecting = data->connecting;
+		if(connecting){
+			//the descriptor becomes writable once the connection attempt completes
+			if(fds[n].ready & mmfd_write){
+				rv = maweb_connected((instance*) fds[n].impl);
+			}
+		}
+		else if((fds[n].ready & mmfd_write) && mmbackend_queue_flush(&(data->queue))){
+			LOGPF("Failed to send on instance %s, assuming connection failure", ((instance*) fds[n].impl)->name);
+			rv = 1;
+		}
+		else if(fds[n].ready & mmfd_read){
+			rv = maweb_handle_fd((instance*) fds[n].impl);
+		}
 		//try to reconnect soft failures
-		if(rv == 1 && maweb_establish((instance*) fds[n].impl)){
-			//keepalive will retry periodically
-			LOGPF("Failed to reconnect with any configured host on instance %s", ((instance*) fds[n].impl)->name);
+		if(rv == 1){
+			if(maweb_establish((instance*) fds[n].impl, connecting)){
+				//keepalive will retry periodically
+				LOGPF("Failed to reconnect with any configured host on instance %s", ((instance*) fds[n].impl)->name);
+			}
 		}
 		else if(rv){
 			//propagate critical failures
@@ -1087,9 +1298,8 @@ static int maweb_handle(size_t num, managed_fd* fds){
 		last_keepalive = mm_timestamp();
 	}
 
-	if(update_interval && last_update && mm_timestamp() - last_update >= update_interval){
+	if(next_poll && mm_timestamp() >= next_poll){
 		rv |= maweb_poll();
-		last_update = mm_timestamp();
 	}
 
 	return rv;
@@ -1114,8 +1324,36 @@ static int maweb_start(size_t n, instance** inst){
 			mm_channel_update(data->channel[p].chan, p);
 		}
 
+		//set up the executor state table with a load factor of at most 0.5
+		for(data->execs = 16; data->execs < data->channels * 2; data->execs *= 2){
+		}
+		data->exec = calloc(data->execs, sizeof(maweb_exec_state));
+		if(!data->exec){
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		for(p = 0; p < data->channels; p++){
+			if(data->channel[p].type < cmdline){
+				maweb_exec_lookup(data, data->channel[p].page, data->channel[p].index, 1);
+			}
+		}
+
+		//resolve all hosts once instead of on every reconnect
+		data->addr = calloc(data->hosts, sizeof(struct sockaddr_storage));
+		data->addr_len = calloc(data->hosts, sizeof(socklen_t));
+		if(!data->addr || !data->addr_len){
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		for(p = 0; p < data->hosts; p++){
+			if(mmbackend_parse_sockaddr(data->host[p], data->port[p] ? data->port[p] : MAWEB_DEFAULT_PORT, data->addr + p, data->addr_len + p)){
+				LOGPF("Failed to resolve host %" PRIsize_t " on instance %s", p + 1, inst[u]->name);
+				return 1;
+			}
+		}
+
 		//try to connect to any available host
-		if(maweb_establish(inst[u])){
+		if(maweb_establish(inst[u], 0)){
 			//do not return failure here, keepalive will periodically try to reconnect
 			LOGPF("Failed to connect to any host configured on instance %s", inst[u]->name);
 		}
@@ -1124,7 +1362,7 @@ static int maweb_start(size_t n, instance** inst){
 	LOGPF("Registering %" PRIsize_t " descriptors to core", n);
 
 	//initialize timeouts
-	last_keepalive = last_update = mm_timestamp();
+	last_keepalive = mm_timestamp();
 	return 0;
 }
 
@@ -1148,6 +1386,10 @@ static int maweb_shutdown(size_t n, instance** inst){
 		data->host = NULL;
 		free(data->port);
 		data->port = NULL;
+		free(data->addr);
+		data->addr = NULL;
+		free(data->addr_len);
+		data->addr_len = NULL;
 
 		free(data->user);
 		data->user = NULL;
@@ -1155,14 +1397,21 @@ static int maweb_shutdown(size_t n, instance** inst){
 		data->pass = NULL;
 
 		maweb_disconnect(inst[u]);
-		free(data->buffer);
-		data->buffer = NULL;
-		data->allocated = 0;
+		mmbackend_stream_free(&(data->stream));
+		free(data->xmit);
+		data->xmit = NULL;
+		data->xmit_alloc = 0;
+		mmbackend_queue_free(&(data->queue));
+		json_index_free(&(data->json));
 
 		free(data->channel);
 		data->channel = NULL;
 		data->channels = 0;
 
+		free(data->exec);
+		data->exec = NULL;
+		data->execs = 0;
+
 		free(inst[u]->impl);
 	}
 
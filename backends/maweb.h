@@ -14,10 +14,21 @@ static uint32_t maweb_interval();
 //Default login password: MD5("midimonster")
 #define MAWEB_DEFAULT_PASSWORD "2807623134739142b119aff358f8a219"
 #define MAWEB_DEFAULT_PORT "80"
-#define MAWEB_RECV_CHUNK 1024
+//maximum size of a single message received from the console
+#define MAWEB_RECV_LIMIT (16 * 1024 * 1024)
 #define MAWEB_XMIT_CHUNK 4096
+//maximum amount of data queued for a slow console before the connection is reset
+#define MAWEB_XMIT_LIMIT (1024 * 1024)
 #define MAWEB_FRAME_HEADER_LENGTH 16
 #define MAWEB_CONNECTION_KEEPALIVE 10000
+//maximum number of playback requests pipelined per instance
+#define MAWEB_POLL_WINDOW 4
+//maximum poll interval for executor blocks without changes
+#define MAWEB_POLL_IDLE 1000
+//initial backoff step when no base interval is configured
+#define MAWEB_POLL_BACKOFF 10
+//playback requests not answered within this time are considered lost
+#define MAWEB_POLL_TIMEOUT 5000
 
 typedef enum /*_maweb_channel_type*/ {
 	type_unset = 0,
@@ -78,11 +89,38 @@ typedef struct /*_maweb_channel*/ {
 	channel* chan;
 } maweb_channel_data;
 
+typedef struct /*_maweb_poll_block*/ {
+	//request without the session identifier
+	char* request;
+	uint16_t page;
+	uint16_t first;
+	uint16_t last;
+
+	uint8_t inflight;
+	uint64_t sequence;
+	uint64_t sent;
+	uint64_t interval;
+	uint64_t due;
+} maweb_poll_block;
+
+typedef struct /*_maweb_exec_state*/ {
+	uint8_t used;
+	uint16_t page;
+	uint16_t index;
+	//hash of the last executor data received
+	uint64_t hash;
+} maweb_exec_state;
+
 typedef struct /*_maweb_instance_data*/ {
 	size_t next_host;
+	//host the current round of connection attempts started with
+	size_t first_host;
 	size_t hosts;
 	char** host;
 	char** port;
+	//host addresses, resolved once on startup
+	struct sockaddr_storage* addr;
+	socklen_t* addr_len;
 
 	char* user;
 	char* pass;
@@ -96,10 +134,22 @@ typedef struct /*_maweb_instance_data*/ {
 	maweb_cmdline_mode cmdline;
 
 	int fd;
+	uint8_t connecting;
+	mmbackend_queue queue;
+	uint8_t* xmit;
+	size_t xmit_alloc;
 	maweb_state state;
-	size_t offset;
-	size_t allocated;
-	uint8_t* buffer;
+	mmbackend_stream stream;
+	json_index json;
 
 	uint64_t updates_inflight;
+	uint64_t poll_sequence;
+	uint64_t next_poll;
+	size_t poll_next;
+	size_t poll_blocks;
+	maweb_poll_block* poll;
+
+	//open-addressed table of mapped executors
+	size_t execs;
+	maweb_exec_state* exec;
 } maweb_instance_data;
@@ -6,6 +6,9 @@
 
 static char* sequencer_name = NULL;
 static snd_seq_t* sequencer = NULL;
+//instances indexed by their ALSA sequencer port
+static size_t midi_ports = 0;
+static instance** midi_port_instance = NULL;
 
 enum /*_midi_channel_type*/ {
 	none = 0,
@@ -114,7 +117,44 @@ static int midi_configure_instance(instance* inst, char* option, char* value){
 	return 1;
 }
 
+//EPN channels are not cached due to their 14-bit address space, returns MIDI_CACHE_SIZE for uncached channels
+static size_t midi_cache_index(midi_channel_ident ident){
+	//out-of-range MIDI channels would alias other cache entries
+	if(ident.fields.channel > 15){
+		return MIDI_CACHE_SIZE;
+	}
+
+	switch(ident.fields.type){
+		case note:
+		case cc:
+		case pressure:
+			if(ident.fields.control > 127){
+				break;
+			}
+			return ((ident.fields.type - note) * 16 + ident.fields.channel) * 128 + ident.fields.control;
+		case aftertouch:
+		case pitchbend:
+		case program:
+			return MIDI_CACHE_CONTROLS + (ident.fields.type - aftertouch) * 16 + ident.fields.channel;
+	}
+	return MIDI_CACHE_SIZE;
+}
+
+static channel* midi_cache_lookup(instance* inst, midi_channel_ident ident){
+	midi_instance_data* data = (midi_instance_data*) inst->impl;
+	size_t index = midi_cache_index(ident);
+
+	//all channels pass through midi_channel on creation, so the cache is authoritative for the indices it covers
+	if(index < MIDI_CACHE_SIZE){
+		return data->cache ? data->cache[index] : NULL;
+	}
+	return mm_channel(inst, ident.label, 0);
+}
+
 static channel* midi_channel(instance* inst, char* spec, uint8_t flags){
+	midi_instance_data* data = (midi_instance_data*) inst->impl;
+	channel* chan = NULL;
+	size_t index;
 	midi_channel_ident ident = {
 		.label = 0
 	};
@@ -182,7 +222,19 @@ static channel* midi_channel(instance* inst, char* spec, uint8_t flags){
 	ident.fields.control = strtoul(channel, NULL, 10);
 
 	if(ident.label){
-		return mm_channel(inst, ident.label, 1);
+		chan = mm_channel(inst, ident.label, 1);
+		index = midi_cache_index(ident);
+		if(chan && index < MIDI_CACHE_SIZE){
+			if(!data->cache){
+				data->cache = calloc(MIDI_CACHE_SIZE, sizeof(*data->cache));
+				if(!data->cache){
+					LOG("Failed to allocate memory");
+					return NULL;
+				}
+			}
+			data->cache[index] = chan;
+		}
+		return chan;
 	}
 
 	return NULL;
@@ -353,7 +405,7 @@ static void midi_handle_epn(instance* inst, uint8_t chan, uint16_t control, uint
 		val.normalised = (double) data->epn_value[chan] / 16383.0;
 
 		//push the new value
-		changed = mm_channel(inst, ident.label, 0);
+		changed = midi_cache_lookup(inst, ident);
 		if(changed){
 			mm_channel_event(changed, val);
 		}
@@ -385,8 +437,8 @@ static int midi_handle(size_t num, managed_fd* fds){
 		ident.fields.control = ev->data.note.note;
 		val.normalised = (double) ev->data.note.velocity / 127.0;
 
-		//scan for the instance before parsing incoming data, instance state is required for the EPN state machine
-		inst = mm_instance_find(BACKEND_NAME, ev->dest.port);
+		//find the instance before parsing incoming data, instance state is required for the EPN state machine
+		inst = (ev->dest.port < midi_ports) ? midi_port_instance[ev->dest.port] : NULL;
 		if(!inst){
 			LOG("Delivered event did not match any instance");
 			continue;
@@ -444,7 +496,7 @@ static int midi_handle(size_t num, managed_fd* fds){
 		}
 
 		event_type = midi_type_name(ident.fields.type);
-		changed = mm_channel(inst, ident.label, 0);
+		changed = midi_cache_lookup(inst, ident);
 		if(changed){
 			if(mm_channel_event(changed, val)){
 				free(ev);
@@ -491,8 +543,25 @@ static int midi_start(size_t n, instance** inst){
 	for(p = 0; p < n; p++){
 		data = (midi_instance_data*) inst[p]->impl;
 		data->port = snd_seq_create_simple_port(sequencer, inst[p]->name, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE | SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ, SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+		if(data->port < 0){
+			LOGPF("Failed to create sequencer port for instance %s", inst[p]->name);
+			goto bail;
+		}
 		inst[p]->ident = data->port;
 
+		//index the instance by port for incoming events
+		if((size_t) data->port >= midi_ports){
+			midi_port_instance = realloc(midi_port_instance, (data->port + 1) * sizeof(instance*));
+			if(!midi_port_instance){
+				LOG("Failed to allocate memory");
+				midi_ports = 0;
+				goto bail;
+			}
+			memset(midi_port_instance + midi_ports, 0, (data->port + 1 - midi_ports) * sizeof(instance*));
+			midi_ports = data->port + 1;
+		}
+		midi_port_instance[data->port] = inst[p];
+
 		//make connections
 		if(data->write){
 			if(snd_seq_parse_address(sequencer, &addr, data->write) == 0){
@@ -552,9 +621,15 @@ static int midi_shutdown(size_t n, instance** inst){
 		free(data->write);
 		data->read = NULL;
 		data->write = NULL;
+		free(data->cache);
+		data->cache = NULL;
 		free(inst[p]->impl);
 	}
 
+	free(midi_port_instance);
+	midi_port_instance = NULL;
+	midi_ports = 0;
+
 	//close midi
 	if(sequencer){
 		snd_seq_close(sequencer);
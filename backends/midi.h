@@ -15,6 +15,10 @@ static int midi_shutdown(size_t n, instance** inst);
 #define EPN_PARAMETER_LO 2
 #define EPN_VALUE_HI 1
 
+//dense channel cache layout: note, cc and pressure controls for each MIDI channel, followed by the channel-wide controls
+#define MIDI_CACHE_CONTROLS (3 * 16 * 128)
+#define MIDI_CACHE_SIZE (MIDI_CACHE_CONTROLS + 3 * 16)
+
 typedef struct /*_midi_instance_data*/ {
 	int port;
 	char* read;
@@ -24,6 +28,9 @@ typedef struct /*_midi_instance_data*/ {
 	uint16_t epn_control[16];
 	uint16_t epn_value[16];
 	uint8_t epn_status[16];
+
+	//channels created on this instance, indexed by midi_cache_index
+	channel** cache;
 } midi_instance_data;
 
 typedef union {
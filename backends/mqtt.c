@@ -9,6 +9,8 @@
 #include "mqtt.h"
 
 static uint64_t last_maintenance = 0;
+//earliest time a coalesced value is due for publishing, 0 if none pending
+static uint64_t coalesce_due = 0;
 /* according to spec 2.2.2.2 */
 static struct {
 	uint8_t property;
@@ -60,6 +62,7 @@ MM_PLUGIN_API int init(){
 		.channel = mqtt_channel,
 		.handle = mqtt_set,
 		.process = mqtt_handle,
+		.interval = mqtt_interval,
 		.start = mqtt_start,
 		.shutdown = mqtt_shutdown
 	};
@@ -72,6 +75,16 @@ MM_PLUGIN_API int init(){
 	return 0;
 }
 
+static uint32_t mqtt_interval(){
+	uint64_t now = mm_timestamp();
+
+	//wake up in time for the next coalesced publish
+	if(coalesce_due){
+		return (coalesce_due > now) ? (coalesce_due - now) : 1;
+	}
+	return 0;
+}
+
 static int mqtt_parse_hostspec(instance* inst, char* hostspec){
 	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
 	char* host = strchr(hostspec, '@'), *password = NULL, *port = NULL;
@@ -234,15 +247,25 @@ static void mqtt_disconnect(instance* inst){
 	size_t u;
 
 	data->last_control = 0;
+	data->connecting = 0;
+	data->connected = 0;
+	data->server_receive_max = 0;
 
 	//reset aliases as they can not be reused across sessions
 	data->server_max_alias = 0;
 	data->current_alias = 1;
 	for(u = 0; u < data->nchannels; u++){
 		data->channel[u].topic_alias_sent = 0;
-		data->channel[u].topic_alias_rcvd = 0;
+	}
+	for(u = 0; u <= MQTT_TOPIC_ALIAS_MAX; u++){
+		free(data->topic_alias[u]);
+		data->topic_alias[u] = NULL;
 	}
 
+	//queued data can not be sent anymore
+	data->xmit_len = 0;
+	mmbackend_queue_init(&(data->queue), -1, BACKEND_NAME, inst, MQTT_XMIT_LIMIT, mmbackend_queue_fail);
+
 	//unmanage the fd
 	mm_manage_fd(data->fd, BACKEND_NAME, 0, NULL);
 
@@ -250,27 +273,91 @@ static void mqtt_disconnect(instance* inst){
 	data->fd = -1;
 }
 
-static int mqtt_transmit(instance* inst, uint8_t type, size_t vh_length, uint8_t* vh, size_t payload_length, uint8_t* payload){
-	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+static int mqtt_reserve(mqtt_instance_data* data, size_t length){
+	if(data->xmit_len + length > data->xmit_alloc){
+		data->xmit_alloc = max(data->xmit_len + length, 2 * data->xmit_alloc);
+		data->xmit = realloc(data->xmit, data->xmit_alloc);
+		if(!data->xmit){
+			data->xmit_alloc = data->xmit_len = 0;
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//finish a message whose body was written after a 5-byte gap at offset start of the output buffer
+static void mqtt_frame(mqtt_instance_data* data, uint8_t type, size_t start, size_t body_length){
 	uint8_t fixed_header[5];
-	size_t offset = 0;
+	size_t header_length = 0;
 
 	//how in the world is it a _fixed_ header if it contains a variable length integer? eh...
-	fixed_header[offset++] = type;
-	offset += mqtt_push_varint(vh_length + payload_length, sizeof(fixed_header) - offset, fixed_header + offset);
+	fixed_header[header_length++] = type;
+	header_length += mqtt_push_varint(body_length, sizeof(fixed_header) - header_length, fixed_header + header_length);
+
+	//close the gap left for the maximum header size
+	if(header_length < sizeof(fixed_header)){
+		memmove(data->xmit + start + header_length, data->xmit + start + sizeof(fixed_header), body_length);
+	}
+	memcpy(data->xmit + start, fixed_header, header_length);
+	data->xmit_len = start + header_length + body_length;
+}
+
+//send all queued messages at once
+static int mqtt_flush(instance* inst){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+
+	if(!data->xmit_len){
+		return 0;
+	}
+
+	if(data->fd < 0){
+		data->xmit_len = 0;
+		return 1;
+	}
+
+	//hold the CONNECT message until the connection is established
+	if(data->connecting){
+		return 0;
+	}
 
-	if(mmbackend_send(data->fd, fixed_header, offset)
-			|| (vh && vh_length && mmbackend_send(data->fd, vh, vh_length))
-			|| (payload && payload_length && mmbackend_send(data->fd, payload, payload_length))){
-		LOGPF("Failed to transmit control message for %s, assuming connection failure", inst->name);
+	//writes are queued when the broker can not keep up
+	if(mmbackend_queue_send(&(data->queue), data->xmit, data->xmit_len, 0)){
+		LOGPF("Failed to transmit data for %s, assuming connection failure", inst->name);
 		mqtt_disconnect(inst);
 		return 1;
 	}
 
+	data->xmit_len = 0;
 	data->last_control = mm_timestamp();
 	return 0;
 }
 
+static int mqtt_queue(instance* inst, uint8_t type, size_t vh_length, uint8_t* vh, size_t payload_length, uint8_t* payload){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	size_t start = data->xmit_len;
+
+	if(mqtt_reserve(data, 5 + vh_length + payload_length)){
+		return 1;
+	}
+
+	if(vh && vh_length){
+		memcpy(data->xmit + start + 5, vh, vh_length);
+	}
+	if(payload && payload_length){
+		memcpy(data->xmit + start + 5 + vh_length, payload, payload_length);
+	}
+	mqtt_frame(data, type, start, vh_length + payload_length);
+	return 0;
+}
+
+static int mqtt_transmit(instance* inst, uint8_t type, size_t vh_length, uint8_t* vh, size_t payload_length, uint8_t* payload){
+	if(mqtt_queue(inst, type, vh_length, vh, payload_length, payload)){
+		return 1;
+	}
+	return mqtt_flush(inst);
+}
+
 static int mqtt_configure(char* option, char* value){
 	LOG("This backend does not take global configuration");
 	return 1;
@@ -303,10 +390,8 @@ static int mqtt_reconnect(instance* inst){
 			(data->user || data->password) ? "yes" : "no",
 			(data->mqtt_version == 0x05) ? "v5" : "v3.1.1");
 
-	data->fd = mmbackend_socket(data->host,
-			data->port ? data->port : (data->tls ? MQTT_TLS_PORT : MQTT_PORT),
-			SOCK_STREAM, 0, 0, 1);
-
+	//connect without blocking, the CONNECT message is sent once the connection is established
+	data->fd = mmbackend_socket_connect(&(data->addr), data->addr_len, &(data->connecting));
 	if(data->fd < 0){
 		//retry later
 		return 1;
@@ -314,12 +399,12 @@ static int mqtt_reconnect(instance* inst){
 
 	//prepare CONNECT message header
 	variable_header[6] = data->mqtt_version;
-	variable_header[7] = 0x02 /*clean start*/ | (data->user ? 0x80 : 0x00) | (data->password ? 0x40 : 0x00);
+	variable_header[7] = (data->persistent ? 0x00 : 0x02 /*clean start*/) | (data->user ? 0x80 : 0x00) | (data->password ? 0x40 : 0x00);
 
 	if(data->mqtt_version == 0x05){ //mqtt v5 has additional options
 		//push number of option bytes (as a varint, no less) before actually pushing the option data.
 		//obviously someone thought saving 3 whole bytes in exchange for not being able to sequentially create the package was smart..
-		variable_header[vh_offset++] = 8;
+		variable_header[vh_offset++] = data->persistent ? 13 : 8;
 		//push maximum packet size option
 		variable_header[vh_offset++] = 0x27;
 		variable_header[vh_offset++] = (MQTT_BUFFER_LENGTH >> 24) & 0xFF;
@@ -328,8 +413,16 @@ static int mqtt_reconnect(instance* inst){
 		variable_header[vh_offset++] = (MQTT_BUFFER_LENGTH) & 0xFF;
 		//push topic alias maximum option
 		variable_header[vh_offset++] = 0x22;
-		variable_header[vh_offset++] = 0xFF;
-		variable_header[vh_offset++] = 0xFF;
+		variable_header[vh_offset++] = (MQTT_TOPIC_ALIAS_MAX >> 8) & 0xFF;
+		variable_header[vh_offset++] = MQTT_TOPIC_ALIAS_MAX & 0xFF;
+		if(data->persistent){
+			//push session expiry interval option, the session ends with the connection otherwise
+			variable_header[vh_offset++] = 0x11;
+			variable_header[vh_offset++] = (MQTT_SESSION_EXPIRY >> 24) & 0xFF;
+			variable_header[vh_offset++] = (MQTT_SESSION_EXPIRY >> 16) & 0xFF;
+			variable_header[vh_offset++] = (MQTT_SESSION_EXPIRY >> 8) & 0xFF;
+			variable_header[vh_offset++] = MQTT_SESSION_EXPIRY & 0xFF;
+		}
 	}
 
 	//prepare CONNECT payload
@@ -342,14 +435,14 @@ static int mqtt_reconnect(instance* inst){
 		payload_offset += mqtt_push_utf8(payload + payload_offset, sizeof(payload) - payload_offset, data->password);
 	}
 
-	mqtt_transmit(inst, MSG_CONNECT, vh_offset, variable_header, payload_offset, payload);
-
-	//register the fd
-	if(mm_manage_fd(data->fd, BACKEND_NAME, 1, (void*) inst)){
+	//register the fd, a pending connection becomes writable when it completes
+	if(mm_manage_fd(data->fd, BACKEND_NAME, mmfd_read | (data->connecting ? mmfd_write : 0), (void*) inst)){
 		LOG("Failed to register FD");
 		return 2;
 	}
+	mmbackend_queue_init(&(data->queue), data->fd, BACKEND_NAME, inst, MQTT_XMIT_LIMIT, mmbackend_queue_fail);
 
+	mqtt_transmit(inst, MSG_CONNECT, vh_offset, variable_header, payload_offset, payload);
 	return 0;
 }
 
@@ -462,6 +555,38 @@ static int mqtt_configure_instance(instance* inst, char* option, char* value){
 			return 0;
 		}
 	}
+	else if(!strcmp(option, "qos")){
+		data->qos = strtoul(value, NULL, 10);
+		if(data->qos > 2){
+			LOGPF("Invalid QoS level %s on instance %s", value, inst->name);
+			return 1;
+		}
+		return 0;
+	}
+	else if(!strcmp(option, "inflight")){
+		data->inflight_max = strtoul(value, NULL, 10);
+		if(!data->inflight_max || data->inflight_max > MQTT_INFLIGHT_MAX){
+			LOGPF("In-flight window on instance %s must be between 1 and %d", inst->name, MQTT_INFLIGHT_MAX);
+			return 1;
+		}
+		return 0;
+	}
+	else if(!strcmp(option, "session")){
+		if(!strcmp(value, "persistent")){
+			data->persistent = 1;
+			return 0;
+		}
+		else if(!strcmp(value, "clean")){
+			data->persistent = 0;
+			return 0;
+		}
+		LOGPF("Unknown session type %s on instance %s", value, inst->name);
+		return 1;
+	}
+	else if(!strcmp(option, "coalesce")){
+		data->coalesce = strtoul(value, NULL, 10);
+		return 0;
+	}
 	else if(!strcmp(option, "protocol")){
 		data->mqtt_version = MQTT_VERSION_DEFAULT;
 		if(!strcmp(value, "3.1.1")){
@@ -489,12 +614,12 @@ static int mqtt_push_subscriptions(instance* inst){
 			variable_header[1] = (data->packet_identifier) & 0xFF;
 
 			payload_offset += mqtt_push_utf8(payload + payload_offset, sizeof(payload) - payload_offset, data->channel[u].topic);
-			payload[payload_offset++] = (data->mqtt_version == 0x05) ? MQTT5_NO_LOCAL : 0;
+			payload[payload_offset++] = ((data->mqtt_version == 0x05) ? MQTT5_NO_LOCAL : 0) | data->qos;
 
+			//identifiers up to MQTT_INFLIGHT_MAX are reserved for publishing
 			data->packet_identifier++;
-			//zero is not a valid packet identifier
-			if(!data->packet_identifier){
-				data->packet_identifier++;
+			if(data->packet_identifier <= MQTT_INFLIGHT_MAX){
+				data->packet_identifier = MQTT_INFLIGHT_MAX + 1;
 			}
 
 			mqtt_transmit(inst, MSG_SUBSCRIBE, data->mqtt_version == 0x05 ? 3 : 2, variable_header, payload_offset, payload);
@@ -516,20 +641,146 @@ static int mqtt_instance(instance* inst){
 
 	data->fd = -1;
 	data->mqtt_version = MQTT_VERSION_DEFAULT;
-	data->packet_identifier = 1;
+	data->packet_identifier = MQTT_INFLIGHT_MAX + 1;
+	data->inflight_max = MQTT_INFLIGHT_DEFAULT;
 	data->current_alias = 1;
 	inst->impl = data;
 
 	return 0;
 }
 
+static int mqtt_topic_validate(char* topic){
+	char* level = topic, *end = NULL;
+
+	//wildcards must occupy a complete level, '#' is only valid as the last level
+	for(; level; level = end ? end + 1 : NULL){
+		end = strchr(level, '/');
+		if(strpbrk(level, "+#") && strpbrk(level, "+#") < (end ? end : level + strlen(level))){
+			if((level[0] != '+' && level[0] != '#')
+					|| (level[1] && level[1] != '/')
+					|| (level[0] == '#' && end)){
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int mqtt_topic_compare(mqtt_topic_node* node, char* level, size_t length){
+	int rv = strncmp(node->level, level, length);
+	return rv ? rv : (node->level[length] ? 1 : 0);
+}
+
+//returns the index of the child with the given level, or the insertion position with found set to 0
+static size_t mqtt_topic_find(mqtt_topic_node* node, char* level, size_t length, uint8_t* found){
+	size_t lower = 0, upper = node->children, mid;
+	int cmp;
+
+	*found = 0;
+	while(lower < upper){
+		mid = lower + (upper - lower) / 2;
+		cmp = mqtt_topic_compare(node->child[mid], level, length);
+		if(!cmp){
+			*found = 1;
+			return mid;
+		}
+		else if(cmp < 0){
+			lower = mid + 1;
+		}
+		else{
+			upper = mid;
+		}
+	}
+	return lower;
+}
+
+static int mqtt_topic_insert(mqtt_topic_node* node, char* topic, size_t channel){
+	char* level = topic, *end = NULL;
+	size_t length, index;
+	uint8_t found;
+	mqtt_topic_node* next = NULL;
+
+	for(; level; level = end ? end + 1 : NULL){
+		end = strchr(level, '/');
+		length = end ? (end - level) : strlen(level);
+
+		if(length == 1 && level[0] == '#'){
+			node->multilevel = channel + 1;
+			return 0;
+		}
+
+		if(length == 1 && level[0] == '+'){
+			if(!node->single_level){
+				node->single_level = calloc(1, sizeof(mqtt_topic_node));
+				if(!node->single_level){
+					LOG("Failed to allocate memory");
+					return 1;
+				}
+			}
+			node = node->single_level;
+			continue;
+		}
+
+		index = mqtt_topic_find(node, level, length, &found);
+		if(!found){
+			node->child = realloc(node->child, (node->children + 1) * sizeof(mqtt_topic_node*));
+			next = calloc(1, sizeof(mqtt_topic_node));
+			if(!node->child || !next){
+				free(next);
+				node->children = 0;
+				LOG("Failed to allocate memory");
+				return 1;
+			}
+
+			next->level = strndup(level, length);
+			if(!next->level){
+				free(next);
+				LOG("Failed to allocate memory");
+				return 1;
+			}
+
+			memmove(node->child + index + 1, node->child + index, (node->children - index) * sizeof(mqtt_topic_node*));
+			node->child[index] = next;
+			node->children++;
+		}
+		node = node->child[index];
+	}
+
+	node->channel = channel + 1;
+	return 0;
+}
+
+static void mqtt_topic_free(mqtt_topic_node* node){
+	size_t u;
+
+	for(u = 0; u < node->children; u++){
+		mqtt_topic_free(node->child[u]);
+		free(node->child[u]);
+	}
+
+	if(node->single_level){
+		mqtt_topic_free(node->single_level);
+		free(node->single_level);
+	}
+
+	free(node->child);
+	free(node->level);
+	memset(node, 0, sizeof(mqtt_topic_node));
+}
+
 static channel* mqtt_channel(instance* inst, char* spec, uint8_t flags){
 	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
 	size_t u;
 
 	//check spec for compliance
-	if(strchr(spec, '+') || strchr(spec, '#')){
-		LOGPF("Invalid character in channel specification %s", spec);
+	if(mqtt_topic_validate(spec)){
+		LOGPF("Invalid wildcard use in channel specification %s", spec);
+		return NULL;
+	}
+
+	//wildcard subscriptions can not be published to
+	if((flags & mmchannel_output) && (strchr(spec, '+') || strchr(spec, '#'))){
+		LOGPF("Wildcard channel %s.%s can not be used for output", inst->name, spec);
 		return NULL;
 	}
 
@@ -552,7 +803,8 @@ static channel* mqtt_channel(instance* inst, char* spec, uint8_t flags){
 
 		data->channel[u].topic = strdup(spec);
 		data->channel[u].topic_alias_sent = 0;
-		data->channel[u].topic_alias_rcvd = 0;
+		data->channel[u].last_publish = 0;
+		data->channel[u].pending = 0;
 		data->channel[u].flags = flags;
 		data->channel[u].values = 0;
 		data->channel[u].value = NULL;
@@ -562,6 +814,10 @@ static channel* mqtt_channel(instance* inst, char* spec, uint8_t flags){
 			return NULL;
 		}
 
+		if(mqtt_topic_insert(&data->topics, spec, u)){
+			return NULL;
+		}
+
 		DBGPF("Allocated channel %" PRIsize_t " for spec %s.%s, flags are %02X", u, inst->name, spec, data->channel[u].flags);
 		data->nchannels++;
 	}
@@ -680,93 +936,334 @@ static size_t mqtt_serialize(instance* inst, mqtt_channel_data* input, char* out
 	return 0;
 }
 
-static int mqtt_set(instance* inst, size_t num, channel** c, channel_value* v){
+//build a PUBLISH message in place in the output buffer, a packet identifier of 0 publishes at QoS 0
+static int mqtt_publish(instance* inst, size_t index, double value, uint16_t packet_id, uint8_t dup){
 	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
-	uint8_t variable_header[MQTT_BUFFER_LENGTH];
-	uint8_t payload[MQTT_BUFFER_LENGTH], alias_assigned = 0;
-	size_t vh_length = 0, payload_length = 0, u;
+	mqtt_channel_data* chan = data->channel + index;
+	uint8_t* message = NULL;
+	uint8_t qos = packet_id ? data->qos : 0;
+	char payload[MQTT_BUFFER_LENGTH];
+	size_t start = data->xmit_len, vh_length = 0, payload_length = 0;
+
+	//serialize first so only the actual message length needs to be reserved
+	payload_length = mqtt_serialize(inst, chan, payload, (data->mqtt_version == 0x05) ? sizeof(payload) - 2 : sizeof(payload), value);
+	if(!payload_length){
+		return 1;
+	}
 
-	for(u = 0; u < num; u++){
-		vh_length = payload_length = alias_assigned = 0;
+	//fixed header gap, topic, packet identifier, properties, payload length and payload
+	if(mqtt_reserve(data, 5 + 2 + strlen(chan->topic) + 2 + 6 + 2 + payload_length)){
+		return 1;
+	}
+	message = data->xmit + start + 5;
 
-		if(data->mqtt_version == 0x05){
-			if(data->channel[c[u]->ident].topic_alias_sent){
-				//push zero-length topic
-				variable_header[vh_length++] = 0;
-				variable_header[vh_length++] = 0;
-			}
-			else{
-				//push topic
-				vh_length += mqtt_push_utf8(variable_header + vh_length, sizeof(variable_header) - vh_length, data->channel[c[u]->ident].topic);
-				//generate topic alias if possible
-				if(data->current_alias <= data->server_max_alias){
-					data->channel[c[u]->ident].topic_alias_sent = data->current_alias++;
-					DBGPF("Assigned outbound topic alias %" PRIu16 " to topic %s.%s", data->channel[c[u]->ident].topic_alias_sent, inst->name, data->channel[c[u]->ident].topic);
-
-					alias_assigned = 1;
-				}
+	if(data->mqtt_version == 0x05){
+		if(chan->topic_alias_sent){
+			//push zero-length topic
+			message[vh_length++] = 0;
+			message[vh_length++] = 0;
+		}
+		else{
+			//push topic
+			vh_length += mqtt_push_utf8(message + vh_length, data->xmit_alloc - start - 5 - vh_length, chan->topic);
+			//generate topic alias if possible
+			if(data->current_alias <= data->server_max_alias){
+				chan->topic_alias_sent = data->current_alias++;
+				DBGPF("Assigned outbound topic alias %" PRIu16 " to topic %s.%s", chan->topic_alias_sent, inst->name, chan->topic);
 			}
+		}
+
+		if(qos){
+			message[vh_length++] = (packet_id >> 8) & 0xFF;
+			message[vh_length++] = packet_id & 0xFF;
+		}
+
+		//push property length
+		message[vh_length++] = (chan->topic_alias_sent) ? 5 : 2;
+
+		//push payload type (0x01)
+		message[vh_length++] = 0x01;
+		message[vh_length++] = 1;
+
+		if(chan->topic_alias_sent){
+			//push topic alias (0x23)
+			message[vh_length++] = 0x23;
+			message[vh_length++] = (chan->topic_alias_sent >> 8) & 0xFF;
+			message[vh_length++] = chan->topic_alias_sent & 0xFF;
+		}
+
+		//push payload length
+		message[vh_length++] = (payload_length >> 8) & 0xFF;
+		message[vh_length++] = payload_length & 0xFF;
+	}
+	else{
+		//push topic
+		vh_length += mqtt_push_utf8(message + vh_length, data->xmit_alloc - start - 5 - vh_length, chan->topic);
+		if(qos){
+			message[vh_length++] = (packet_id >> 8) & 0xFF;
+			message[vh_length++] = packet_id & 0xFF;
+		}
+	}
+	memcpy(message + vh_length, payload, payload_length);
+
+	DBGPF("Queueing %" PRIsize_t " bytes for %s, QoS %d, packet %" PRIu16, payload_length, inst->name, qos, packet_id);
+	mqtt_frame(data, MSG_PUBLISH | (dup ? 0x08 : 0) | (qos << 1), start, vh_length + payload_length);
+	chan->last_publish = mm_timestamp();
+	return 0;
+}
+
+//returns the in-flight slot for a new QoS 1/2 publish or -1 if the window is exhausted
+static ssize_t mqtt_inflight_alloc(mqtt_instance_data* data){
+	if(!data->inflight_free_count
+			|| (data->server_receive_max && data->inflight_max - data->inflight_free_count >= data->server_receive_max)){
+		return -1;
+	}
+
+	return data->inflight_free[--data->inflight_free_count];
+}
+
+static void mqtt_inflight_release(mqtt_instance_data* data, size_t slot){
+	data->inflight[slot].state = INFLIGHT_FREE;
+	data->inflight_free[data->inflight_free_count++] = slot;
+}
+
+//returns 2 if the value could not be published because the in-flight window is full
+static int mqtt_send_value(instance* inst, size_t index, double value){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	ssize_t slot;
+
+	if(!data->qos){
+		mqtt_publish(inst, index, value, 0, 0);
+		return 0;
+	}
+
+	slot = mqtt_inflight_alloc(data);
+	if(slot < 0){
+		return 2;
+	}
+
+	data->inflight[slot].state = INFLIGHT_PUBLISH;
+	data->inflight[slot].transmitted = data->connected;
+	data->inflight[slot].sequence = data->inflight_sequence++;
+	data->inflight[slot].channel = index;
+	data->inflight[slot].value = value;
+
+	//while not connected, the message is kept and sent once the session is established
+	if(data->connected && mqtt_publish(inst, index, value, slot + 1, 0)){
+		mqtt_inflight_release(data, slot);
+	}
+	return 0;
+}
 
-			//push property length
-			variable_header[vh_length++] = (data->channel[c[u]->ident].topic_alias_sent) ? 5 : 2;
+//keep the most recent value for a channel until it may be published
+static int mqtt_defer(instance* inst, size_t index, double value){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	mqtt_channel_data* chan = data->channel + index;
+	uint64_t now = mm_timestamp();
 
-			//push payload type (0x01)
-			variable_header[vh_length++] = 0x01;
-			variable_header[vh_length++] = 1;
+	if(!chan->pending){
+		data->pending = realloc(data->pending, (data->npending + 1) * sizeof(size_t));
+		if(!data->pending){
+			data->npending = 0;
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		data->pending[data->npending++] = index;
+		chan->pending = 1;
+	}
+	chan->pending_value = value;
 
-			if(data->channel[c[u]->ident].topic_alias_sent){
-				//push topic alias (0x23)
-				variable_header[vh_length++] = 0x23;
-				variable_header[vh_length++] = (data->channel[c[u]->ident].topic_alias_sent >> 8) & 0xFF;
-				variable_header[vh_length++] = data->channel[c[u]->ident].topic_alias_sent & 0xFF;
+	if(data->coalesce && now - chan->last_publish < data->coalesce
+			&& (!coalesce_due || chan->last_publish + data->coalesce < coalesce_due)){
+		coalesce_due = chan->last_publish + data->coalesce;
+	}
+	return 0;
+}
+
+//publish deferred values whose coalescing window has closed, as far as the in-flight window allows
+static void mqtt_release(instance* inst){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	mqtt_channel_data* chan = NULL;
+	uint64_t now = mm_timestamp();
+	size_t p;
+
+	for(p = 0; p < data->npending; p++){
+		chan = data->channel + data->pending[p];
+		if(data->coalesce && now - chan->last_publish < data->coalesce){
+			if(!coalesce_due || chan->last_publish + data->coalesce < coalesce_due){
+				coalesce_due = chan->last_publish + data->coalesce;
 			}
+			continue;
+		}
+
+		if(mqtt_send_value(inst, data->pending[p], chan->pending_value) == 2){
+			//retried when an acknowledgement frees a slot
+			continue;
+		}
+
+		chan->pending = 0;
+		data->pending[p] = data->pending[data->npending - 1];
+		data->npending--;
+		p--;
+	}
+}
+
+static int mqtt_inflight_compare(const void* raw_a, const void* raw_b){
+	mqtt_inflight* a = *((mqtt_inflight**) raw_a);
+	mqtt_inflight* b = *((mqtt_inflight**) raw_b);
+	return (a->sequence > b->sequence) - (a->sequence < b->sequence);
+}
 
-			payload_length = mqtt_serialize(inst, data->channel + c[u]->ident, (char*) (payload + 2), sizeof(payload) - 2, v[u].normalised);
-			if(payload_length){
-				payload[0] = (payload_length >> 8) & 0xFF;
-				payload[1] = payload_length & 0xFF;
-				payload_length += 2;
+//(re-)transmit all unacknowledged messages in their original order after a connection has been established
+static int mqtt_resend(instance* inst, uint8_t session_present){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	mqtt_inflight** order = NULL;
+	uint8_t packet_id[2];
+	size_t u, n = 0, slot;
+
+	if(!data->qos || data->inflight_free_count == data->inflight_max){
+		return 0;
+	}
+
+	order = calloc(data->inflight_max - data->inflight_free_count, sizeof(mqtt_inflight*));
+	if(!order){
+		LOG("Failed to allocate memory");
+		return 1;
+	}
+
+	for(u = 0; u < data->inflight_max; u++){
+		if(data->inflight[u].state != INFLIGHT_FREE){
+			order[n++] = data->inflight + u;
+		}
+	}
+	qsort(order, n, sizeof(mqtt_inflight*), mqtt_inflight_compare);
+
+	for(u = 0; u < n; u++){
+		slot = order[u] - data->inflight;
+		if(order[u]->state == INFLIGHT_PUBLISH){
+			//without a stored session, the server has never seen this message
+			if(mqtt_publish(inst, order[u]->channel, order[u]->value, slot + 1, session_present && order[u]->transmitted)){
+				mqtt_inflight_release(data, slot);
+				continue;
 			}
+			order[u]->transmitted = 1;
+		}
+		else if(session_present){
+			packet_id[0] = ((slot + 1) >> 8) & 0xFF;
+			packet_id[1] = (slot + 1) & 0xFF;
+			mqtt_queue(inst, MSG_PUBREL, 2, packet_id, 0, NULL);
 		}
 		else{
-			//push topic
-			vh_length += mqtt_push_utf8(variable_header + vh_length, sizeof(variable_header) - vh_length, data->channel[c[u]->ident].topic);
-			if(data->mqtt_version == 0x05){
-				//push property length
-				variable_header[vh_length++] = 2;
-
-				//push payload type (0x01)
-				variable_header[vh_length++] = 0x01;
-				variable_header[vh_length++] = 1;
-			}
-			payload_length = mqtt_serialize(inst, data->channel + c[u]->ident, (char*) payload, sizeof(payload), v[u].normalised);
+			//the server already acknowledged reception before losing the session
+			mqtt_inflight_release(data, slot);
 		}
+	}
 
-		if(payload_length){
-			DBGPF("Transmitting %" PRIsize_t " bytes for %s", payload_length, inst->name);
-			mqtt_transmit(inst, MSG_PUBLISH, vh_length, variable_header, payload_length, payload);
-		}
-		else if(alias_assigned){
-			//undo alias assignment
-			data->channel[c[u]->ident].topic_alias_sent = 0;
-			data->current_alias--;
+	LOGPF("Retransmitting %" PRIsize_t " unacknowledged messages on %s", n, inst->name);
+	free(order);
+	return 0;
+}
+
+static int mqtt_set(instance* inst, size_t num, channel** c, channel_value* v){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	mqtt_channel_data* chan = NULL;
+	uint64_t now = mm_timestamp();
+	size_t u;
+
+	for(u = 0; u < num; u++){
+		chan = data->channel + c[u]->ident;
+
+		//within the coalescing window or while the in-flight window is full, only the last value is published
+		if(chan->pending
+				|| (data->coalesce && now - chan->last_publish < data->coalesce)
+				|| mqtt_send_value(inst, c[u]->ident, v[u].normalised) == 2){
+			if(mqtt_defer(inst, c[u]->ident, v[u].normalised)){
+				return 1;
+			}
 		}
 	}
 
+	//write all publishes from this cycle with one call
+	mqtt_flush(inst);
 	return 0;
 }
 
+//publish all coalesced values whose window has closed
+static int mqtt_coalesce(){
+	size_t n, u;
+	instance** inst = NULL;
+
+	if(mm_backend_instances(BACKEND_NAME, &n, &inst)){
+		LOG("Failed to fetch instance list");
+		return 1;
+	}
+
+	coalesce_due = 0;
+	for(u = 0; u < n; u++){
+		mqtt_release(inst[u]);
+		mqtt_flush(inst[u]);
+	}
+
+	free(inst);
+	return 0;
+}
+
+static void mqtt_topic_deliver(instance* inst, size_t index, char* payload, size_t payload_length){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	channel* changed = mm_channel(inst, index, 0);
+
+	if(changed){
+		mqtt_deserialize(inst, changed, data->channel + index, payload, payload_length);
+	}
+}
+
+//dispatch a publish to all channels matching the remaining topic below node, level by level
+static void mqtt_topic_match(instance* inst, mqtt_topic_node* node, char* topic, size_t length, uint8_t consumed, char* payload, size_t payload_length){
+	char* end = NULL;
+	size_t level_length, index;
+	//wildcards in the first level do not match topics starting with '$'
+	uint8_t wildcards = (node != &(((mqtt_instance_data*) inst->impl)->topics)) || !length || topic[0] != '$', found;
+
+	if(node->multilevel && wildcards){
+		mqtt_topic_deliver(inst, node->multilevel - 1, payload, payload_length);
+	}
+
+	if(consumed){
+		if(node->channel){
+			mqtt_topic_deliver(inst, node->channel - 1, payload, payload_length);
+		}
+		return;
+	}
+
+	end = memchr(topic, '/', length);
+	level_length = end ? (end - topic) : length;
+
+	index = mqtt_topic_find(node, topic, level_length, &found);
+	if(found){
+		mqtt_topic_match(inst, node->child[index], end ? end + 1 : topic + length, end ? length - level_length - 1 : 0, end ? 0 : 1, payload, payload_length);
+	}
+
+	if(node->single_level && wildcards){
+		mqtt_topic_match(inst, node->single_level, end ? end + 1 : topic + length, end ? length - level_length - 1 : 0, end ? 0 : 1, payload, payload_length);
+	}
+}
+
 static int mqtt_handle_publish(instance* inst, uint8_t type, uint8_t* variable_header, size_t length){
 	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
 	char* topic = NULL, *payload = NULL;
-	channel* changed = NULL;
 	uint8_t qos = (type & 0x06) >> 1, content_utf8 = 0;
-	uint16_t topic_alias = 0;
+	uint16_t topic_alias = 0, packet_id = 0;
+	uint8_t ack[2];
 	uint32_t property_length = 0;
-	size_t u = data->nchannels, property_offset, payload_offset, payload_length;
+	size_t property_offset, payload_offset, payload_length;
 	size_t topic_length = min(mqtt_pop_utf8(variable_header, length, &topic), length);
 
 	property_offset = payload_offset = topic_length + 2 + ((qos > 0) ? 2 : 0);
+	if(qos && length >= topic_length + 4){
+		packet_id = (variable_header[topic_length + 2] << 8) | variable_header[topic_length + 3];
+	}
+	ack[0] = (packet_id >> 8) & 0xFF;
+	ack[1] = packet_id & 0xFF;
 	if(data->mqtt_version == 0x05){
 		//read properties length
 		payload_offset += mqtt_pop_varint(variable_header + property_offset, length - property_offset, &property_length);
@@ -790,25 +1287,20 @@ static int mqtt_handle_publish(instance* inst, uint8_t type, uint8_t* variable_h
 		}
 	}
 
-	//match via topic alias
-	if(!topic_length && topic_alias){
-		for(u = 0; u < data->nchannels; u++){
-			if(data->channel[u].topic_alias_rcvd == topic_alias){
-				break;
-			}
-		}
+	if(topic_alias > MQTT_TOPIC_ALIAS_MAX){
+		LOGPF("Server sent invalid topic alias %" PRIu16 " on %s", topic_alias, inst->name);
+		return 0;
 	}
-	//match via topic
-	else if(topic_length){
-		for(u = 0; u < data->nchannels; u++){
-			if(!strncmp(data->channel[u].topic, topic, topic_length)){
-				break;
-			}
-		}
 
-		if(topic_alias){
-			data->channel[u].topic_alias_rcvd = topic_alias;
-		}
+	//resolve topic alias
+	if(!topic_length && topic_alias){
+		topic = data->topic_alias[topic_alias];
+		topic_length = topic ? strlen(topic) : 0;
+	}
+	//register topic alias
+	else if(topic_length && topic_alias){
+		free(data->topic_alias[topic_alias]);
+		data->topic_alias[topic_alias] = strndup(topic, topic_length);
 	}
 
 	if(content_utf8){
@@ -819,19 +1311,88 @@ static int mqtt_handle_publish(instance* inst, uint8_t type, uint8_t* variable_h
 		payload = (char*) (variable_header + payload_offset);
 	}
 
-	if(u != data->nchannels && payload_length && payload){
-		DBGPF("Received PUBLISH for %s.%s, QoS %d, payload length %" PRIsize_t, inst->name, data->channel[u].topic, qos, payload_length);
-		changed = mm_channel(inst, u, 0);
-		if(changed){
-			mqtt_deserialize(inst, changed, data->channel + u, payload, payload_length);
+	if(qos == 2){
+		//a retransmission of a message not yet released by PUBREL has already been delivered
+		if(data->received[packet_id / 8] & (1 << (packet_id % 8))){
+			DBGPF("Ignoring duplicate QoS 2 PUBLISH %" PRIu16 " on %s", packet_id, inst->name);
+			return mqtt_queue(inst, MSG_PUBREC, 2, ack, 0, NULL);
 		}
+		data->received[packet_id / 8] |= (1 << (packet_id % 8));
+	}
+
+	if(topic_length && payload_length && payload){
+		DBGPF("Received PUBLISH for %s.%.*s, QoS %d, payload length %" PRIsize_t, inst->name, (int) topic_length, topic, qos, payload_length);
+		mqtt_topic_match(inst, &data->topics, topic, topic_length, 0, payload, payload_length);
+	}
+
+	//acknowledgements are sent with the next flush
+	if(qos){
+		return mqtt_queue(inst, (qos == 1) ? MSG_PUBACK : MSG_PUBREC, 2, ack, 0, NULL);
 	}
 	return 0;
 }
 
+static int mqtt_handle_ack(instance* inst, uint8_t type, uint8_t* variable_header, size_t length){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	uint16_t packet_id;
+	uint8_t reason;
+	mqtt_inflight* slot = NULL;
+
+	if(length < 2){
+		LOGPF("Received malformed acknowledgement on %s", inst->name);
+		return 1;
+	}
+
+	packet_id = (variable_header[0] << 8) | variable_header[1];
+	//the reason code is only present in MQTT v5 and may be omitted on success
+	reason = (length > 2) ? variable_header[2] : 0;
+
+	if(!packet_id || packet_id > data->inflight_max || !data->inflight
+			|| data->inflight[packet_id - 1].state == INFLIGHT_FREE){
+		LOGPF("Received acknowledgement for unknown packet %" PRIu16 " on %s", packet_id, inst->name);
+		return 0;
+	}
+	slot = data->inflight + packet_id - 1;
+
+	if(reason >= 0x80){
+		LOGPF("Server rejected publish to %s.%s, reason code %d", inst->name, data->channel[slot->channel].topic, reason);
+		mqtt_inflight_release(data, packet_id - 1);
+	}
+	else if(type == MSG_PUBACK && slot->state == INFLIGHT_PUBLISH){
+		mqtt_inflight_release(data, packet_id - 1);
+	}
+	else if(type == MSG_PUBREC){
+		//the message is stored by the server, release it for delivery
+		slot->state = INFLIGHT_PUBREL;
+		return mqtt_queue(inst, MSG_PUBREL, 2, variable_header, 0, NULL);
+	}
+	else if(type == MSG_PUBCOMP && slot->state == INFLIGHT_PUBREL){
+		mqtt_inflight_release(data, packet_id - 1);
+	}
+
+	//publish values that were held back by the in-flight window
+	mqtt_release(inst);
+	return 0;
+}
+
+static int mqtt_handle_pubrel(instance* inst, uint8_t type, uint8_t* variable_header, size_t length){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	uint16_t packet_id;
+
+	if(length < 2){
+		LOGPF("Received malformed PUBREL on %s", inst->name);
+		return 1;
+	}
+
+	packet_id = (variable_header[0] << 8) | variable_header[1];
+	data->received[packet_id / 8] &= ~(1 << (packet_id % 8));
+	return mqtt_queue(inst, MSG_PUBCOMP, 2, variable_header, 0, NULL);
+}
+
 static int mqtt_handle_connack(instance* inst, uint8_t type, uint8_t* variable_header, size_t length){
 	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
 	size_t property_offset = 2;
+	uint8_t session_present = 0;
 
 	if(length >= 2){
 		if(variable_header[1]){
@@ -856,13 +1417,36 @@ static int mqtt_handle_connack(instance* inst, uint8_t type, uint8_t* variable_h
 					data->server_max_alias = (variable_header[property_offset + 1] << 8) | variable_header[property_offset + 2];
 					DBGPF("Connection supports maximum connection alias %" PRIu16, data->server_max_alias);
 				}
+				//read receive maximum
+				else if(variable_header[property_offset] == 0x21){
+					data->server_receive_max = (variable_header[property_offset + 1] << 8) | variable_header[property_offset + 2];
+					DBGPF("Connection supports %" PRIu16 " messages in flight", data->server_receive_max);
+				}
 
 				property_offset += mqtt_pop_property(variable_header + property_offset, length - property_offset);
 			}
 		}
 
-		LOGPF("Connection on %s established", inst->name);
-		return mqtt_push_subscriptions(inst);
+		session_present = data->persistent && (variable_header[0] & 0x01);
+		LOGPF("Connection on %s established%s", inst->name, session_present ? ", resuming session" : "");
+		data->connected = 1;
+
+		if(!session_present){
+			//the server does not know about any in-progress inbound messages
+			memset(data->received, 0, sizeof(data->received));
+		}
+
+		if(mqtt_resend(inst, session_present)){
+			return 1;
+		}
+
+		//subscriptions are part of the stored session state
+		if(!session_present && mqtt_push_subscriptions(inst)){
+			return 1;
+		}
+
+		mqtt_release(inst);
+		return 0;
 	}
 
 	LOGPF("Received malformed CONNACK on %s", inst->name);
@@ -873,6 +1457,12 @@ static int mqtt_handle_message(instance* inst, uint8_t type, uint8_t* variable_h
 	switch(type){
 		case MSG_CONNACK:
 			return mqtt_handle_connack(inst, type, variable_header, length);
+		case MSG_PUBACK:
+		case MSG_PUBREC:
+		case MSG_PUBCOMP:
+			return mqtt_handle_ack(inst, type, variable_header, length);
+		case MSG_PUBREL:
+			return mqtt_handle_pubrel(inst, type, variable_header, length);
 		case MSG_PINGRESP:
 		case MSG_SUBACK:
 			//ignore most responses
@@ -927,19 +1517,63 @@ static int mqtt_handle_fd(instance* inst){
 		}
 	}
 
+	//send acknowledgements and released messages
+	mqtt_flush(inst);
+	return 0;
+}
+
+static int mqtt_connected(instance* inst){
+	mqtt_instance_data* data = (mqtt_instance_data*) inst->impl;
+	int error = mmbackend_socket_connected(data->fd);
+
+	if(error){
+		LOGPF("Failed to connect instance %s: %s, will be retried", inst->name, mmbackend_socket_strerror(error));
+		mqtt_disconnect(inst);
+		return 1;
+	}
+
+	data->connecting = 0;
+	mm_manage_fd(data->fd, BACKEND_NAME, mmfd_read, (void*) inst);
+	DBGPF("Instance %s connected, sending CONNECT", inst->name);
+	//send the held CONNECT message
+	mqtt_flush(inst);
 	return 0;
 }
 
 static int mqtt_handle(size_t num, managed_fd* fds){
 	size_t n = 0;
 
+	instance* inst = NULL;
+	mqtt_instance_data* data = NULL;
+
 	for(n = 0; n < num; n++){
-		if(mqtt_handle_fd((instance*) fds[n].impl) >= 2){
+		inst = (instance*) fds[n].impl;
+		data = (mqtt_instance_data*) inst->impl;
+
+		if(data->connecting){
+			//the descriptor becomes writable once the connection attempt completes
+			if(!(fds[n].ready & mmfd_write) || mqtt_connected(inst)){
+				continue;
+			}
+		}
+		else if(fds[n].ready & mmfd_write){
+			if(mmbackend_queue_flush(&(data->queue))){
+				LOGPF("Failed to transmit data for %s, assuming connection failure", inst->name);
+				mqtt_disconnect(inst);
+				continue;
+			}
+		}
+
+		if((fds[n].ready & mmfd_read) && mqtt_handle_fd(inst) >= 2){
 			//propagate critical failures
 			return 1;
 		}
 	}
 
+	if(coalesce_due && mm_timestamp() >= coalesce_due && mqtt_coalesce()){
+		return 1;
+	}
+
 	//keepalive/reconnect processing
 	if(last_maintenance && mm_timestamp() - last_maintenance >= MQTT_KEEPALIVE * 1000){
 		if(mqtt_maintenance()){
@@ -954,7 +1588,34 @@ static int mqtt_handle(size_t num, managed_fd* fds){
 static int mqtt_start(size_t n, instance** inst){
 	size_t u = 0, fds = 0;
 
+	mqtt_instance_data* data = NULL;
+	size_t slot;
+
 	for(u = 0; u < n; u++){
+		data = (mqtt_instance_data*) inst[u]->impl;
+		if(data->qos){
+			//set up the in-flight window, slot n carries packet identifier n + 1
+			data->inflight = calloc(data->inflight_max, sizeof(mqtt_inflight));
+			data->inflight_free = calloc(data->inflight_max, sizeof(uint16_t));
+			if(!data->inflight || !data->inflight_free){
+				LOG("Failed to allocate memory");
+				return 1;
+			}
+
+			for(slot = 0; slot < data->inflight_max; slot++){
+				data->inflight_free[slot] = data->inflight_max - slot - 1;
+			}
+			data->inflight_free_count = data->inflight_max;
+		}
+
+		//resolve the broker address once instead of on every reconnect
+		if(data->host && mmbackend_parse_sockaddr(data->host,
+					data->port ? data->port : (data->tls ? MQTT_TLS_PORT : MQTT_PORT),
+					&(data->addr), &(data->addr_len))){
+			LOGPF("Failed to resolve host for instance %s", inst[u]->name);
+			return 1;
+		}
+
 		switch(mqtt_reconnect(inst[u])){
 			case 1:
 				LOGPF("Failed to connect to host for instance %s, will be retried", inst[u]->name);
@@ -990,6 +1651,12 @@ static int mqtt_shutdown(size_t n, instance** inst){
 			free(data->channel[p].topic);
 		}
 		free(data->channel);
+		free(data->pending);
+		free(data->xmit);
+		mmbackend_queue_free(&(data->queue));
+		free(data->inflight);
+		free(data->inflight_free);
+		mqtt_topic_free(&data->topics);
 		free(data->host);
 		free(data->port);
 		free(data->user);
@@ -7,6 +7,7 @@ static int mqtt_instance(instance* inst);
 static channel* mqtt_channel(instance* inst, char* spec, uint8_t flags);
 static int mqtt_set(instance* inst, size_t num, channel** c, channel_value* v);
 static int mqtt_handle(size_t num, managed_fd* fds);
+static uint32_t mqtt_interval();
 static int mqtt_start(size_t n, instance** inst);
 static int mqtt_shutdown(size_t n, instance** inst);
 
@@ -15,6 +16,15 @@ static int mqtt_shutdown(size_t n, instance** inst);
 #define MQTT_BUFFER_LENGTH 8192
 #define MQTT_KEEPALIVE 10 
 #define MQTT_VERSION_DEFAULT 0x05
+//maximum number of topic aliases accepted from the server
+#define MQTT_TOPIC_ALIAS_MAX 1024
+//maximum amount of data queued for a slow broker before the connection is reset
+#define MQTT_XMIT_LIMIT (4 * 1024 * 1024)
+//in-flight window for QoS 1/2 publishes, packet identifiers above the maximum are used for subscriptions
+#define MQTT_INFLIGHT_DEFAULT 16
+#define MQTT_INFLIGHT_MAX 1024
+//session expiry interval requested for persistent sessions in seconds
+#define MQTT_SESSION_EXPIRY 86400
 
 #define MQTT5_NO_LOCAL 0x04
 
@@ -34,7 +44,7 @@ enum {
 	MSG_PUBLISH = 0x30,
 	MSG_PUBACK = 0x40,
 	MSG_PUBREC = 0x50,
-	MSG_PUBREL = 0x60,
+	MSG_PUBREL = 0x62,
 	MSG_PUBCOMP = 0x70,
 	MSG_SUBSCRIBE = 0x82,
 	MSG_SUBACK = 0x90,
@@ -46,6 +56,22 @@ enum {
 	MSG_AUTH = 0xF0
 };
 
+enum /*_mqtt_inflight_state*/ {
+	INFLIGHT_FREE = 0,
+	//waiting for PUBACK or PUBREC
+	INFLIGHT_PUBLISH,
+	//waiting for PUBCOMP
+	INFLIGHT_PUBREL
+};
+
+typedef struct /*_mqtt_inflight*/ {
+	uint8_t state;
+	uint8_t transmitted;
+	uint64_t sequence;
+	size_t channel;
+	double value;
+} mqtt_inflight;
+
 typedef struct /*_mqtt_value_mapping*/ {
 	double min;
 	double max;
@@ -56,18 +82,35 @@ typedef struct /*_mqtt_value_mapping*/ {
 typedef struct /*_mqtt_channel*/ {
 	char* topic;
 	uint16_t topic_alias_sent;
-	uint16_t topic_alias_rcvd;
 	uint8_t flags;
 
+	//output coalescing
+	uint64_t last_publish;
+	uint8_t pending;
+	double pending_value;
+
 	size_t values;
 	mqtt_channel_value* value;
 } mqtt_channel_data;
 
+typedef struct _mqtt_topic_node {
+	char* level;
+	//channel offset + 1 for the topic ending at this level, respectively for a '#' subscription at this level
+	size_t channel;
+	size_t multilevel;
+	//literal children are sorted by level for binary search
+	size_t children;
+	struct _mqtt_topic_node** child;
+	struct _mqtt_topic_node* single_level;
+} mqtt_topic_node;
+
 typedef struct /*_mqtt_instance_data*/ {
 	uint8_t tls;
 	char* host;
 	char* port;
 	uint8_t mqtt_version;
+	uint8_t qos;
+	uint8_t persistent;
 
 	char* user;
 	char* password;
@@ -75,8 +118,21 @@ typedef struct /*_mqtt_instance_data*/ {
 
 	size_t nchannels;
 	mqtt_channel_data* channel;
+	mqtt_topic_node topics;
+	//topics for aliases assigned by the server
+	char* topic_alias[MQTT_TOPIC_ALIAS_MAX + 1];
+
+	//broker address, resolved once on startup
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
 
 	int fd;
+	uint8_t connecting;
+	uint8_t connected;
+	uint8_t* xmit;
+	size_t xmit_len;
+	size_t xmit_alloc;
+	mmbackend_queue queue;
 	uint8_t receive_buffer[MQTT_BUFFER_LENGTH];
 	size_t receive_offset;
 
@@ -84,4 +140,19 @@ typedef struct /*_mqtt_instance_data*/ {
 	uint16_t packet_identifier;
 	uint16_t server_max_alias;
 	uint16_t current_alias;
+	uint16_t server_receive_max;
+
+	//unacknowledged outbound QoS 1/2 publishes
+	size_t inflight_max;
+	mqtt_inflight* inflight;
+	uint16_t* inflight_free;
+	size_t inflight_free_count;
+	uint64_t inflight_sequence;
+	//inbound QoS 2 packet identifiers awaiting PUBREL
+	uint8_t received[65536 / 8];
+
+	//publish coalescing window in milliseconds and channels waiting for it to close
+	uint32_t coalesce;
+	size_t npending;
+	size_t* pending;
 } mqtt_instance_data;
@@ -232,9 +232,21 @@ static int openpixel_output_data(openpixel_instance_data* data){
 			hdr.mode = data->mode;
 			hdr.length = htobe16(data->buffer[u].bytes);
 
-			//output data
-			if(mmbackend_send(data->dest_fd, (uint8_t*) &hdr, sizeof(hdr))
-					|| mmbackend_send(data->dest_fd, data->buffer[u].data.u8, data->buffer[u].bytes)){
+			//assemble the frame so it is queued as a whole
+			if(sizeof(hdr) + data->buffer[u].bytes > data->xmit_alloc){
+				data->xmit = realloc(data->xmit, sizeof(hdr) + data->buffer[u].bytes);
+				if(!data->xmit){
+					data->xmit_alloc = 0;
+					LOG("Failed to allocate memory");
+					return 1;
+				}
+				data->xmit_alloc = sizeof(hdr) + data->buffer[u].bytes;
+			}
+			memcpy(data->xmit, &hdr, sizeof(hdr));
+			memcpy(data->xmit + sizeof(hdr), data->buffer[u].data.u8, data->buffer[u].bytes);
+
+			//output data, a queued frame for the same strip is replaced with the current one
+			if(mmbackend_queue_send(&(data->queue), data->xmit, sizeof(hdr) + data->buffer[u].bytes, data->buffer[u].strip + 1) == 1){
 				return 1;
 			}
 		}
@@ -589,6 +601,16 @@ static int openpixel_handle(size_t num, managed_fd* fds){
 		data = (openpixel_instance_data*) inst->impl;
 
 		if(fds[u].fd == data->dest_fd){
+			//destination fd ready to write, continue sending queued frames
+			if((fds[u].ready & mmfd_write) && mmbackend_queue_flush(&(data->queue))){
+				LOGPF("Failed to send data on instance %s", inst->name);
+				return 1;
+			}
+
+			if(!(fds[u].ready & mmfd_read)){
+				continue;
+			}
+
 			//destination fd ready to read
 			//since the protocol does not define any responses, the connection was probably closed
 			bytes = recv(data->dest_fd, buffer, sizeof(buffer), 0);
@@ -631,6 +653,7 @@ static int openpixel_start(size_t n, instance** inst){
 				LOGPF("Failed to register destination descriptor for instance %s with core", inst[u]->name);
 				goto bail;
 			}
+			mmbackend_queue_init(&(data->queue), data->dest_fd, BACKEND_NAME, inst[u], OPENPIXEL_XMIT_LIMIT, mmbackend_queue_drop);
 			nfds++;
 		}
 		if(data->listen_fd >= 0){
@@ -670,6 +693,8 @@ static int openpixel_shutdown(size_t n, instance** inst){
 		if(data->dest_fd >= 0){
 			close(data->dest_fd);
 		}
+		mmbackend_queue_free(&(data->queue));
+		free(data->xmit);
 
 		//free all buffers
 		for(p = 0; p < data->buffers; p++){
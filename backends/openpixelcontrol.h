@@ -12,6 +12,8 @@ static int openpixel_shutdown(size_t n, instance** inst);
 
 #define OPENPIXEL_INPUT 1
 #define OPENPIXEL_MARK 2
+//maximum amount of frame data queued for a slow server, further frames are dropped
+#define OPENPIXEL_XMIT_LIMIT (1024 * 1024)
 
 typedef struct /*_data_buffer*/ {
 	uint8_t strip;
@@ -53,6 +55,9 @@ typedef struct {
 	openpixel_buffer* buffer;
 
 	int dest_fd;
+	mmbackend_queue queue;
+	uint8_t* xmit;
+	size_t xmit_alloc;
 	int listen_fd;
 	size_t clients;
 	openpixel_client* client;
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <sys/time.h>
 
 #include "libmmbackend.h"
 #include "osc.h"
@@ -11,15 +12,29 @@
 /*
  * TODO
  * ping method
- * bundle output
  */
 
 #define osc_align(a) ((((a) / 4) + (((a) % 4) ? 1 : 0)) * 4)
 
 static struct {
 	uint8_t detect;
+
+	//min-heap of bundles with future timetags, ordered by due time and arrival
+	size_t scheduled;
+	size_t schedule_alloc;
+	osc_scheduled_bundle* schedule;
+	uint64_t sequence;
+	//limits for holding bundles, as any sender may schedule them
+	uint64_t horizon;
+	size_t schedule_limit;
 } osc_global_config = {
-	.detect = 0
+	.detect = 0,
+	.scheduled = 0,
+	.schedule_alloc = 0,
+	.schedule = NULL,
+	.sequence = 0,
+	.horizon = OSC_SCHEDULE_HORIZON,
+	.schedule_limit = OSC_SCHEDULE_LIMIT
 };
 
 MM_PLUGIN_API int init(){
@@ -31,6 +46,7 @@ MM_PLUGIN_API int init(){
 		.channel = osc_map_channel,
 		.handle = osc_set,
 		.process = osc_handle,
+		.interval = osc_interval,
 		.start = osc_start,
 		.shutdown = osc_shutdown
 	};
@@ -48,6 +64,36 @@ MM_PLUGIN_API int init(){
 	return 0;
 }
 
+static uint32_t osc_interval(){
+	uint64_t now = mm_timestamp();
+
+	//wake up when the next scheduled bundle is due
+	if(osc_global_config.scheduled){
+		if(osc_global_config.schedule[0].due <= now){
+			return 1;
+		}
+		return min(osc_global_config.schedule[0].due - now, UINT32_MAX);
+	}
+	return 0;
+}
+
+static uint64_t osc_timetag_now(){
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return ((((uint64_t) now.tv_sec) + OSC_NTP_EPOCH_OFFSET) << 32)
+		| ((((uint64_t) now.tv_usec) << 32) / 1000000);
+}
+
+//signed difference between two timetags in milliseconds
+static int64_t osc_timetag_diff(uint64_t a, uint64_t b){
+	int64_t diff = (int64_t) (a - b);
+	return (diff / (((int64_t) 1) << 32)) * 1000 + ((diff % (((int64_t) 1) << 32)) * 1000) / (((int64_t) 1) << 32);
+}
+
+static uint64_t osc_timetag_offset(uint64_t tag, int64_t offset_ms){
+	return tag + (offset_ms * (((int64_t) 1) << 32)) / 1000;
+}
+
 static size_t osc_data_length(osc_parameter_type t){
 	//binary representation lengths for osc data types
 	switch(t){
@@ -241,7 +287,8 @@ static int osc_path_validate(char* path, uint8_t allow_patterns){
 
 	for(u = 0; u < strlen(path); u++){
 		for(c = 0; c < sizeof(illegal_chars); c++){
-			if(path[u] == illegal_chars[c]){
+			//commas separate alternatives within curly braces
+			if(path[u] == illegal_chars[c] && !(path[u] == ',' && curly_open)){
 				LOGPF("%s is not a valid OSC path: Illegal '%c' at %" PRIsize_t, path, illegal_chars[c], u);
 				return 1;
 			}
@@ -297,122 +344,282 @@ static int osc_path_validate(char* path, uint8_t allow_patterns){
 	return 0;
 }
 
-static int osc_path_match(char* pattern, char* path){
-	size_t u, p = 0, match_begin, match_end;
-	uint8_t match_any = 0, inverted, match;
+static int osc_pattern_tokenize(osc_pattern_node* node){
+	char* part = node->part;
+	size_t u = 0, end;
+	uint8_t inverted, c;
+	osc_pattern_token* token = NULL;
 
-	for(u = 0; u < strlen(path); u++){
-		switch(pattern[p]){
-			case '/':
-				if(match_any){
-					for(; path[u] && path[u] != '/'; u++){
-					}
-				}
-				if(path[u] != '/'){
-					return 0;
-				}
-				match_any = 0;
-				p++;
-				break;
+	while(part[u]){
+		node->token = realloc(node->token, (node->tokens + 1) * sizeof(osc_pattern_token));
+		if(!node->token){
+			node->tokens = 0;
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		token = node->token + node->tokens;
+		memset(token, 0, sizeof(osc_pattern_token));
+		node->tokens++;
+
+		switch(part[u]){
 			case '?':
-				match_any = 0;
-				p++;
+				token->type = pattern_any;
+				u++;
 				break;
 			case '*':
-				match_any = 1;
-				p++;
+				token->type = pattern_wildcard;
+				//consecutive wildcards are equivalent to one
+				for(; part[u] == '*'; u++){
+				}
 				break;
 			case '[':
-				inverted = (pattern[p + 1] == '!') ? 1 : 0;
-				match_end = match_begin = inverted ? p + 2 : p + 1;
-				match = 0;
-				for(; pattern[match_end] != ']'; match_end++){
-					if(pattern[match_end] == path[u]){
-						match = 1;
-						break;
-					}
-
-					if(pattern[match_end + 1] == '-' && pattern[match_end + 2] != ']'){
-						if((pattern[match_end] > pattern[match_end + 2]
-									&& path[u] >= pattern[match_end + 2]
-									&& path[u] <= pattern[match_end])
-								|| (pattern[match_end] <= pattern[match_end + 2]
-									&& path[u] >= pattern[match_end]
-									&& path[u] <= pattern[match_end + 2])){
-							match = 1;
-							break;
+				token->type = pattern_set;
+				inverted = (part[u + 1] == '!') ? 1 : 0;
+				for(end = u + 1 + inverted; part[end] != ']'; end++){
+					if(part[end + 1] == '-' && part[end + 2] != ']'){
+						//ranges may be given in either direction
+						for(c = min(part[end], part[end + 2]); c <= max(part[end], part[end + 2]); c++){
+							token->set[c / 8] |= 1 << (c % 8);
+							if(c == 0xFF){
+								break;
+							}
 						}
-						match_end += 2;
+						end += 2;
+						continue;
 					}
+					token->set[((uint8_t) part[end]) / 8] |= 1 << (((uint8_t) part[end]) % 8);
+				}
 
-					if(pattern[match_end + 1] == ']' && match_any && !match
-							&& path[u + 1] && path[u + 1] != '/'){
-						match_end = match_begin - 1;
-						u++;
+				if(inverted){
+					for(c = 0; c < sizeof(token->set); c++){
+						token->set[c] = ~token->set[c];
 					}
 				}
-
-				if(match == inverted){
-					return 0;
+				u = end + 1;
+				break;
+			case '{':
+				token->type = pattern_alternatives;
+				for(end = u + 1; part[end] != '}'; end++){
 				}
-
-				match_any = 0;
-				//advance to end of pattern
-				for(; pattern[p] != ']'; p++){
+				token->text = part + u + 1;
+				token->length = end - u - 1;
+				u = end + 1;
+				break;
+			default:
+				token->type = pattern_literal;
+				for(end = u; part[end] && !strchr("?*[{", part[end]); end++){
 				}
-				p++;
+				token->text = part + u;
+				token->length = end - u;
+				u = end;
 				break;
-			case '{':
-				for(match_begin = p + 1; pattern[match_begin] != '}'; match_begin++){
-					//find end
-					for(match_end = match_begin; pattern[match_end] != ',' && pattern[match_end] != '}'; match_end++){
-					}
+		}
+	}
+	return 0;
+}
 
-					if(!strncmp(path + u, pattern + match_begin, match_end - match_begin)){
-						//advance pattern
-						for(; pattern[p] != '}'; p++){
-						}
-						p++;
-						//advance path
-						u += match_end - match_begin - 1;
-						break;
-					}
+//match one part of a path against the compiled tokens, backtracking for wildcards and alternatives
+static int osc_pattern_part_match(osc_pattern_token* token, size_t tokens, char* part, size_t length){
+	size_t u, alt_begin, alt_end;
 
-					if(pattern[match_end] == '}'){
-						//retry with next if in match_any
-						if(match_any && path[u + 1] && path[u + 1] != '/'){
-							u++;
-							match_begin = p;
-							continue;
-						}
-						return 0;
-					}
-					match_begin = match_end;
+	if(!tokens){
+		return length == 0;
+	}
+
+	switch(token->type){
+		case pattern_literal:
+			return length >= token->length
+				&& !memcmp(part, token->text, token->length)
+				&& osc_pattern_part_match(token + 1, tokens - 1, part + token->length, length - token->length);
+		case pattern_any:
+			return length
+				&& osc_pattern_part_match(token + 1, tokens - 1, part + 1, length - 1);
+		case pattern_set:
+			return length
+				&& (token->set[((uint8_t) *part) / 8] & (1 << (((uint8_t) *part) % 8)))
+				&& osc_pattern_part_match(token + 1, tokens - 1, part + 1, length - 1);
+		case pattern_wildcard:
+			for(u = 0; u <= length; u++){
+				if(osc_pattern_part_match(token + 1, tokens - 1, part + u, length - u)){
+					return 1;
 				}
-				match_any = 0;
-				break;
-			case 0:
-				if(match_any){
-					for(; path[u] && path[u] != '/'; u++){
-					}
+			}
+			return 0;
+		case pattern_alternatives:
+			for(alt_begin = 0; alt_begin <= token->length; alt_begin = alt_end + 1){
+				for(alt_end = alt_begin; alt_end < token->length && token->text[alt_end] != ','; alt_end++){
 				}
-				if(path[u]){
-					return 0;
+
+				if(length >= alt_end - alt_begin
+						&& !memcmp(part, token->text + alt_begin, alt_end - alt_begin)
+						&& osc_pattern_part_match(token + 1, tokens - 1, part + (alt_end - alt_begin), length - (alt_end - alt_begin))){
+					return 1;
 				}
+			}
+			return 0;
+	}
+	return 0;
+}
+
+static int osc_pattern_compile(osc_instance_data* data, size_t pattern){
+	char* path = data->pattern[pattern].path + 1, *end = NULL;
+	size_t u, length;
+	osc_pattern_node* node = &data->pattern_root;
+	osc_pattern_node* next = NULL;
+
+	//walk the tree one path part at a time, sharing nodes with identical parts
+	do{
+		end = strchr(path, '/');
+		length = end ? (end - path) : strlen(path);
+
+		for(u = 0; u < node->children; u++){
+			if(strlen(node->child[u]->part) == length && !strncmp(node->child[u]->part, path, length)){
 				break;
-			default:
-				if(match_any){
-					for(; path[u] && path[u] != '/' && path[u] != pattern[p]; u++){
+			}
+		}
+
+		if(u == node->children){
+			node->child = realloc(node->child, (node->children + 1) * sizeof(osc_pattern_node*));
+			next = calloc(1, sizeof(osc_pattern_node));
+			if(!node->child || !next){
+				free(next);
+				node->children = 0;
+				LOG("Failed to allocate memory");
+				return 1;
+			}
+			node->child[node->children] = next;
+			node->children++;
+
+			next->part = strndup(path, length);
+			if(!next->part){
+				LOG("Failed to allocate memory");
+				return 1;
+			}
+
+			//purely literal parts are compared directly
+			if(strpbrk(next->part, "?*[{") && osc_pattern_tokenize(next)){
+				return 1;
+			}
+		}
+
+		node = node->child[u];
+		path = end ? end + 1 : NULL;
+	} while(path);
+
+	node->match = realloc(node->match, (node->matches + 1) * sizeof(size_t));
+	if(!node->match){
+		node->matches = 0;
+		LOG("Failed to allocate memory");
+		return 1;
+	}
+	node->match[node->matches] = pattern;
+	node->matches++;
+	return 0;
+}
+
+//returns the first configured pattern matching the path or data->patterns if none does
+static size_t osc_pattern_match(osc_instance_data* data, char* path){
+	size_t active = 1, next = 0, n, u, length, rv = data->patterns;
+	osc_pattern_node** frontier = calloc(data->patterns + 1, sizeof(osc_pattern_node*));
+	osc_pattern_node** candidates = calloc(data->patterns + 1, sizeof(osc_pattern_node*));
+	osc_pattern_node** swap = NULL;
+	char* part = path + 1, *end = NULL;
+
+	if(!frontier || !candidates){
+		LOG("Failed to allocate memory");
+		goto bail;
+	}
+
+	//every pattern occupies at most one node per level, bounding the frontier size
+	frontier[0] = &data->pattern_root;
+	do{
+		end = strchr(part, '/');
+		length = end ? (end - part) : strlen(part);
+
+		next = 0;
+		for(n = 0; n < active; n++){
+			for(u = 0; u < frontier[n]->children; u++){
+				if(frontier[n]->child[u]->tokens){
+					if(osc_pattern_part_match(frontier[n]->child[u]->token, frontier[n]->child[u]->tokens, part, length)){
+						candidates[next++] = frontier[n]->child[u];
 					}
 				}
-				if(pattern[p] != path[u]){
-					return 0;
+				else if(strlen(frontier[n]->child[u]->part) == length
+						&& !strncmp(frontier[n]->child[u]->part, part, length)){
+					candidates[next++] = frontier[n]->child[u];
 				}
-				p++;
-				break;
+			}
+		}
+
+		swap = frontier;
+		frontier = candidates;
+		candidates = swap;
+		active = next;
+		part = end ? end + 1 : NULL;
+	} while(part && active);
+
+	//select the pattern configured first
+	for(n = 0; n < active; n++){
+		for(u = 0; u < frontier[n]->matches; u++){
+			rv = min(rv, frontier[n]->match[u]);
 		}
 	}
-	return 1;
+
+bail:
+	free(frontier);
+	free(candidates);
+	return rv;
+}
+
+static void osc_pattern_free(osc_pattern_node* node){
+	size_t u;
+	for(u = 0; u < node->children; u++){
+		osc_pattern_free(node->child[u]);
+		free(node->child[u]);
+	}
+	free(node->child);
+	free(node->token);
+	free(node->match);
+	free(node->part);
+	memset(node, 0, sizeof(osc_pattern_node));
+}
+
+static uint32_t osc_path_hash(char* path){
+	//32 bit fnv-1a
+	uint32_t hash = 2166136261u;
+	for(; *path; path++){
+		hash ^= (uint8_t) *path;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static size_t osc_path_lookup(osc_instance_data* data, char* path){
+	uint32_t hash = osc_path_hash(path);
+	size_t u, bucket = hash % OSC_PATH_BUCKETS;
+
+	for(u = 0; u < data->bucket_size[bucket]; u++){
+		if(data->channel[data->bucket[bucket][u]].hash == hash
+				&& !strcmp(path, data->channel[data->bucket[bucket][u]].path)){
+			return data->bucket[bucket][u];
+		}
+	}
+	return data->channels;
+}
+
+static int osc_path_index(osc_instance_data* data, size_t channel){
+	size_t bucket = data->channel[channel].hash % OSC_PATH_BUCKETS;
+
+	data->bucket[bucket] = realloc(data->bucket[bucket], (data->bucket_size[bucket] + 1) * sizeof(size_t));
+	if(!data->bucket[bucket]){
+		data->bucket_size[bucket] = 0;
+		LOG("Failed to allocate memory");
+		return 1;
+	}
+
+	data->bucket[bucket][data->bucket_size[bucket]] = channel;
+	data->bucket_size[bucket]++;
+	return 0;
 }
 
 static int osc_configure(char* option, char* value){
@@ -423,6 +630,14 @@ static int osc_configure(char* option, char* value){
 		}
 		return 0;
 	}
+	else if(!strcmp(option, "horizon")){
+		osc_global_config.horizon = strtoull(value, NULL, 10);
+		return 0;
+	}
+	else if(!strcmp(option, "schedule-limit")){
+		osc_global_config.schedule_limit = strtoul(value, NULL, 10);
+		return 0;
+	}
 
 	LOGPF("Unknown backend configuration parameter %s", option);
 	return 1;
@@ -494,7 +709,7 @@ static int osc_register_pattern(osc_instance_data* data, char* pattern_path, cha
 	}
 
 	data->patterns++;
-	return 0;
+	return osc_pattern_compile(data, pattern);
 }
 
 static int osc_configure_instance(instance* inst, char* option, char* value){
@@ -525,6 +740,16 @@ static int osc_configure_instance(instance* inst, char* option, char* value){
 			return 1;
 		}
 
+		if(fd_opts && !strcmp(fd_opts, "tcp")){
+			data->fd = mmbackend_socket(host, port, SOCK_STREAM, 1, 0, 1);
+			if(data->fd < 0 || listen(data->fd, SOMAXCONN)){
+				LOGPF("Failed to listen for instance %s", inst->name);
+				return 1;
+			}
+			data->tcp |= OSC_TCP_LISTEN;
+			return 0;
+		}
+
 		//this requests a socket with SO_BROADCAST set, whether this is useful functionality for OSC is up for debate
 		data->fd = mmbackend_socket(host, port, SOCK_DGRAM, 1, 1, 1);
 		if(data->fd < 0){
@@ -544,18 +769,52 @@ static int osc_configure_instance(instance* inst, char* option, char* value){
 			return 0;
 		}
 
-		mmbackend_parse_hostspec(value, &host, &port, NULL);
+		mmbackend_parse_hostspec(value, &host, &port, &fd_opts);
 		if(!host || !port){
 			LOGPF("Invalid destination address for instance %s", inst->name);
 			return 1;
 		}
 
+		//tcp connections are established on start
+		if(fd_opts && !strcmp(fd_opts, "tcp")){
+			data->tcp |= OSC_TCP_CONNECT;
+			if(mmbackend_parse_sockaddr(host, port, &data->tcp_addr, &data->tcp_addr_len)){
+				LOGPF("Failed to parse destination address for instance %s", inst->name);
+				return 1;
+			}
+			return mmbackend_strdup(&data->tcp_host, host) || mmbackend_strdup(&data->tcp_port, port);
+		}
+
 		if(mmbackend_parse_sockaddr(host, port, &data->dest, &data->dest_len)){
 			LOGPF("Failed to parse destination address for instance %s", inst->name);
 			return 1;
 		}
 		return 0;
 	}
+	else if(!strcmp(option, "bundle")){
+		data->bundle = strtoul(value, NULL, 10);
+		return 0;
+	}
+	else if(!strcmp(option, "timetag")){
+		data->timetag = 0;
+		if(strcmp(value, "immediate")){
+			data->timetag = 1;
+			data->timetag_offset = strtoll(value, NULL, 10);
+		}
+		return 0;
+	}
+	else if(!strcmp(option, "tolerance")){
+		data->tolerance = strtoul(value, NULL, 10);
+		return 0;
+	}
+	else if(!strcmp(option, "mtu")){
+		data->mtu = strtoul(value, NULL, 10);
+		if(data->mtu < OSC_BUNDLE_HEADER + 4 || data->mtu > OSC_XMIT_BUF){
+			LOGPF("Invalid MTU %s for instance %s, must be between %d and %d", value, inst->name, OSC_BUNDLE_HEADER + 4, OSC_XMIT_BUF);
+			return 1;
+		}
+		return 0;
+	}
 	else if(*option == '/'){
 		return osc_register_pattern(data, option, value);
 	}
@@ -572,6 +831,7 @@ static int osc_instance(instance* inst){
 	}
 
 	data->fd = -1;
+	data->mtu = OSC_DEFAULT_MTU;
 	inst->impl = data;
 	return 0;
 }
@@ -595,19 +855,11 @@ static channel* osc_map_channel(instance* inst, char* spec, uint8_t flags){
 	}
 
 	//find matching channel
-	for(u = 0; u < data->channels; u++){
-		if(!strcmp(spec, data->channel[u].path)){
-			break;
-		}
-	}
+	u = osc_path_lookup(data, spec);
 
 	//allocate new channel
 	if(u == data->channels){
-		for(p = 0; p < data->patterns; p++){
-			if(osc_path_match(data->pattern[p].path, spec)){
-				break;
-			}
-		}
+		p = osc_pattern_match(data, spec);
 
 		data->channel = realloc(data->channel, (u + 1) * sizeof(osc_channel));
 		if(!data->channel){
@@ -617,6 +869,7 @@ static channel* osc_map_channel(instance* inst, char* spec, uint8_t flags){
 
 		memset(data->channel + u, 0, sizeof(osc_channel));
 		data->channel[u].path = strdup(spec);
+		data->channel[u].hash = osc_path_hash(spec);
 		if(p != data->patterns){
 			LOGPF("Matched pattern %s for %s", data->pattern[p].path, spec);
 			data->channel[u].params = data->pattern[p].params;
@@ -638,6 +891,10 @@ static channel* osc_map_channel(instance* inst, char* spec, uint8_t flags){
 			LOG("Failed to allocate memory");
 			return NULL;
 		}
+
+		if(osc_path_index(data, u)){
+			return NULL;
+		}
 		data->channels++;
 	}
 
@@ -645,63 +902,287 @@ static channel* osc_map_channel(instance* inst, char* spec, uint8_t flags){
 	return mm_channel(inst, ident.label, 1);
 }
 
-static int osc_output_channel(instance* inst, size_t channel){
-	osc_instance_data* data = (osc_instance_data*) inst->impl;
-	uint8_t xmit_buf[OSC_XMIT_BUF] = "", *format = NULL;
-	size_t offset = 0, p;
-
-	//fix destination rport if required
-	if(data->forced_rport){
-		//cheating a bit because both IPv4 and IPv6 have the port at the same offset
-		struct sockaddr_in* sockadd = (struct sockaddr_in*) &(data->dest);
-		sockadd->sin_port = htobe16(data->forced_rport);
+static int osc_message_template(osc_instance_data* data, size_t channel){
+	osc_channel* chan = data->channel + channel;
+	size_t path_len = osc_align((data->root ? strlen(data->root) : 0) + strlen(chan->path) + 1);
+	size_t offset = 4, p;
+	uint32_t element_size;
+
+	//the cached message is prefixed with its size to be usable as bundle element
+	chan->xmit_prefix = 4 + path_len + osc_align(chan->params + 2);
+	chan->xmit_len = chan->xmit_prefix;
+	for(p = 0; p < chan->params; p++){
+		chan->xmit_len += osc_data_length(chan->type[p]);
 	}
 
-	//determine minimum packet size
-	if(osc_align((data->root ? strlen(data->root) : 0) + strlen(data->channel[channel].path) + 1) + osc_align(data->channel[channel].params + 2)  >= sizeof(xmit_buf)){
-		LOGPF("Insufficient buffer size for transmitting channel %s.%s", inst->name, data->channel[channel].path);
+	chan->xmit = calloc(chan->xmit_len, sizeof(uint8_t));
+	if(!chan->xmit){
+		LOG("Failed to allocate memory");
 		return 1;
 	}
 
+	element_size = htobe32(chan->xmit_len - 4);
+	memcpy(chan->xmit, &element_size, sizeof(element_size));
+
 	//copy osc target path
 	if(data->root){
-		memcpy(xmit_buf, data->root, strlen(data->root));
+		memcpy(chan->xmit + offset, data->root, strlen(data->root));
 		offset += strlen(data->root);
 	}
+	memcpy(chan->xmit + offset, chan->path, strlen(chan->path));
+
+	//write format string
+	offset = 4 + path_len;
+	chan->xmit[offset] = ',';
+	for(p = 0; p < chan->params; p++){
+		chan->xmit[offset + 1 + p] = chan->type[p];
+	}
+	return 0;
+}
+
+//patch the current output values into the cached message
+static void osc_message_update(osc_instance_data* data, size_t channel){
+	osc_channel* chan = data->channel + channel;
+	size_t offset = chan->xmit_prefix, p;
+
+	for(p = 0; p < chan->params; p++){
+		osc_deparse(chan->type[p], chan->out[p], chan->xmit + offset);
+		offset += osc_data_length(chan->type[p]);
+	}
+}
+
+static int osc_tcp_add(instance* inst, int fd, uint8_t outgoing){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+
+	data->connection = realloc(data->connection, (data->connections + 1) * sizeof(osc_connection));
+	if(!data->connection){
+		data->connections = 0;
+		LOG("Failed to allocate memory");
+		close(fd);
+		return 1;
+	}
+
+	memset(data->connection + data->connections, 0, sizeof(osc_connection));
+	data->connection[data->connections].fd = fd;
+	data->connection[data->connections].outgoing = outgoing;
+	//output to slow peers is buffered up to a limit, further packets are dropped
+	mmbackend_queue_init(&(data->connection[data->connections].queue), fd, BACKEND_NAME, inst, OSC_TCP_XMIT_LIMIT, mmbackend_queue_drop);
+	data->connections++;
+
+	return mm_manage_fd(fd, BACKEND_NAME, 1, inst);
+}
+
+static void osc_tcp_close(instance* inst, size_t conn){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+
+	mm_manage_fd(data->connection[conn].fd, BACKEND_NAME, 0, NULL);
+	close(data->connection[conn].fd);
+	free(data->connection[conn].recv);
+	mmbackend_queue_free(&(data->connection[conn].queue));
+
+	//outgoing connections are reestablished by the maintenance timer
+	if(data->connection[conn].outgoing){
+		data->tcp_last_connect = mm_timestamp();
+	}
+
+	data->connections--;
+	data->connection[conn] = data->connection[data->connections];
+}
+
+//start a nonblocking connection attempt, completed by osc_tcp_connected once the socket becomes writable
+static int osc_tcp_connect(instance* inst){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+	uint8_t pending = 0;
+	int fd = -1;
+
+	data->tcp_last_connect = mm_timestamp();
+	fd = mmbackend_socket_connect(&data->tcp_addr, data->tcp_addr_len, &pending);
+	if(fd < 0){
+		LOGPF("Failed to connect instance %s to %s port %s, will be retried", inst->name, data->tcp_host, data->tcp_port);
+		return 1;
+	}
+
+	if(osc_tcp_add(inst, fd, 1)){
+		return 1;
+	}
+
+	if(!pending){
+		LOGPF("Instance %s connected to %s port %s", inst->name, data->tcp_host, data->tcp_port);
+		return 0;
+	}
+
+	//wait for the connection to complete
+	data->connection[data->connections - 1].connecting = 1;
+	return mm_manage_fd(fd, BACKEND_NAME, mmfd_read | mmfd_write, inst);
+}
 
-	memcpy(xmit_buf + offset, data->channel[channel].path, strlen(data->channel[channel].path));
-	offset += strlen(data->channel[channel].path) + 1;
-	offset = osc_align(offset);
+static void osc_tcp_connected(instance* inst, size_t conn){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+	int error = mmbackend_socket_connected(data->connection[conn].fd);
 
-	//get format string offset, initialize
-	format = xmit_buf + offset;
-	offset += osc_align(data->channel[channel].params + 2);
-	*format = ',';
-	format++;
+	if(error){
+		LOGPF("Failed to connect instance %s to %s port %s: %s, will be retried", inst->name, data->tcp_host, data->tcp_port, mmbackend_socket_strerror(error));
+		osc_tcp_close(inst, conn);
+		return;
+	}
 
-	for(p = 0; p < data->channel[channel].params; p++){
-		//write format specifier
-		format[p] = data->channel[channel].type[p];
+	LOGPF("Instance %s connected to %s port %s", inst->name, data->tcp_host, data->tcp_port);
+	data->connection[conn].connecting = 0;
+	mm_manage_fd(data->connection[conn].fd, BACKEND_NAME, mmfd_read, inst);
+}
 
-		//write data
-		if(offset + osc_data_length(data->channel[channel].type[p]) >= sizeof(xmit_buf)){
-			LOGPF("Insufficient buffer size for transmitting channel %s.%s at parameter %" PRIsize_t, inst->name, data->channel[channel].path, p);
+//slip-encode a packet and queue it for all connections
+static int osc_tcp_queue(instance* inst, uint8_t* buffer, size_t length){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+	size_t u, p, encoded = 0;
+
+	//worst case every byte is escaped, plus the frame delimiters
+	if(2 * length + 2 > data->slip_alloc){
+		data->slip = realloc(data->slip, 2 * length + 2);
+		if(!data->slip){
+			data->slip_alloc = 0;
+			LOG("Failed to allocate memory");
 			return 1;
 		}
+		data->slip_alloc = 2 * length + 2;
+	}
 
-		osc_deparse(data->channel[channel].type[p],
-				data->channel[channel].out[p],
-				xmit_buf + offset);
-		offset += osc_data_length(data->channel[channel].type[p]);
+	data->slip[encoded++] = SLIP_END;
+	for(p = 0; p < length; p++){
+		switch(buffer[p]){
+			case SLIP_END:
+				data->slip[encoded++] = SLIP_ESC;
+				data->slip[encoded++] = SLIP_ESC_END;
+				break;
+			case SLIP_ESC:
+				data->slip[encoded++] = SLIP_ESC;
+				data->slip[encoded++] = SLIP_ESC_ESC;
+				break;
+			default:
+				data->slip[encoded++] = buffer[p];
+		}
+	}
+	data->slip[encoded++] = SLIP_END;
+
+	for(u = 0; u < data->connections; u++){
+		//output generated while connecting is not buffered
+		if(data->connection[u].connecting){
+			continue;
+		}
+
+		switch(mmbackend_queue_send(&(data->connection[u].queue), data->slip, encoded, 0)){
+			case 1:
+				LOGPF("Failed to send on %s, closing connection", inst->name);
+				osc_tcp_close(inst, u);
+				u--;
+				break;
+			case 2:
+				LOGPF("Output buffer limit exceeded for a connection on %s, dropping packet", inst->name);
+				break;
+		}
+	}
+	return 0;
+}
+
+static int osc_transmit(instance* inst, uint8_t* buffer, size_t length){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+
+	if(data->tcp){
+		return osc_tcp_queue(inst, buffer, length);
+	}
+
+	//fix destination rport if required
+	if(data->forced_rport){
+		//cheating a bit because both IPv4 and IPv6 have the port at the same offset
+		struct sockaddr_in* sockadd = (struct sockaddr_in*) &(data->dest);
+		sockadd->sin_port = htobe16(data->forced_rport);
 	}
 
 	//output packet
-	if(sendto(data->fd, xmit_buf, offset, 0, (struct sockaddr*) &(data->dest), data->dest_len) < 0){
+	if(sendto(data->fd, buffer, length, 0, (struct sockaddr*) &(data->dest), data->dest_len) < 0){
 		LOGPF("Failed to transmit packet: %s", mmbackend_socket_strerror(errno));
 	}
 	return 0;
 }
 
+static int osc_output_channel(instance* inst, size_t channel){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+
+	osc_message_update(data, channel);
+	return osc_transmit(inst, data->channel[channel].xmit + 4, data->channel[channel].xmit_len - 4);
+}
+
+static int osc_output_bundle(instance* inst, uint8_t* buffer, size_t length, size_t elements){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+
+	//a bundle with only one element is sent as a plain message, unless it needs to carry a timetag
+	if(elements == 1 && !data->timetag){
+		return osc_transmit(inst, buffer + OSC_BUNDLE_HEADER + 4, length - OSC_BUNDLE_HEADER - 4);
+	}
+	return osc_transmit(inst, buffer, length);
+}
+
+static int osc_output_marked(instance* inst, size_t num, channel** c){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+	uint8_t xmit_buf[OSC_XMIT_BUF];
+	size_t evt, length, offset = OSC_BUNDLE_HEADER, elements = 0;
+	uint64_t timetag;
+	int rv = 0;
+	osc_channel_ident ident = {
+		.label = 0
+	};
+
+	//bundle header with the immediate timetag
+	memcpy(xmit_buf, "#bundle\0\0\0\0\0\0\0\0\1", OSC_BUNDLE_HEADER);
+
+	//timestamp all events of this cycle with the current time and the configured offset
+	if(data->timetag){
+		timetag = htobe64(osc_timetag_offset(osc_timetag_now(), data->timetag_offset));
+		memcpy(xmit_buf + 8, &timetag, sizeof(timetag));
+	}
+
+	for(evt = 0; !rv && evt < num; evt++){
+		ident.label = c[evt]->ident;
+		if(!data->channel[ident.fields.channel].mark){
+			continue;
+		}
+		data->channel[ident.fields.channel].mark = 0;
+
+		length = data->channel[ident.fields.channel].xmit_len;
+		if(offset + length > data->mtu){
+			if(elements){
+				rv |= osc_output_bundle(inst, xmit_buf, offset, elements);
+				offset = OSC_BUNDLE_HEADER;
+				elements = 0;
+			}
+
+			//messages not fitting into a bundle are sent on their own, in a single-element bundle if they need to carry a timetag
+			if(offset + length > data->mtu){
+				if(data->timetag && offset + length <= sizeof(xmit_buf)){
+					osc_message_update(data, ident.fields.channel);
+					memcpy(xmit_buf + offset, data->channel[ident.fields.channel].xmit, length);
+					rv |= osc_output_bundle(inst, xmit_buf, offset + length, 1);
+				}
+				else{
+					rv |= osc_output_channel(inst, ident.fields.channel);
+				}
+				continue;
+			}
+		}
+
+		//the cached message already carries the element size
+		osc_message_update(data, ident.fields.channel);
+		memcpy(xmit_buf + offset, data->channel[ident.fields.channel].xmit, length);
+		offset += length;
+		elements++;
+	}
+
+	if(elements){
+		rv |= osc_output_bundle(inst, xmit_buf, offset, elements);
+	}
+	return rv;
+}
+
 static int osc_set(instance* inst, size_t num, channel** c, channel_value* v){
 	size_t evt = 0, mark = 0;
 	int rv = 0;
@@ -711,7 +1192,7 @@ static int osc_set(instance* inst, size_t num, channel** c, channel_value* v){
 	};
 	osc_parameter_value current;
 
-	if(!data->dest_len){
+	if(!data->dest_len && !data->tcp){
 		LOGPF("Instance %s does not have a destination, output is disabled (%" PRIsize_t " channels)", inst->name, num);
 		return 0;
 	}
@@ -746,7 +1227,11 @@ static int osc_set(instance* inst, size_t num, channel** c, channel_value* v){
 		}
 	}
 
-	if(mark){
+	if(mark && (data->bundle || data->timetag)){
+		//pack all marked channels into as few datagrams as possible
+		rv = osc_output_marked(inst, num, c);
+	}
+	else if(mark){
 		//output all marked channels
 		for(evt = 0; !rv && evt < num; evt++){
 			ident.label = c[evt]->ident;
@@ -774,43 +1259,126 @@ static int osc_process_message(instance* inst, char* local_path, char* format, u
 		return 0;
 	}
 
-	for(c = 0; c < data->channels; c++){
-		if(!strcmp(local_path, data->channel[c].path)){
-			ident.fields.channel = c;
-			//unconfigured input should work without errors (using default limits)
-			if(data->channel[c].params && strlen(format) != data->channel[c].params){
-				LOGPF("Message %s.%s had format %s, internal representation has %" PRIsize_t " parameters", inst->name, local_path, format, data->channel[c].params);
-				continue;
-			}
+	c = osc_path_lookup(data, local_path);
+	if(c == data->channels){
+		return 0;
+	}
 
-			for(p = 0; p < strlen(format); p++){
-				ident.fields.parameter = p;
-				if(data->channel[c].params){
-					max = data->channel[c].max[p];
-					min = data->channel[c].min[p];
-				}
-				else{
-					osc_defaults(format[p], &max, &min);
-				}
-				cur = osc_parse(format[p], payload + offset);
-				if(!data->channel[c].params || memcmp(&cur, &data->channel[c].in, sizeof(cur))){
-					evt = osc_parameter_normalise(format[p], min, max, cur);
-					chan = mm_channel(inst, ident.label, 0);
-					if(chan){
-						mm_channel_event(chan, evt);
-					}
-				}
+	ident.fields.channel = c;
+	//unconfigured input should work without errors (using default limits)
+	if(data->channel[c].params && strlen(format) != data->channel[c].params){
+		LOGPF("Message %s.%s had format %s, internal representation has %" PRIsize_t " parameters", inst->name, local_path, format, data->channel[c].params);
+		return 0;
+	}
 
-				//skip to next parameter data
-				offset += osc_data_length(format[p]);
-				//TODO check offset against payload length
+	for(p = 0; p < strlen(format); p++){
+		ident.fields.parameter = p;
+		if(data->channel[c].params){
+			max = data->channel[c].max[p];
+			min = data->channel[c].min[p];
+		}
+		else{
+			osc_defaults(format[p], &max, &min);
+		}
+		cur = osc_parse(format[p], payload + offset);
+		if(!data->channel[c].params || memcmp(&cur, &data->channel[c].in, sizeof(cur))){
+			evt = osc_parameter_normalise(format[p], min, max, cur);
+			chan = mm_channel(inst, ident.label, 0);
+			if(chan){
+				mm_channel_event(chan, evt);
 			}
 		}
+
+		//skip to next parameter data
+		offset += osc_data_length(format[p]);
+		//TODO check offset against payload length
+	}
+
+	return 0;
+}
+
+static int osc_schedule_less(size_t a, size_t b){
+	return osc_global_config.schedule[a].due < osc_global_config.schedule[b].due
+		|| (osc_global_config.schedule[a].due == osc_global_config.schedule[b].due
+			&& osc_global_config.schedule[a].sequence < osc_global_config.schedule[b].sequence);
+}
+
+static void osc_schedule_swap(size_t a, size_t b){
+	osc_scheduled_bundle xchg = osc_global_config.schedule[a];
+	osc_global_config.schedule[a] = osc_global_config.schedule[b];
+	osc_global_config.schedule[b] = xchg;
+}
+
+static int osc_schedule_push(instance* inst, uint8_t* buffer, size_t len, uint64_t delay){
+	size_t u = osc_global_config.scheduled;
+	uint8_t* copy = NULL;
+	osc_scheduled_bundle* schedule = NULL;
+
+	if(delay > osc_global_config.horizon){
+		LOGPF("Discarding bundle on %s scheduled %" PRIu64 "ms in the future, exceeding the horizon", inst->name, delay);
+		return 0;
+	}
+
+	if(osc_global_config.scheduled >= osc_global_config.schedule_limit){
+		LOGPF("Discarding bundle on %s, %" PRIsize_t " bundles already scheduled", inst->name, osc_global_config.scheduled);
+		return 0;
+	}
+
+	if(osc_global_config.scheduled == osc_global_config.schedule_alloc){
+		schedule = realloc(osc_global_config.schedule, max(2 * osc_global_config.schedule_alloc, 16) * sizeof(osc_scheduled_bundle));
+		if(!schedule){
+			LOG("Failed to allocate memory");
+			return 1;
+		}
+		osc_global_config.schedule = schedule;
+		osc_global_config.schedule_alloc = max(2 * osc_global_config.schedule_alloc, 16);
 	}
 
+	copy = malloc(len);
+	if(!copy){
+		LOG("Failed to allocate memory");
+		return 1;
+	}
+
+	//mark the copy as immediate so it is processed directly when released
+	memcpy(copy, buffer, len);
+	memset(copy + 8, 0, 8);
+	copy[15] = OSC_TIMETAG_IMMEDIATE;
+
+	osc_global_config.schedule[u].due = mm_timestamp() + delay;
+	osc_global_config.schedule[u].sequence = osc_global_config.sequence++;
+	osc_global_config.schedule[u].inst = inst;
+	osc_global_config.schedule[u].length = len;
+	osc_global_config.schedule[u].data = copy;
+	osc_global_config.scheduled++;
+
+	//sift up
+	for(; u && osc_schedule_less(u, (u - 1) / 2); u = (u - 1) / 2){
+		osc_schedule_swap(u, (u - 1) / 2);
+	}
 	return 0;
 }
 
+static osc_scheduled_bundle osc_schedule_pop(){
+	size_t u = 0, next;
+	osc_scheduled_bundle top = osc_global_config.schedule[0];
+
+	osc_global_config.scheduled--;
+	osc_global_config.schedule[0] = osc_global_config.schedule[osc_global_config.scheduled];
+
+	//sift down
+	for(next = 1; next < osc_global_config.scheduled; u = next, next = 2 * u + 1){
+		if(next + 1 < osc_global_config.scheduled && osc_schedule_less(next + 1, next)){
+			next++;
+		}
+		if(!osc_schedule_less(next, u)){
+			break;
+		}
+		osc_schedule_swap(u, next);
+	}
+	return top;
+}
+
 static int osc_process_packet(instance* inst, uint8_t* buffer, size_t len){
 	osc_instance_data* data = (osc_instance_data*) inst->impl;
 	size_t offset = 0, message_length = len;
@@ -818,11 +1386,29 @@ static int osc_process_packet(instance* inst, uint8_t* buffer, size_t len){
 	uint8_t* osc_data = NULL;
 	uint32_t* bundle_size = NULL;
 	uint8_t decode_bundle = 0;
+	uint64_t timetag = 0;
+	int64_t delay = 0;
 
 	//bundles need at least a header and timestamp
 	if(len >= 16 && !memcmp(buffer, "#bundle\0", 8)){
 		decode_bundle = 1;
 		offset = 16;
+
+		memcpy(&timetag, buffer + 8, sizeof(timetag));
+		timetag = be64toh(timetag);
+		if(timetag != OSC_TIMETAG_IMMEDIATE){
+			delay = osc_timetag_diff(timetag, osc_timetag_now());
+			if(delay > 0){
+				DBGPF("Scheduling bundle on %s for %" PRId64 "ms in the future", inst->name, delay);
+				return osc_schedule_push(inst, buffer, len, delay);
+			}
+			else if(data->tolerance && -delay > data->tolerance){
+				if(osc_global_config.detect){
+					LOGPF("Discarding bundle on %s, %" PRId64 "ms late", inst->name, -delay);
+				}
+				return 0;
+			}
+		}
 	}
 
 	do{
@@ -881,12 +1467,168 @@ static int osc_process_packet(instance* inst, uint8_t* buffer, size_t len){
 	return 0;
 }
 
+static void osc_tcp_accept(instance* inst){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+	int fd = -1;
+	#ifdef _WIN32
+	u_long mode = 1;
+	#endif
+
+	for(fd = accept(data->fd, NULL, NULL); fd >= 0; fd = accept(data->fd, NULL, NULL)){
+		#ifdef _WIN32
+		if(ioctlsocket(fd, FIONBIO, &mode) != NO_ERROR){
+		#else
+		if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0){
+		#endif
+			LOGPF("Failed to set client socket nonblocking on %s: %s", inst->name, mmbackend_socket_strerror(errno));
+			close(fd);
+			continue;
+		}
+
+		DBGPF("Accepted client connection on %s", inst->name);
+		osc_tcp_add(inst, fd, 0);
+	}
+}
+
+//returns 1 if the connection was closed
+static int osc_tcp_receive(instance* inst, size_t index){
+	osc_instance_data* data = (osc_instance_data*) inst->impl;
+	osc_connection* conn = data->connection + index;
+	ssize_t bytes_read;
+	size_t scan;
+	uint8_t byte;
+
+	do{
+		//move the partially decoded packet to the start of the buffer
+		if(conn->recv_start){
+			memmove(conn->recv, conn->recv + conn->recv_start, conn->recv_len - conn->recv_start);
+			conn->recv_len -= conn->recv_start;
+			conn->recv_start = 0;
+		}
+
+		if(conn->recv_len >= OSC_TCP_MAX_PACKET){
+			LOGPF("Incoming packet on %s exceeds the maximum size, discarding", inst->name);
+			conn->recv_discard = 1;
+			conn->recv_len = conn->recv_decoded = 0;
+		}
+
+		if(conn->recv_alloc - conn->recv_len < OSC_RECV_BUF){
+			conn->recv_alloc = max(conn->recv_alloc * 2, conn->recv_len + OSC_RECV_BUF);
+			conn->recv = realloc(conn->recv, conn->recv_alloc);
+			if(!conn->recv){
+				LOG("Failed to allocate memory");
+				osc_tcp_close(inst, index);
+				return 1;
+			}
+		}
+
+		bytes_read = recv(conn->fd, conn->recv + conn->recv_len, conn->recv_alloc - conn->recv_len, 0);
+		if(bytes_read <= 0){
+			break;
+		}
+
+		//decode in place, the write position never overtakes the read position
+		for(scan = conn->recv_len; scan < conn->recv_len + bytes_read; scan++){
+			byte = conn->recv[scan];
+			if(conn->recv_escape){
+				byte = (byte == SLIP_ESC_END) ? SLIP_END : ((byte == SLIP_ESC_ESC) ? SLIP_ESC : byte);
+				conn->recv_escape = 0;
+			}
+			else if(byte == SLIP_ESC){
+				conn->recv_escape = 1;
+				continue;
+			}
+			else if(byte == SLIP_END){
+				if(conn->recv_decoded && !conn->recv_discard){
+					osc_process_packet(inst, conn->recv + conn->recv_start, conn->recv_decoded);
+				}
+				conn->recv_start = scan + 1;
+				conn->recv_decoded = 0;
+				conn->recv_discard = 0;
+				continue;
+			}
+
+			if(!conn->recv_discard){
+				conn->recv[conn->recv_start + conn->recv_decoded] = byte;
+				conn->recv_decoded++;
+			}
+		}
+
+		//only keep the decoded part of the current packet
+		conn->recv_len = conn->recv_start + conn->recv_decoded;
+	} while(bytes_read > 0);
+
+	#ifdef _WIN32
+	if(bytes_read < 0 && WSAGetLastError() != WSAEWOULDBLOCK){
+	#else
+	if(bytes_read < 0 && errno != EAGAIN){
+	#endif
+		LOGPF("Failed to receive data for instance %s: %s", inst->name, mmbackend_socket_strerror(errno));
+		bytes_read = 0;
+	}
+
+	if(bytes_read == 0){
+		LOGPF("Connection on %s closed", inst->name);
+		osc_tcp_close(inst, index);
+		return 1;
+	}
+	return 0;
+}
+
+static int osc_tcp_maintenance(){
+	size_t n, u, c;
+	instance** inst = NULL;
+	osc_instance_data* data = NULL;
+
+	if(mm_backend_instances(BACKEND_NAME, &n, &inst)){
+		LOG("Failed to fetch instance list");
+		return 1;
+	}
+
+	for(u = 0; u < n; u++){
+		data = (osc_instance_data*) inst[u]->impl;
+		if(!data->tcp){
+			continue;
+		}
+
+		//reconnect lost outgoing connections
+		if(data->tcp_host && mm_timestamp() - data->tcp_last_connect >= OSC_TCP_RECONNECT){
+			for(c = 0; c < data->connections && !data->connection[c].outgoing; c++){
+			}
+			if(c == data->connections){
+				osc_tcp_connect(inst[u]);
+			}
+		}
+	}
+
+	free(inst);
+	return 0;
+}
+
 static int osc_handle(size_t num, managed_fd* fds){
-	size_t fd;
+	size_t fd, c;
 	uint8_t recv_buf[OSC_RECV_BUF];
 	instance* inst = NULL;
 	osc_instance_data* data = NULL;
 	ssize_t bytes_read = 0;
+	static uint64_t last_maintenance = 0;
+
+	osc_scheduled_bundle due;
+
+	//release all bundles due in this iteration
+	while(osc_global_config.scheduled && osc_global_config.schedule[0].due <= mm_timestamp()){
+		due = osc_schedule_pop();
+		osc_process_packet(due.inst, due.data, due.length);
+		free(due.data);
+	}
+
+	//reconnect lost connections
+	if(mm_timestamp() - last_maintenance >= OSC_TCP_RECONNECT){
+		if(osc_tcp_maintenance()){
+			return 1;
+		}
+		last_maintenance = mm_timestamp();
+	}
 
 	for(fd = 0; fd < num; fd++){
 		inst = (instance*) fds[fd].impl;
@@ -897,6 +1639,35 @@ static int osc_handle(size_t num, managed_fd* fds){
 
 		data = (osc_instance_data*) inst->impl;
 
+		if(data->tcp){
+			if(fds[fd].fd == data->fd){
+				osc_tcp_accept(inst);
+				continue;
+			}
+
+			for(c = 0; c < data->connections; c++){
+				if(data->connection[c].fd == fds[fd].fd){
+					if(data->connection[c].connecting){
+						osc_tcp_connected(inst, c);
+						break;
+					}
+
+					//continue writing buffered output
+					if((fds[fd].ready & mmfd_write) && mmbackend_queue_flush(&(data->connection[c].queue))){
+						LOGPF("Failed to send on %s, closing connection", inst->name);
+						osc_tcp_close(inst, c);
+						break;
+					}
+
+					if(fds[fd].ready & mmfd_read){
+						osc_tcp_receive(inst, c);
+					}
+					break;
+				}
+			}
+			continue;
+		}
+
 		do{
 			if(data->learn){
 				data->dest_len = sizeof(data->dest);
@@ -931,13 +1702,29 @@ static int osc_handle(size_t num, managed_fd* fds){
 }
 
 static int osc_start(size_t n, instance** inst){
-	size_t u, fds = 0;
+	size_t u, c, fds = 0;
 	osc_instance_data* data = NULL;
 
 	//update instance identifiers
 	for(u = 0; u < n; u++){
 		data = (osc_instance_data*) inst[u]->impl;
 
+		//precompute the wire representation for all channels with a known format
+		for(c = 0; c < data->channels; c++){
+			if(data->channel[c].params && osc_message_template(data, c)){
+				return 1;
+			}
+		}
+
+		if(data->tcp && (data->learn || data->dest_len || (data->fd >= 0 && !(data->tcp & OSC_TCP_LISTEN)))){
+			LOGPF("Instance %s mixes TCP and UDP transports, please use only one", inst[u]->name);
+			return 1;
+		}
+
+		if((data->tcp & OSC_TCP_CONNECT) && !osc_tcp_connect(inst[u])){
+			fds++;
+		}
+
 		if(data->fd >= 0){
 			inst[u]->ident = data->fd;
 			if(mm_manage_fd(data->fd, BACKEND_NAME, 1, inst[u])){
@@ -965,8 +1752,12 @@ static int osc_shutdown(size_t n, instance** inst){
 			free(data->channel[c].path);
 			free(data->channel[c].in);
 			free(data->channel[c].out);
+			free(data->channel[c].xmit);
 		}
 		free(data->channel);
+		for(c = 0; c < OSC_PATH_BUCKETS; c++){
+			free(data->bucket[c]);
+		}
 		for(c = 0; c < data->patterns; c++){
 			free(data->pattern[c].path);
 			free(data->pattern[c].type);
@@ -974,6 +1765,17 @@ static int osc_shutdown(size_t n, instance** inst){
 			free(data->pattern[c].max);
 		}
 		free(data->pattern);
+		osc_pattern_free(&data->pattern_root);
+
+		for(c = 0; c < data->connections; c++){
+			close(data->connection[c].fd);
+			free(data->connection[c].recv);
+			mmbackend_queue_free(&(data->connection[c].queue));
+		}
+		free(data->connection);
+		free(data->slip);
+		free(data->tcp_host);
+		free(data->tcp_port);
 
 		free(data->root);
 		if(data->fd >= 0){
@@ -985,6 +1787,14 @@ static int osc_shutdown(size_t n, instance** inst){
 		free(inst[u]->impl);
 	}
 
+	for(u = 0; u < osc_global_config.scheduled; u++){
+		free(osc_global_config.schedule[u].data);
+	}
+	free(osc_global_config.schedule);
+	osc_global_config.schedule = NULL;
+	osc_global_config.scheduled = 0;
+	osc_global_config.schedule_alloc = 0;
+
 	LOG("Backend shut down");
 	return 0;
 }
@@ -6,6 +6,29 @@
 
 #define OSC_RECV_BUF 8192
 #define OSC_XMIT_BUF 8192
+//typical ethernet mtu minus ipv6 and udp headers
+#define OSC_DEFAULT_MTU 1452
+#define OSC_BUNDLE_HEADER 16
+//tcp transport limits and timers
+#define OSC_TCP_MAX_PACKET (1024 * 1024)
+#define OSC_TCP_XMIT_LIMIT (4 * 1024 * 1024)
+#define OSC_TCP_RECONNECT 2000
+#define OSC_TCP_LISTEN 0x01
+#define OSC_TCP_CONNECT 0x02
+//slip framing bytes
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+//offset between the ntp (1900) and unix (1970) epochs in seconds
+#define OSC_NTP_EPOCH_OFFSET 2208988800ULL
+#define OSC_TIMETAG_IMMEDIATE 1
+//default limits for holding incoming bundles with future timetags
+#define OSC_SCHEDULE_HORIZON 10000
+#define OSC_SCHEDULE_LIMIT 1024
+
+//channel path index is set up for 256 buckets
+#define OSC_PATH_BUCKETS 256
 
 MM_PLUGIN_API int init();
 static int osc_configure(char* option, char* value);
@@ -14,6 +37,7 @@ static int osc_instance(instance* inst);
 static channel* osc_map_channel(instance* inst, char* spec, uint8_t flags);
 static int osc_set(instance* inst, size_t num, channel** c, channel_value* v);
 static int osc_handle(size_t num, managed_fd* fds);
+static uint32_t osc_interval();
 static int osc_start(size_t n, instance** inst);
 static int osc_shutdown(size_t n, instance** inst);
 
@@ -33,8 +57,40 @@ typedef union {
 	double d;
 } osc_parameter_value;
 
+typedef enum {
+	pattern_literal = 0,
+	pattern_any,		//?
+	pattern_wildcard,	//*
+	pattern_set,		//[]
+	pattern_alternatives	//{}
+} osc_pattern_token_type;
+
+typedef struct /*_osc_pattern_token*/ {
+	osc_pattern_token_type type;
+	//literal text or comma-separated alternatives
+	char* text;
+	size_t length;
+	//character bitmap for sets, inversion is applied when compiling
+	uint8_t set[32];
+} osc_pattern_token;
+
+typedef struct _osc_pattern_node {
+	//source text of the path part, literal parts do not have tokens
+	char* part;
+	size_t tokens;
+	osc_pattern_token* token;
+
+	size_t children;
+	struct _osc_pattern_node** child;
+
+	//indices of the patterns ending at this node
+	size_t matches;
+	size_t* match;
+} osc_pattern_node;
+
 typedef struct /*_osc_channel*/ {
 	char* path;
+	uint32_t hash;
 	size_t params;
 	uint8_t mark;
 
@@ -43,20 +99,65 @@ typedef struct /*_osc_channel*/ {
 	osc_parameter_value* min;
 	osc_parameter_value* in;
 	osc_parameter_value* out;
+
+	//cached output message, prefixed with its bundle element size
+	uint8_t* xmit;
+	size_t xmit_prefix;
+	size_t xmit_len;
 } osc_channel;
 
+typedef struct /*_osc_scheduled_bundle*/ {
+	uint64_t due;
+	uint64_t sequence;
+	instance* inst;
+	size_t length;
+	uint8_t* data;
+} osc_scheduled_bundle;
+
+typedef struct /*_osc_connection*/ {
+	int fd;
+	uint8_t outgoing;
+	//nonblocking connect in progress, completed on writability
+	uint8_t connecting;
+
+	//slip decoder state, packets are decoded in place starting at recv_start
+	uint8_t* recv;
+	size_t recv_alloc;
+	size_t recv_len;
+	size_t recv_start;
+	size_t recv_decoded;
+	uint8_t recv_escape;
+	uint8_t recv_discard;
+
+	//pending encoded output
+	mmbackend_queue queue;
+} osc_connection;
+
 typedef struct /*_osc_instance_data*/ {
 	//pre-configured channel patterns
 	size_t patterns;
 	osc_channel* pattern;
+	//patterns compiled into a tree of path parts
+	osc_pattern_node pattern_root;
 
 	//actual channel registry
 	size_t channels;
 	osc_channel* channel;
 
+	//channel path index, buckets contain channel offsets
+	size_t bucket_size[OSC_PATH_BUCKETS];
+	size_t* bucket[OSC_PATH_BUCKETS];
+
 	//instance config
 	char* root;
 	uint8_t learn;
+	uint8_t bundle;
+	size_t mtu;
+	//outgoing bundle timetag, offset from the cycle time in milliseconds
+	uint8_t timetag;
+	int64_t timetag_offset;
+	//maximum lateness of incoming bundles in milliseconds, 0 to process all
+	uint64_t tolerance;
 
 	//peer addressing
 	socklen_t dest_len;
@@ -65,6 +166,20 @@ typedef struct /*_osc_instance_data*/ {
 
 	//peer fd
 	int fd;
+
+	//tcp transport (OSC_TCP_LISTEN / OSC_TCP_CONNECT), output is sent to all connections
+	uint8_t tcp;
+	char* tcp_host;
+	char* tcp_port;
+	//peer address for outgoing connections, resolved on configuration
+	socklen_t tcp_addr_len;
+	struct sockaddr_storage tcp_addr;
+	uint64_t tcp_last_connect;
+	size_t connections;
+	osc_connection* connection;
+	//slip encoding buffer shared by all connections
+	uint8_t* slip;
+	size_t slip_alloc;
 } osc_instance_data;
 
 typedef union {
@@ -1,6 +1,11 @@
 #define BACKEND_NAME "rtpmidi"
 //#define DEBUG
 
+//sendmmsg is a GNU extension
+#ifdef __linux__
+	#define _GNU_SOURCE
+#endif
+
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
@@ -18,6 +23,7 @@
 #include <net/if.h>
 #include <sys/types.h>
 #include <ifaddrs.h>
+#include <time.h>
 #endif
 
 //TODO learn peer ssrcs
@@ -348,6 +354,23 @@ static uint32_t rtpmidi_interval(){
 	return max(0, (int64_t) RTPMIDI_SERVICE_INTERVAL - (int64_t) (mm_timestamp() - cfg.last_service));
 }
 
+//media clock for RTP timestamps and AppleMIDI clock synchronization
+static uint64_t rtpmidi_clock(){
+	#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (count.QuadPart / frequency.QuadPart) * RTPMIDI_CLOCK_RATE
+		+ ((count.QuadPart % frequency.QuadPart) * RTPMIDI_CLOCK_RATE) / frequency.QuadPart;
+	#else
+	struct timespec current;
+	if(clock_gettime(CLOCK_MONOTONIC, &current)){
+		return mm_timestamp() * (RTPMIDI_CLOCK_RATE / 1000);
+	}
+	return current.tv_sec * RTPMIDI_CLOCK_RATE + current.tv_nsec / (1000000000 / RTPMIDI_CLOCK_RATE);
+	#endif
+}
+
 static int rtpmidi_configure(char* option, char* value){
 	if(!strcmp(option, "mdns-name")){
 		if(cfg.mdns_name){
@@ -437,6 +460,19 @@ static char* rtpmidi_type_name(uint8_t type){
 	return "unknown";
 }
 
+static size_t rtpmidi_find_peer(rtpmidi_instance_data* data, struct sockaddr* sock_addr, socklen_t sock_len){
+	size_t u;
+
+	for(u = 0; u < data->peers; u++){
+		if(data->peer[u].active
+				&& data->peer[u].dest_len == sock_len
+				&& !memcmp(&data->peer[u].dest, sock_addr, sock_len)){
+			break;
+		}
+	}
+	return u;
+}
+
 static int rtpmidi_push_peer(rtpmidi_instance_data* data, struct sockaddr* sock_addr, socklen_t sock_len, uint8_t learned, uint8_t connected, ssize_t invite_reference){
 	size_t u, p = data->peers;
 
@@ -447,6 +483,13 @@ static int rtpmidi_push_peer(rtpmidi_instance_data* data, struct sockaddr* sock_
 				&& sock_len == data->peer[u].dest_len
 				&& !memcmp(&data->peer[u].dest, sock_addr, sock_len)){
 			//if yes, update connection flag (but not learned flag because that doesn't change)
+			if(connected && !data->peer[u].connected){
+				//new session, restart feedback, stream tracking and clock synchronization
+				data->peer[u].acknowledged = 0;
+				data->peer[u].rx_valid = 0;
+				data->peer[u].synchronized = 0;
+				data->peer[u].latency_reported = 0;
+			}
 			data->peer[u].connected = connected;
 			return 0;
 		}
@@ -464,6 +507,7 @@ static int rtpmidi_push_peer(rtpmidi_instance_data* data, struct sockaddr* sock_
 			return 1;
 		}
 		data->peers++;
+		data->peer[p].rx = NULL;
 		DBGPF("Extending peer registry to %" PRIsize_t " entries", data->peers);
 	}
 
@@ -473,6 +517,11 @@ static int rtpmidi_push_peer(rtpmidi_instance_data* data, struct sockaddr* sock_
 	data->peer[p].invite = invite_reference;
 	memcpy(&(data->peer[p].dest), sock_addr, sock_len);
 	data->peer[p].dest_len = sock_len;
+	data->peer[p].acknowledged = 0;
+	data->peer[p].rx_valid = 0;
+	data->peer[p].rx_reported = 0;
+	data->peer[p].synchronized = 0;
+	data->peer[p].latency_reported = 0;
 	return 0;
 }
 
@@ -662,6 +711,13 @@ static int rtpmidi_configure_instance(instance* inst, char* option, char* value)
 		}
 		return mmbackend_strdup(&data->accept, value);
 	}
+	else if(!strcmp(option, "journal")){
+		data->journal = 1;
+		if(!strcmp(value, "off")){
+			data->journal = 0;
+		}
+		return 0;
+	}
 
 	LOGPF("Unknown instance configuration option %s on instance %s", option, inst->name);
 	return 1;
@@ -675,6 +731,7 @@ static int rtpmidi_instance(instance* inst){
 	}
 	data->fd = -1;
 	data->control_fd = -1;
+	data->journal = 1;
 
 	inst->impl = data;
 	return 0;
@@ -778,26 +835,268 @@ static size_t rtpmidi_push_midi(uint8_t* payload, size_t bytes_left, uint8_t typ
 	return 4;
 }
 
+//map a 16-bit sequence number reported by a peer to the extended sequence number space
+static uint64_t rtpmidi_journal_extend(rtpmidi_instance_data* data, uint16_t sequence){
+	uint16_t distance = data->sequence - 1 - sequence;
+
+	if(distance >= data->packets){
+		return 0;
+	}
+	return data->packets - distance;
+}
+
+static void rtpmidi_journal_update(rtpmidi_instance_data* data, uint8_t type, uint8_t chan, uint8_t control, uint16_t value, uint64_t sequence){
+	rtpmidi_journal_channel* journal = data->journal_channel + chan;
+
+	switch(type){
+		case note:
+			journal->velocity[control] = value & 0x7F;
+			journal->note_sequence[control] = sequence;
+			break;
+		case cc:
+			//the parameter number controllers are only meaningful in sequence and can not be replayed from a log
+			if(control == 6 || control == 38 || (control >= 96 && control <= 101)){
+				return;
+			}
+			journal->control[control] = value & 0x7F;
+			journal->control_sequence[control] = sequence;
+			break;
+		case pitchbend:
+			journal->pitch = value & 0x3FFF;
+			journal->pitch_sequence = sequence;
+			break;
+		default:
+			//not covered by the journal
+			return;
+	}
+	journal->dirty = 1;
+}
+
+/*
+ * Encode the channel journal (chapters C, W and N) for all changes after the checkpoint.
+ * All S bits are left at 0, which is always valid and keeps the encoding
+ * independent of the packet it is sent in.
+ */
+static void rtpmidi_journal_encode_channel(rtpmidi_journal_channel* journal, uint8_t chan, uint64_t checkpoint){
+	uint8_t* chapter = journal->encoded + 3, *notes = NULL, chapters = 0, offbits[16] = {0}, low = 15, high = 0;
+	size_t u, logs = 0, offset = 0;
+
+	journal->dirty = 0;
+	journal->oldest = 0;
+	journal->length = 0;
+
+	//chapter C: controller values
+	for(u = 0; u < 128; u++){
+		if(journal->control_sequence[u] > checkpoint){
+			chapter[1 + 2 * logs] = u;
+			chapter[2 + 2 * logs] = journal->control[u];
+			journal->oldest = journal->oldest ? min(journal->oldest, journal->control_sequence[u]) : journal->control_sequence[u];
+			logs++;
+		}
+		else{
+			//fell behind the checkpoint, drop from the journal
+			journal->control_sequence[u] = 0;
+		}
+	}
+
+	if(logs){
+		chapter[0] = logs - 1;
+		offset = 1 + 2 * logs;
+		chapters |= RTPMIDI_CHAPTER_C;
+	}
+
+	//chapter W: pitch wheel
+	if(journal->pitch_sequence > checkpoint){
+		chapter[offset] = journal->pitch & 0x7F;
+		chapter[offset + 1] = (journal->pitch >> 7) & 0x7F;
+		journal->oldest = journal->oldest ? min(journal->oldest, journal->pitch_sequence) : journal->pitch_sequence;
+		offset += 2;
+		chapters |= RTPMIDI_CHAPTER_W;
+	}
+	else{
+		journal->pitch_sequence = 0;
+	}
+
+	//chapter N: active notes as logs, released notes as offbits
+	notes = chapter + offset;
+	for(logs = 0, u = 0; u < 128; u++){
+		if(journal->note_sequence[u] > checkpoint){
+			if(journal->velocity[u]){
+				notes[2 + 2 * logs] = u;
+				//set the Y bit, the note should be played on recovery
+				notes[3 + 2 * logs] = 0x80 | journal->velocity[u];
+				logs++;
+			}
+			else{
+				offbits[u / 8] |= 0x80 >> (u % 8);
+				low = min(low, u / 8);
+				high = max(high, u / 8);
+			}
+			journal->oldest = journal->oldest ? min(journal->oldest, journal->note_sequence[u]) : journal->note_sequence[u];
+		}
+		else{
+			journal->note_sequence[u] = 0;
+		}
+	}
+
+	if(logs || low <= high){
+		//LEN 127 with LOW 15 and HIGH 0 signals 128 logs, use an empty offbit octet to code 127 logs
+		if(logs == 127 && low > high){
+			low = high = 0;
+		}
+
+		notes[0] = (logs == 128) ? 127 : logs;
+		notes[1] = (low << 4) | high;
+		offset += 2 + 2 * logs;
+		for(u = low; u <= high; u++){
+			chapter[offset++] = offbits[u];
+		}
+		chapters |= RTPMIDI_CHAPTER_N;
+	}
+
+	if(chapters){
+		journal->length = 3 + offset;
+		journal->encoded[0] = (chan << 3) | ((journal->length >> 8) & 0x03);
+		journal->encoded[1] = journal->length & 0xFF;
+		journal->encoded[2] = chapters;
+	}
+}
+
+/*
+ * Assemble the recovery journal for packet `sequence`, coding the stream history
+ * from the checkpoint packet up to (and including) the previous packet.
+ * Returns the journal length or 0 if it does not fit into `length` bytes.
+ */
+static size_t rtpmidi_journal_encode(rtpmidi_instance_data* data, uint8_t* journal, size_t length, uint64_t sequence){
+	uint64_t checkpoint = (sequence > RTPMIDI_JOURNAL_DEPTH + 1) ? sequence - 1 - RTPMIDI_JOURNAL_DEPTH : 0, acknowledged = 0;
+	uint16_t checkpoint_sequence;
+	size_t u, offset = 3, channels = 0;
+	uint8_t feedback = 0;
+
+	//advance the checkpoint to the oldest packet confirmed by all peers, as long as every connected peer provides feedback
+	for(u = 0; u < data->peers; u++){
+		if(data->peer[u].active && data->peer[u].connected){
+			if(!data->peer[u].acknowledged){
+				acknowledged = 0;
+				break;
+			}
+			acknowledged = feedback ? min(acknowledged, data->peer[u].acknowledged) : data->peer[u].acknowledged;
+			feedback = 1;
+		}
+	}
+	checkpoint = max(max(checkpoint, acknowledged), data->checkpoint);
+	checkpoint = min(checkpoint, sequence - 1);
+
+	//only channels with entries behind the new checkpoint need to be encoded again
+	if(checkpoint != data->checkpoint){
+		for(u = 0; u < 16; u++){
+			if(data->journal_channel[u].length && data->journal_channel[u].oldest <= checkpoint){
+				data->journal_channel[u].dirty = 1;
+			}
+		}
+		data->checkpoint = checkpoint;
+	}
+
+	if(length < 3){
+		return 0;
+	}
+
+	for(u = 0; u < 16; u++){
+		if(data->journal_channel[u].dirty){
+			rtpmidi_journal_encode_channel(data->journal_channel + u, u, checkpoint);
+		}
+
+		if(data->journal_channel[u].length){
+			if(offset + data->journal_channel[u].length > length){
+				return 0;
+			}
+			memcpy(journal + offset, data->journal_channel[u].encoded, data->journal_channel[u].length);
+			offset += data->journal_channel[u].length;
+			channels++;
+		}
+	}
+
+	//recovery journal header, the current packet is sent with data->sequence - 1
+	checkpoint_sequence = data->sequence - 1 - (sequence - checkpoint);
+	journal[0] = channels ? (RTPMIDI_JOURNAL_CHANNELS | (channels - 1)) : 0;
+	journal[1] = checkpoint_sequence >> 8;
+	journal[2] = checkpoint_sequence & 0xFF;
+	return offset;
+}
+
+//send one frame to all connected peers
+static void rtpmidi_transmit(rtpmidi_instance_data* data, uint8_t* frame, size_t length){
+	size_t u;
+	#ifdef __linux__
+	struct iovec payload = {
+		.iov_base = frame,
+		.iov_len = length
+	};
+	struct mmsghdr batch[RTPMIDI_SEND_BATCH];
+	size_t batched = 0, done;
+	int sent;
+
+	for(u = 0; u < data->peers; u++){
+		if(data->peer[u].active && data->peer[u].connected){
+			memset(batch + batched, 0, sizeof(struct mmsghdr));
+			batch[batched].msg_hdr.msg_name = &data->peer[u].dest;
+			batch[batched].msg_hdr.msg_namelen = data->peer[u].dest_len;
+			batch[batched].msg_hdr.msg_iov = &payload;
+			batch[batched].msg_hdr.msg_iovlen = 1;
+			batched++;
+		}
+
+		if(batched && (batched == RTPMIDI_SEND_BATCH || u == data->peers - 1)){
+			for(done = 0; done < batched;){
+				sent = sendmmsg(data->fd, batch + done, batched - done, 0);
+				if(sent <= 0){
+					//skip the failing peer
+					LOGPF("Failed to transmit to peer: %s", mmbackend_socket_strerror(errno));
+					done++;
+					continue;
+				}
+				done += sent;
+			}
+			batched = 0;
+		}
+	}
+	#else
+	for(u = 0; u < data->peers; u++){
+		if(data->peer[u].active && data->peer[u].connected){
+			if(sendto(data->fd, frame, length, 0, (struct sockaddr*) &data->peer[u].dest, data->peer[u].dest_len) <= 0){
+				LOGPF("Failed to transmit to peer: %s", mmbackend_socket_strerror(errno));
+			}
+		}
+	}
+	#endif
+}
+
 static int rtpmidi_set(instance* inst, size_t num, channel** c, channel_value* v){
 	rtpmidi_instance_data* data = (rtpmidi_instance_data*) inst->impl;
 	uint8_t frame[RTPMIDI_PACKET_BUFFER] = "";
 	rtpmidi_header* rtp_header = (rtpmidi_header*) frame;
 	rtpmidi_command_header* command_header = (rtpmidi_command_header*) (frame + sizeof(rtpmidi_header));
-	size_t command_length = 0, offset = sizeof(rtpmidi_header) + sizeof(rtpmidi_command_header), u = 0;
-	uint8_t* payload = frame + offset;
+	size_t command_length = 0, offset = sizeof(rtpmidi_header) + sizeof(rtpmidi_command_header), u = 0, journal_length = 0;
+	uint8_t journal[RTPMIDI_PACKET_BUFFER];
+	uint64_t sequence = ++data->packets;
 	rtpmidi_channel_ident ident;
 
 	rtp_header->vpxcc = RTPMIDI_HEADER_MAGIC;
 	//some receivers seem to have problems reading rfcs and interpreting the marker bit correctly
 	rtp_header->mpt = (data->mode == apple ? 0 : 0x80) | RTPMIDI_HEADER_TYPE;
 	rtp_header->sequence = htobe16(data->sequence++);
-	rtp_header->timestamp = mm_timestamp() * 10; //just assume 100msec resolution because rfc4695 handwaves it
+	//use the same clock as the AppleMIDI synchronization so peers can relate the timestamps
+	rtp_header->timestamp = htobe32(rtpmidi_clock());
 	rtp_header->ssrc = htobe32(data->ssrc);
 
 	//midi command section header
-	//TODO enable the journal bit here
 	command_header->flags = 0xA0; //extended length header, first entry in list has dtime
 
+	//the journal codes the stream history before this packet, so encode it before updating the state
+	if(data->journal){
+		journal_length = rtpmidi_journal_encode(data, journal, sizeof(journal), sequence);
+	}
+
 	//midi list
 	for(u = 0; u < num; u++){
 		ident.label = c[u]->ident;
@@ -806,25 +1105,25 @@ static int rtpmidi_set(instance* inst, size_t num, channel** c, channel_value* v
 			case rpn:
 			case nrpn:
 				//transmit parameter number
-				command_length = rtpmidi_push_midi(payload + offset, sizeof(frame) - offset, cc, ident.fields.channel, (ident.fields.type == rpn) ? 101 : 99, (ident.fields.control >> 7) & 0x7F);
-				command_length += rtpmidi_push_midi(payload + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, (ident.fields.type == rpn) ? 100 : 98, ident.fields.control & 0x7F);
+				command_length = rtpmidi_push_midi(frame + offset, sizeof(frame) - offset, cc, ident.fields.channel, (ident.fields.type == rpn) ? 101 : 99, (ident.fields.control >> 7) & 0x7F);
+				command_length += rtpmidi_push_midi(frame + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, (ident.fields.type == rpn) ? 100 : 98, ident.fields.control & 0x7F);
 
 				//transmit parameter value
-				command_length += rtpmidi_push_midi(payload + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, 6, (((uint16_t) (v[u].normalised * 16383.0)) >> 7) & 0x7F);
-				command_length += rtpmidi_push_midi(payload + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, 38, ((uint16_t) (v[u].normalised * 16383.0)) & 0x7F);
+				command_length += rtpmidi_push_midi(frame + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, 6, (((uint16_t) (v[u].normalised * 16383.0)) >> 7) & 0x7F);
+				command_length += rtpmidi_push_midi(frame + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, 38, ((uint16_t) (v[u].normalised * 16383.0)) & 0x7F);
 
 				if(!data->epn_tx_short){
 					//clear active parameter
-					command_length += rtpmidi_push_midi(payload + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, 101, 127);
-					command_length += rtpmidi_push_midi(payload + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, 100, 127);
+					command_length += rtpmidi_push_midi(frame + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, 101, 127);
+					command_length += rtpmidi_push_midi(frame + offset + command_length, sizeof(frame) - offset, cc, ident.fields.channel, 100, 127);
 				}
 				break;
 			case pitchbend:
 				//TODO check whether this works
-				command_length = rtpmidi_push_midi(payload + offset, sizeof(frame) - offset, ident.fields.type, ident.fields.channel, ident.fields.control, v[u].normalised * 16383.0);
+				command_length = rtpmidi_push_midi(frame + offset, sizeof(frame) - offset, ident.fields.type, ident.fields.channel, ident.fields.control, v[u].normalised * 16383.0);
 				break;
 			default:
-				command_length = rtpmidi_push_midi(payload + offset, sizeof(frame) - offset, ident.fields.type, ident.fields.channel, ident.fields.control, v[u].normalised * 127.0);
+				command_length = rtpmidi_push_midi(frame + offset, sizeof(frame) - offset, ident.fields.type, ident.fields.channel, ident.fields.control, v[u].normalised * 127.0);
 		}
 
 		if(command_length == 0){
@@ -832,6 +1131,11 @@ static int rtpmidi_set(instance* inst, size_t num, channel** c, channel_value* v
 			break;
 		}
 
+		if(data->journal){
+			rtpmidi_journal_update(data, ident.fields.type, ident.fields.channel, ident.fields.control,
+					v[u].normalised * ((ident.fields.type == pitchbend) ? 16383.0 : 127.0), sequence);
+		}
+
 		offset += command_length;
 	}
 
@@ -840,24 +1144,59 @@ static int rtpmidi_set(instance* inst, size_t num, channel** c, channel_value* v
 	command_header->flags |= (((offset - sizeof(rtpmidi_header) - sizeof(rtpmidi_command_header)) & 0x0F00) >> 8);
 	command_header->length = ((offset - sizeof(rtpmidi_header) - sizeof(rtpmidi_command_header)) & 0xFF);
 
-	//TODO journal section
-
-	for(u = 0; u < data->peers; u++){
-		if(data->peer[u].active && data->peer[u].connected){
-			if(sendto(data->fd, frame, offset, 0, (struct sockaddr*) &data->peer[u].dest, data->peer[u].dest_len) <= 0){
-				LOGPF("Failed to transmit to peer: %s", mmbackend_socket_strerror(errno));
-			}
-		}
+	//append the recovery journal if it fits
+	if(journal_length && offset + journal_length <= sizeof(frame)){
+		command_header->flags |= RTPMIDI_COMMAND_JOURNAL;
+		memcpy(frame + offset, journal, journal_length);
+		offset += journal_length;
 	}
 
+	rtpmidi_transmit(data, frame, offset);
 	return 0;
 }
 
+//find the peer for an AppleMIDI command, which may arrive on either the control or the data port
+static size_t rtpmidi_find_apple_peer(rtpmidi_instance_data* data, int fd, struct sockaddr_storage* peer, socklen_t peer_len){
+	struct sockaddr_storage data_peer;
+
+	memcpy(&data_peer, peer, peer_len);
+	//peers are stored by their data port
+	if(fd == data->control_fd){
+		((struct sockaddr_in*) &data_peer)->sin_port = htobe16(be16toh(((struct sockaddr_in*) &data_peer)->sin_port) + 1);
+	}
+	return rtpmidi_find_peer(data, (struct sockaddr*) &data_peer, peer_len);
+}
+
+//update the clock synchronization estimates for a peer
+static void rtpmidi_peer_clock(instance* inst, rtpmidi_peer* peer, uint64_t latency, int64_t offset){
+	char peer_name[INET6_ADDRSTRLEN + 1];
+
+	if(!peer->synchronized){
+		peer->latency = latency;
+		peer->clock_offset = offset;
+		peer->synchronized = 1;
+	}
+	else{
+		//smooth out jitter in the measurements
+		peer->latency = (3 * peer->latency + latency) / 4;
+		peer->clock_offset = (3 * peer->clock_offset + offset) / 4;
+	}
+
+	if(!peer->latency_reported
+			|| max(peer->latency, peer->latency_reported) - min(peer->latency, peer->latency_reported) >= RTPMIDI_LATENCY_REPORT){
+		LOGPF("Instance %s peer %s latency %.1f msec", inst->name, mmbackend_sockaddr_ntop((struct sockaddr*) &peer->dest, peer_name, sizeof(peer_name)), (double) peer->latency * 1000.0 / RTPMIDI_CLOCK_RATE);
+		//store at least one tick so the initial measurement is only logged once
+		peer->latency_reported = max(peer->latency, 1);
+	}
+	DBGPF("Peer clock offset on %s is %" PRId64 " ticks", inst->name, peer->clock_offset);
+}
+
 static int rtpmidi_handle_applemidi(instance* inst, int fd, uint8_t* frame, size_t bytes, struct sockaddr_storage* peer, socklen_t peer_len){
 	rtpmidi_instance_data* data = (rtpmidi_instance_data*) inst->impl;
 	uint8_t response[RTPMIDI_PACKET_BUFFER] = "";
 	apple_command* command = (apple_command*) frame;
 	char* session_name = (char*) frame + sizeof(apple_command);
+	uint64_t acknowledged, now;
 	size_t n, u;
 
 	command->command = be16toh(command->command);
@@ -947,23 +1286,41 @@ static int rtpmidi_handle_applemidi(instance* inst, int fd, uint8_t* frame, size
 		return 0;
 	}
 	else if(command->command == apple_sync){
+		if(bytes < sizeof(apple_sync_frame)){
+			LOGPF("Short sync frame on instance %s", inst->name);
+			return 0;
+		}
+
 		//respond with sync answer
-		memcpy(response, frame, bytes);
+		memcpy(response, frame, sizeof(apple_sync_frame));
 		apple_sync_frame* sync = (apple_sync_frame*) response;
 		DBGPF("Incoming sync on instance %s (%d)", inst->name, sync->count);
 		sync->command = htobe16(apple_sync);
 		sync->ssrc = htobe32(data->ssrc);
+		now = rtpmidi_clock();
+		u = rtpmidi_find_apple_peer(data, fd, peer, peer_len);
 		switch(sync->count){
 			case 0:
 				//this happens if we're a participant
 				sync->count++;
-				sync->timestamp[1] = htobe64(mm_timestamp() * 10);
+				sync->timestamp[1] = htobe64(now);
 				break;
 			case 1:
-				//this happens if we're an initiator
+				//this happens if we're an initiator, the round trip started at timestamp 0 in our clock
+				if(u < data->peers && now >= be64toh(sync->timestamp[0])){
+					rtpmidi_peer_clock(inst, data->peer + u, (now - be64toh(sync->timestamp[0])) / 2,
+							(int64_t) be64toh(sync->timestamp[1]) - (int64_t) ((be64toh(sync->timestamp[0]) + now) / 2));
+				}
 				sync->count++;
-				sync->timestamp[2] = htobe64(mm_timestamp() * 10);
+				sync->timestamp[2] = htobe64(now);
 				break;
+			case 2:
+				//this happens if we're a participant, the second leg started at timestamp 1 in our clock
+				if(u < data->peers && now >= be64toh(sync->timestamp[1])){
+					rtpmidi_peer_clock(inst, data->peer + u, (now - be64toh(sync->timestamp[1])) / 2,
+							(int64_t) be64toh(sync->timestamp[2]) + (int64_t) ((now - be64toh(sync->timestamp[1])) / 2) - (int64_t) now);
+				}
+				return 0;
 			default:
 				//ignore this one
 				return 0;
@@ -975,8 +1332,18 @@ static int rtpmidi_handle_applemidi(instance* inst, int fd, uint8_t* frame, size
 		return 0;
 	}
 	else if(command->command == apple_feedback){
-		//TODO store this somewhere to properly update the recovery journal
-		LOGPF("Feedback on instance %s", inst->name);
+		if(bytes < sizeof(apple_journal_feedback)){
+			LOGPF("Short receiver feedback on instance %s", inst->name);
+			return 0;
+		}
+
+		u = rtpmidi_find_apple_peer(data, fd, peer, peer_len);
+		if(u < data->peers && data->journal){
+			//the sequence number is transmitted in the upper 16 bits
+			acknowledged = rtpmidi_journal_extend(data, be32toh(((apple_journal_feedback*) frame)->sequence) >> 16);
+			DBGPF("Receiver feedback on instance %s, peer %" PRIsize_t " acknowledged %" PRIu64, inst->name, u, acknowledged);
+			data->peer[u].acknowledged = max(data->peer[u].acknowledged, acknowledged);
+		}
 		return 0;
 	}
 	else{
@@ -1059,7 +1426,175 @@ static void rtpmidi_handle_epn(instance* inst, uint8_t chan, uint16_t control, u
 	}
 }
 
-static int rtpmidi_parse(instance* inst, uint8_t* frame, size_t bytes){
+//push a repair event from the recovery journal and update the receive state
+static void rtpmidi_journal_event(instance* inst, rtpmidi_stream_state* rx, uint8_t type, uint8_t chan, uint8_t control, uint16_t value){
+	rtpmidi_channel_ident ident = {
+		.label = 0
+	};
+	channel* changed = NULL;
+	channel_value val = {
+		.raw.u64 = value,
+		.normalised = (double) value / ((type == pitchbend) ? 16383.0 : 127.0)
+	};
+
+	switch(type){
+		case note:
+			rx->velocity[chan][control] = value;
+			break;
+		case cc:
+			rx->control[chan][control] = value;
+			break;
+		case pitchbend:
+			rx->pitch[chan] = value;
+			break;
+	}
+
+	DBGPF("Recovered type %02X channel %d control %d value %d on %s", type, chan, control, value, inst->name);
+
+	ident.fields.type = type;
+	ident.fields.channel = chan;
+	ident.fields.control = control;
+	changed = mm_channel(inst, ident.label, 0);
+	if(changed){
+		mm_channel_event(changed, val);
+	}
+}
+
+//apply the chapters of one channel journal that differ from the receive state
+static int rtpmidi_journal_recover_channel(instance* inst, rtpmidi_stream_state* rx, uint8_t chan, uint8_t chapters, uint8_t* journal, size_t length){
+	size_t offset = 0, u, logs, low, high;
+
+	//chapter P: program change, not journalled by this implementation
+	if(chapters & RTPMIDI_CHAPTER_P){
+		offset += 3;
+	}
+
+	//chapter C: controller values
+	if(chapters & RTPMIDI_CHAPTER_C){
+		if(offset >= length){
+			return 1;
+		}
+		logs = (journal[offset] & 0x7F) + 1;
+		offset++;
+		if(offset + 2 * logs > length){
+			return 1;
+		}
+
+		for(u = 0; u < logs; u++){
+			//only handle value-type logs (A bit clear), leave parameter numbers to the command stream
+			if(!(journal[offset + 2 * u + 1] & 0x80)
+					&& (journal[offset + 2 * u] & 0x7F) != 6
+					&& (journal[offset + 2 * u] & 0x7F) != 38
+					&& ((journal[offset + 2 * u] & 0x7F) < 96 || (journal[offset + 2 * u] & 0x7F) > 101)
+					&& rx->control[chan][journal[offset + 2 * u] & 0x7F] != (journal[offset + 2 * u + 1] & 0x7F)){
+				rtpmidi_journal_event(inst, rx, cc, chan, journal[offset + 2 * u] & 0x7F, journal[offset + 2 * u + 1] & 0x7F);
+			}
+		}
+		offset += 2 * logs;
+	}
+
+	//chapter M: parameter system, skip using the length field
+	if(chapters & RTPMIDI_CHAPTER_M){
+		if(offset + 2 > length){
+			return 1;
+		}
+		offset += ((journal[offset] & 0x03) << 8) | journal[offset + 1];
+	}
+
+	//chapter W: pitch wheel
+	if(chapters & RTPMIDI_CHAPTER_W){
+		if(offset + 2 > length){
+			return 1;
+		}
+		u = ((journal[offset + 1] & 0x7F) << 7) | (journal[offset] & 0x7F);
+		if(rx->pitch[chan] != u){
+			rtpmidi_journal_event(inst, rx, pitchbend, chan, 0, u);
+		}
+		offset += 2;
+	}
+
+	//chapter N: note logs and offbits
+	if(chapters & RTPMIDI_CHAPTER_N){
+		if(offset + 2 > length){
+			return 1;
+		}
+		logs = journal[offset] & 0x7F;
+		low = journal[offset + 1] >> 4;
+		high = journal[offset + 1] & 0x0F;
+		if(logs == 127 && low == 15 && high == 0){
+			logs = 128;
+		}
+		offset += 2;
+		if(offset + 2 * logs + ((low <= high) ? (high - low + 1) : 0) > length){
+			return 1;
+		}
+
+		for(u = 0; u < logs; u++){
+			//only replay notes with the Y bit set and a changed velocity
+			if((journal[offset + 2 * u + 1] & 0x80)
+					&& (journal[offset + 2 * u + 1] & 0x7F)
+					&& rx->velocity[chan][journal[offset + 2 * u] & 0x7F] != (journal[offset + 2 * u + 1] & 0x7F)){
+				rtpmidi_journal_event(inst, rx, note, chan, journal[offset + 2 * u] & 0x7F, journal[offset + 2 * u + 1] & 0x7F);
+			}
+		}
+		offset += 2 * logs;
+
+		for(; low <= high; low++, offset++){
+			for(u = 0; u < 8; u++){
+				if((journal[offset] & (0x80 >> u)) && rx->velocity[chan][low * 8 + u]){
+					rtpmidi_journal_event(inst, rx, note, chan, low * 8 + u, 0);
+				}
+			}
+		}
+	}
+
+	//chapters E, T and A are not handled
+	return 0;
+}
+
+static int rtpmidi_journal_recover(instance* inst, rtpmidi_stream_state* rx, uint8_t* journal, size_t bytes){
+	size_t offset = 3, channels, length, u;
+
+	if(bytes < 3){
+		LOGPF("Short recovery journal on %s", inst->name);
+		return 1;
+	}
+
+	//skip the system journal
+	if(journal[0] & RTPMIDI_JOURNAL_SYSTEM){
+		if(offset + 2 > bytes){
+			LOGPF("Short system journal on %s", inst->name);
+			return 1;
+		}
+		offset += ((journal[offset] & 0x03) << 8) | journal[offset + 1];
+	}
+
+	if(!(journal[0] & RTPMIDI_JOURNAL_CHANNELS)){
+		return 0;
+	}
+
+	channels = (journal[0] & 0x0F) + 1;
+	for(u = 0; u < channels; u++){
+		if(offset + 3 > bytes){
+			break;
+		}
+
+		length = ((journal[offset] & 0x03) << 8) | journal[offset + 1];
+		if(length < 3 || offset + length > bytes
+				|| rtpmidi_journal_recover_channel(inst, rx, (journal[offset] >> 3) & 0x0F, journal[offset + 2], journal + offset + 3, length - 3)){
+			break;
+		}
+		offset += length;
+	}
+
+	if(u != channels){
+		LOGPF("Malformed channel journal on %s", inst->name);
+		return 1;
+	}
+	return 0;
+}
+
+static int rtpmidi_parse(instance* inst, rtpmidi_stream_state* rx, uint8_t* frame, size_t bytes, uint8_t recover){
 	uint16_t length = 0;
 	size_t offset = 1, decode_time = 0, command_bytes = 0;
 	uint8_t midi_status = 0;
@@ -1096,6 +1631,11 @@ static int rtpmidi_parse(instance* inst, uint8_t* frame, size_t bytes){
 		return 1;
 	}
 
+	//after packet loss, restore the stream state from the journal before processing the commands
+	if(recover && rx && (frame[0] & RTPMIDI_COMMAND_JOURNAL)){
+		rtpmidi_journal_recover(inst, rx, frame + command_bytes, bytes - command_bytes);
+	}
+
 	if(frame[0] & 0x20){
 		decode_time = 1;
 	}
@@ -1192,6 +1732,19 @@ static int rtpmidi_parse(instance* inst, uint8_t* frame, size_t bytes){
 			}
 		}
 
+		//track the stream state for journal recovery
+		if(rx){
+			if(ident.fields.type == note){
+				rx->velocity[ident.fields.channel][ident.fields.control] = val.raw.u64;
+			}
+			else if(ident.fields.type == cc){
+				rx->control[ident.fields.channel][ident.fields.control] = val.raw.u64;
+			}
+			else if(ident.fields.type == pitchbend){
+				rx->pitch[ident.fields.channel] = val.raw.u64;
+			}
+		}
+
 		//push event
 		chan = mm_channel(inst, ident.label, 0);
 		if(chan){
@@ -1211,7 +1764,11 @@ static int rtpmidi_handle_data(instance* inst){
 	socklen_t sock_len = sizeof(sock_addr);
 	rtpmidi_header* rtp_header = (rtpmidi_header*) frame;
 	ssize_t bytes_recv = recvfrom(data->fd, frame, sizeof(frame), 0, (struct sockaddr*) &sock_addr, &sock_len);
-	size_t u;
+	rtpmidi_peer* peer = NULL;
+	uint8_t recover = 0;
+	uint16_t sequence;
+	int16_t delta;
+	size_t u, p;
 
 	//TODO receive until EAGAIN
 	if(bytes_recv < 0){
@@ -1233,26 +1790,55 @@ static int rtpmidi_handle_data(instance* inst){
 		return 0;
 	}
 
+	p = rtpmidi_find_peer(data, (struct sockaddr*) &sock_addr, sock_len);
+	if(p < data->peers){
+		peer = data->peer + p;
+		sequence = be16toh(rtp_header->sequence);
+
+		if(!peer->rx){
+			peer->rx = calloc(1, sizeof(rtpmidi_stream_state));
+			if(!peer->rx){
+				LOG("Failed to allocate memory");
+				return 1;
+			}
+			peer->rx_valid = 0;
+		}
+
+		delta = sequence - peer->rx_sequence;
+		if(!peer->rx_valid || peer->rx_ssrc != be32toh(rtp_header->ssrc)
+				|| delta <= -RTPMIDI_JOURNAL_DEPTH){
+			//new stream, reset the receive state
+			memset(peer->rx->velocity, 0, sizeof(peer->rx->velocity));
+			memset(peer->rx->control, 0xFF, sizeof(peer->rx->control));
+			for(u = 0; u < 16; u++){
+				peer->rx->pitch[u] = 0xFFFF;
+			}
+			peer->rx_valid = 1;
+			peer->rx_ssrc = be32toh(rtp_header->ssrc);
+		}
+		else if(delta <= 0){
+			DBGPF("Dropping duplicate or reordered packet %" PRIu16 " on %s", sequence, inst->name);
+			return 0;
+		}
+		else if(delta > 1){
+			LOGPF("Lost %d packets from peer on %s", delta - 1, inst->name);
+			recover = 1;
+		}
+
+		peer->rx_sequence = sequence;
+		peer->rx_reported = 0;
+	}
+
 	//parse data
-	if(rtpmidi_parse(inst, frame + sizeof(rtpmidi_header), bytes_recv - sizeof(rtpmidi_header))){
+	if(rtpmidi_parse(inst, peer ? peer->rx : NULL, frame + sizeof(rtpmidi_header), bytes_recv - sizeof(rtpmidi_header), recover)){
 		//returning errors here fails the core loop, so just return 0 to have some logging
 		return 0;
 	}
 
 	//try to learn peers
-	if(data->learn_peers){
-		for(u = 0; u < data->peers; u++){
-			if(data->peer[u].active
-					&& data->peer[u].dest_len == sock_len
-					&& !memcmp(&data->peer[u].dest, &sock_addr, sock_len)){
-				break;
-			}
-		}
-
-		if(u == data->peers){
-			LOGPF("Learned new peer on %s", inst->name);
-			return rtpmidi_push_peer(data, (struct sockaddr*) &sock_addr, sock_len, 1, 1, -1);
-		}
+	if(data->learn_peers && !peer){
+		LOGPF("Learned new peer on %s", inst->name);
+		return rtpmidi_push_peer(data, (struct sockaddr*) &sock_addr, sock_len, 1, 1, -1);
 	}
 	return 0;
 }
@@ -1475,13 +2061,17 @@ static int rtpmidi_service(){
 	struct sockaddr_storage control_peer;
 
 	//prepare commands
+	apple_journal_feedback feedback = {
+		.res1 = 0xFFFF,
+		.command = {'R', 'S'}
+	};
 	apple_sync_frame sync = {
 		.res1 = 0xFFFF,
 		.command = htobe16(apple_sync),
 		.ssrc = 0,
 		.count = 0,
 		.timestamp = {
-			mm_timestamp() * 10
+			htobe64(rtpmidi_clock())
 		}
 	};
 
@@ -1506,12 +2096,23 @@ static int rtpmidi_service(){
 					DBGPF("Instance %s initializing sync on peer %" PRIsize_t, inst[u]->name, p);
 					sync.ssrc = htobe32(data->ssrc);
 					//calculate remote control port from data port
-					memcpy(&control_peer, &(data->peer[u].dest), sizeof(control_peer));
+					memcpy(&control_peer, &(data->peer[p].dest), sizeof(control_peer));
 					((struct sockaddr_in*) &control_peer)->sin_port = htobe16(be16toh(((struct sockaddr_in*) &control_peer)->sin_port) - 1);
 
-					if(sendto(data->control_fd, (char*) &sync, sizeof(apple_sync_frame), 0, (struct sockaddr*) &control_peer, data->peer[u].dest_len) != sizeof(apple_sync_frame)){
+					if(sendto(data->control_fd, (char*) &sync, sizeof(apple_sync_frame), 0, (struct sockaddr*) &control_peer, data->peer[p].dest_len) != sizeof(apple_sync_frame)){
 						LOG("Failed to output sync frame");
 					}
+
+					//report the last received packet so the peer can trim its recovery journal
+					if(data->peer[p].rx_valid && !data->peer[p].rx_reported){
+						feedback.ssrc = htobe32(data->ssrc);
+						feedback.sequence = htobe32(((uint32_t) data->peer[p].rx_sequence) << 16);
+
+						if(sendto(data->control_fd, (char*) &feedback, sizeof(apple_journal_feedback), 0, (struct sockaddr*) &control_peer, data->peer[p].dest_len) != sizeof(apple_journal_feedback)){
+							LOG("Failed to output receiver feedback frame");
+						}
+						data->peer[p].rx_reported = 1;
+					}
 				}
 				else if(data->peer[p].active && !data->peer[p].learned && (mm_timestamp() / 1000) % 10 == 0){
 					//try to invite pre-defined unconnected applemidi peers
@@ -1847,6 +2448,14 @@ static int rtpmidi_start(size_t n, instance** inst){
 			data->ssrc = ((uint32_t) rand()) << 16 | rand();
 		}
 
+		if(data->journal){
+			data->journal_channel = calloc(16, sizeof(rtpmidi_journal_channel));
+			if(!data->journal_channel){
+				LOG("Failed to allocate memory");
+				return 1;
+			}
+		}
+
 		//if not bound, bind to default
 		if(data->fd < 0 && rtpmidi_bind_instance(inst[u], data, RTPMIDI_DEFAULT_HOST, NULL)){
 			LOGPF("Failed to bind default sockets for instance %s", inst[u]->name);
@@ -1905,10 +2514,16 @@ static int rtpmidi_shutdown(size_t n, instance** inst){
 		free(data->accept);
 		data->accept = NULL;
 
+		for(p = 0; p < data->peers; p++){
+			free(data->peer[p].rx);
+		}
 		free(data->peer);
 		data->peer = NULL;
 		data->peers = 0;
 
+		free(data->journal_channel);
+		data->journal_channel = NULL;
+
 		free(inst[u]->impl);
 		inst[u]->impl = NULL;
 	}
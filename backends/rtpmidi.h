@@ -26,6 +26,25 @@ static int rtpmidi_shutdown(size_t n, instance** inst);
 #define RTPMIDI_MDNS_DOMAIN "_apple-midi._udp.local."
 #define RTPMIDI_DNSSD_DOMAIN "_services._dns-sd._udp.local."
 #define RTPMIDI_ANNOUNCE_INTERVAL (60 * 1000)
+//RTP media clock rate, as used by AppleMIDI clock synchronization
+#define RTPMIDI_CLOCK_RATE 10000
+//maximum number of peers per sendmmsg call
+#define RTPMIDI_SEND_BATCH 32
+//minimum change (in clock ticks) of a peer's latency estimate to be logged
+#define RTPMIDI_LATENCY_REPORT 10
+//number of packets covered by the recovery journal when peers do not send receiver feedback
+#define RTPMIDI_JOURNAL_DEPTH 64
+//channel journal header, chapters C (128 logs), W and N (128 logs, 16 offbit octets)
+#define RTPMIDI_JOURNAL_CHANNEL_MAX (3 + 1 + 2 * 128 + 2 + 2 + 2 * 128 + 16)
+
+#define RTPMIDI_COMMAND_JOURNAL 0x40
+#define RTPMIDI_JOURNAL_SYSTEM 0x40
+#define RTPMIDI_JOURNAL_CHANNELS 0x20
+#define RTPMIDI_CHAPTER_P 0x80
+#define RTPMIDI_CHAPTER_C 0x40
+#define RTPMIDI_CHAPTER_M 0x20
+#define RTPMIDI_CHAPTER_W 0x10
+#define RTPMIDI_CHAPTER_N 0x08
 
 #define DNS_POINTER(a) (((a) & 0xC0) == 0xC0)
 #define DNS_LABEL_LENGTH(a) ((a) & 0x3F)
@@ -65,6 +84,33 @@ typedef union {
 	uint64_t label;
 } rtpmidi_channel_ident;
 
+//receiver-side stream state, used to detect which journal entries need to be applied
+typedef struct /*_rtpmidi_stream_state*/ {
+	uint8_t velocity[16][128];
+	//0xFF for unknown values
+	uint8_t control[16][128];
+	//0xFFFF for unknown values
+	uint16_t pitch[16];
+} rtpmidi_stream_state;
+
+//sender-side recovery journal state for one MIDI channel
+typedef struct /*_rtpmidi_journal_channel*/ {
+	uint8_t velocity[128];
+	uint8_t control[128];
+	uint16_t pitch;
+
+	//extended sequence number of the packet carrying the last change, 0 if not journalled
+	uint64_t note_sequence[128];
+	uint64_t control_sequence[128];
+	uint64_t pitch_sequence;
+
+	//cached encoding, only rebuilt when the channel state or the checkpoint changes
+	uint8_t dirty;
+	uint64_t oldest;
+	size_t length;
+	uint8_t encoded[RTPMIDI_JOURNAL_CHANNEL_MAX];
+} rtpmidi_journal_channel;
+
 typedef struct /*_rtpmidi_peer*/ {
 	struct sockaddr_storage dest;
 	socklen_t dest_len;
@@ -73,6 +119,22 @@ typedef struct /*_rtpmidi_peer*/ {
 	uint8_t learned; //learned / configured peer (learned peers are marked inactive on session shutdown)
 	uint8_t connected; //currently in active session
 	ssize_t invite; //invite-list index for apple-mode learned peers (used to track ipv6/ipv4 overlapping invitations)
+
+	//extended sequence number of the last packet confirmed via receiver feedback
+	uint64_t acknowledged;
+
+	//receive state for loss detection and journal recovery
+	uint8_t rx_valid;
+	uint8_t rx_reported;
+	uint32_t rx_ssrc;
+	uint16_t rx_sequence;
+	rtpmidi_stream_state* rx;
+
+	//clock synchronization state, in RTPMIDI_CLOCK_RATE ticks
+	uint8_t synchronized;
+	uint64_t latency;
+	uint64_t latency_reported;
+	int64_t clock_offset; //remote clock - local clock
 } rtpmidi_peer;
 
 typedef struct /*_rtpmidi_instance_data*/ {
@@ -87,6 +149,12 @@ typedef struct /*_rtpmidi_instance_data*/ {
 	uint32_t ssrc;
 	uint16_t sequence;
 
+	//recovery journal
+	uint8_t journal;
+	uint64_t packets;
+	uint64_t checkpoint;
+	rtpmidi_journal_channel* journal_channel;
+
 	uint8_t epn_tx_short;
 	uint16_t epn_control[16];
 	uint16_t epn_value[16];
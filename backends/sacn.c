@@ -10,6 +10,8 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <poll.h>
+#include <time.h>
 #endif
 
 #include "libmmbackend.h"
@@ -28,18 +30,33 @@ static struct /*_sacn_global_config*/ {
 	size_t fds;
 	sacn_fd* fd;
 	uint64_t last_announce;
-	uint32_t next_frame;
+	size_t timers;
+	sacn_output_universe** timer;
+	uint8_t sync_pending;
 	uint8_t detect;
+	uint8_t workers_running;
+	int wake[2];
+	int control[2];
 } global_cfg = {
 	.source_name = "MIDIMonster",
 	.cid = {'M', 'I', 'D', 'I', 'M', 'o', 'n', 's', 't', 'e', 'r'},
 	.fds = 0,
 	.fd = NULL,
 	.last_announce = 0,
-	.next_frame = 0,
-	.detect = 0
+	.timers = 0,
+	.timer = NULL,
+	.sync_pending = 0,
+	.detect = 0,
+	.workers_running = 0,
+	.wake = {-1, -1},
+	.control = {-1, -1}
 };
 
+#ifdef SACN_WORKERS
+//set in worker threads to redirect generated events into the worker queue
+static _Thread_local sacn_worker* worker_context = NULL;
+#endif
+
 MM_PLUGIN_API int init(){
 	backend sacn = {
 		.name = BACKEND_NAME,
@@ -68,40 +85,156 @@ MM_PLUGIN_API int init(){
 	return 0;
 }
 
+//the core timestamp only advances with the main loop, workers read their own clock
+static uint64_t sacn_clock(){
+	#ifdef SACN_WORKERS
+	struct timespec current;
+
+	if(worker_context && !clock_gettime(CLOCK_MONOTONIC_COARSE, &current)){
+		return current.tv_sec * 1000 + current.tv_nsec / 1000000;
+	}
+	#endif
+	return mm_timestamp();
+}
+
 static uint32_t sacn_interval(){
-	if(global_cfg.next_frame){
-		return global_cfg.next_frame;
+	uint64_t timestamp = mm_timestamp(), next_deadline;
+
+	//flush pending synchronization packets as soon as possible
+	if(global_cfg.sync_pending){
+		return 1;
+	}
+
+	if(!global_cfg.timers){
+		return SACN_KEEPALIVE_INTERVAL;
 	}
-	return SACN_KEEPALIVE_INTERVAL;
+
+	next_deadline = min(global_cfg.timer[0]->deadline, global_cfg.last_announce + SACN_DISCOVERY_TIMEOUT + 1);
+	return (next_deadline > timestamp) ? (next_deadline - timestamp) : 1;
+}
+
+static void sacn_timer_swap(size_t a, size_t b){
+	sacn_output_universe* xchg = global_cfg.timer[a];
+
+	global_cfg.timer[a] = global_cfg.timer[b];
+	global_cfg.timer[b] = xchg;
+	global_cfg.timer[a]->timer = a;
+	global_cfg.timer[b]->timer = b;
 }
 
-static int sacn_listener(char* host, char* port, uint8_t flags){
+//update the deadline of an output universe, restoring the min-heap property of the timer list
+static void sacn_schedule(sacn_output_universe* output, uint64_t deadline){
+	size_t u = output->timer, child;
+
+	output->deadline = deadline;
+
+	//sift up
+	while(u && global_cfg.timer[(u - 1) / 2]->deadline > deadline){
+		sacn_timer_swap(u, (u - 1) / 2);
+		u = (u - 1) / 2;
+	}
+
+	//sift down
+	for(child = 2 * u + 1; child < global_cfg.timers; child = 2 * u + 1){
+		if(child + 1 < global_cfg.timers && global_cfg.timer[child + 1]->deadline < global_cfg.timer[child]->deadline){
+			child++;
+		}
+
+		if(global_cfg.timer[child]->deadline >= deadline){
+			break;
+		}
+
+		sacn_timer_swap(u, child);
+		u = child;
+	}
+}
+
+static int sacn_listener(char* host, char* port, uint8_t flags, size_t workers){
 	int fd = -1, yes = 1;
+	size_t u;
+	sacn_worker* worker = NULL;
+
 	if(global_cfg.fds >= MAX_FDS){
 		LOG("Descriptor limit reached");
 		return -1;
 	}
 
-	fd = mmbackend_socket(host, port, SOCK_DGRAM, 1, 1, 1);
-	if(fd < 0){
+	if(workers > 1){
+		#ifdef SACN_WORKERS
+		worker = calloc(workers, sizeof(sacn_worker));
+		if(!worker){
+			LOG("Failed to allocate memory");
+			return -1;
+		}
+
+		//create one load-balanced socket per worker, each only receiving the multicast groups joined on it
+		yes = 0;
+		for(u = 0; u < workers; u++){
+			worker[u].fd_index = global_cfg.fds;
+			worker[u].fd = mmbackend_socket(host, port, SOCK_DGRAM, 2, 1, 1);
+			if(worker[u].fd < 0
+					|| setsockopt(worker[u].fd, IPPROTO_IP, IP_MULTICAST_ALL, (void*) &yes, sizeof(yes)) < 0){
+				LOGPF("Failed to create worker socket %" PRIsize_t " for %s port %s", u, host, port);
+				if(worker[u].fd >= 0){
+					close(worker[u].fd);
+				}
+				while(u--){
+					close(worker[u].fd);
+				}
+				free(worker);
+				return -1;
+			}
+		}
+		fd = worker[0].fd;
+		#else
+		LOG("Sharded input is not supported on this platform");
 		return -1;
+		#endif
+	}
+	else{
+		fd = mmbackend_socket(host, port, SOCK_DGRAM, 1, 1, 1);
+		if(fd < 0){
+			return -1;
+		}
+		workers = 0;
 	}
 
 	//store fd
 	global_cfg.fd = realloc(global_cfg.fd, (global_cfg.fds + 1) * sizeof(sacn_fd));
 	if(!global_cfg.fd){
-		close(fd);
+		//fd is the first worker socket when sharding
+		for(u = 0; u < workers; u++){
+			close(worker[u].fd);
+		}
+		free(worker);
+		if(!workers){
+			close(fd);
+		}
 		LOG("Failed to allocate memory");
 		return -1;
 	}
 
-	LOGPF("Socket %" PRIsize_t " bound to %s port %s", global_cfg.fds, host, port);
+	if(workers){
+		LOGPF("Socket %" PRIsize_t " bound to %s port %s with %" PRIsize_t " workers", global_cfg.fds, host, port, workers);
+	}
+	else{
+		LOGPF("Socket %" PRIsize_t " bound to %s port %s", global_cfg.fds, host, port);
+	}
 	global_cfg.fd[global_cfg.fds].fd = fd;
+	global_cfg.fd[global_cfg.fds].workers = workers;
+	global_cfg.fd[global_cfg.fds].worker = worker;
+	global_cfg.fd[global_cfg.fds].inputs = 0;
+	global_cfg.fd[global_cfg.fds].input = NULL;
 	global_cfg.fd[global_cfg.fds].universes = 0;
 	global_cfg.fd[global_cfg.fds].universe = NULL;
+	global_cfg.fd[global_cfg.fds].syncs = 0;
+	global_cfg.fd[global_cfg.fds].sync = NULL;
+	global_cfg.fd[global_cfg.fds].discovery_pages = 0;
+	global_cfg.fd[global_cfg.fds].discovery = NULL;
 
 	if(flags & mcast_loop){
 		//set IP_MCAST_LOOP to allow local applications to receive output
+		yes = 1;
 		if(setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, (void*)&yes, sizeof(yes)) < 0){
 			LOGPF("Failed to re-enable IP_MULTICAST_LOOP on socket: %s", mmbackend_socket_strerror(errno));
 		}
@@ -114,7 +247,7 @@ static int sacn_listener(char* host, char* port, uint8_t flags){
 static int sacn_configure(char* option, char* value){
 	char* host = NULL, *port = NULL, *next = NULL;
 	uint8_t flags = 0;
-	size_t u;
+	size_t u, workers = 0;
 
 	if(!strcmp(option, "name")){
 		if(strlen(value) > 63){
@@ -156,10 +289,17 @@ static int sacn_configure(char* option, char* value){
 				if(!strcmp(next, "local")){
 					flags |= mcast_loop;
 				}
+				else if(!strncmp(next, "workers=", 8)){
+					workers = strtoul(next + 8, NULL, 10);
+					if(!workers || workers > SACN_MAX_WORKERS){
+						LOGPF("Invalid worker count %s, must be between 1 and %d", next + 8, SACN_MAX_WORKERS);
+						return 1;
+					}
+				}
 			}
 		}
 
-		if(sacn_listener(host, port ? port : SACN_PORT, flags)){
+		if(sacn_listener(host, port ? port : SACN_PORT, flags, workers)){
 			LOGPF("Failed to bind socket: %s", value);
 			return 1;
 		}
@@ -193,6 +333,10 @@ static int sacn_configure_instance(instance* inst, char* option, char* value){
 		data->xmit_prio = strtoul(value, NULL, 10);
 		return 0;
 	}
+	else if(!strcmp(option, "sync")){
+		data->xmit_sync = strtoul(value, NULL, 10);
+		return 0;
+	}
 	else if(!strcmp(option, "destination")){
 		mmbackend_parse_hostspec(value, &host, &port, NULL);
 
@@ -220,6 +364,21 @@ static int sacn_configure_instance(instance* inst, char* option, char* value){
 		data->realtime = strtoul(value, NULL, 10);
 		return 0;
 	}
+	else if(!strcmp(option, "full-frames")){
+		data->full_frames = strtoul(value, NULL, 10);
+		return 0;
+	}
+	else if(!strcmp(option, "merge")){
+		data->merge = 0;
+		if(!strcmp(value, "htp")){
+			data->merge = 1;
+		}
+		else if(strcmp(value, "off")){
+			LOGPF("Unknown merge mode %s on instance %s", value, inst->name);
+			return 1;
+		}
+		return 0;
+	}
 
 	LOGPF("Unknown instance configuration option %s for instance %s", option, inst->name);
 	return 1;
@@ -239,6 +398,14 @@ static int sacn_instance(instance* inst){
 		data->data.channel[u].instance = inst;
 	}
 
+	#ifdef SACN_WORKERS
+	if(pthread_mutex_init(&data->lock, NULL)){
+		LOG("Failed to initialize instance mutex");
+		free(data);
+		return 1;
+	}
+	#endif
+
 	inst->impl = data;
 	return 0;
 }
@@ -261,6 +428,11 @@ static channel* sacn_channel(instance* inst, char* spec, uint8_t flags){
 		LOGPF("Channel %s.%s mapped for output, but instance is not configured for output (no priority set)", inst->name, spec);
 	}
 
+	//track the highest slot used for output to trim transmitted frames
+	if((flags & mmchannel_output) && data->data.out_len <= chan_a){
+		data->data.out_len = chan_a + 1;
+	}
+
 	//if wide channel, mark fine
 	if(*spec_next == '+'){
 		chan_b = strtoul(spec_next + 1, NULL, 10);
@@ -270,6 +442,10 @@ static channel* sacn_channel(instance* inst, char* spec, uint8_t flags){
 		}
 		chan_b--;
 
+		if((flags & mmchannel_output) && data->data.out_len <= chan_b){
+			data->data.out_len = chan_b + 1;
+		}
+
 		//if already mapped, bail
 		if(IS_ACTIVE(data->data.map[chan_b]) && data->data.map[chan_b] != (MAP_FINE | chan_a)){
 			LOGPF("Fine channel %u already mapped on instance %s", chan_b, inst->name);
@@ -294,6 +470,8 @@ static channel* sacn_channel(instance* inst, char* spec, uint8_t flags){
 
 static int sacn_transmit(instance* inst, sacn_output_universe* output){
 	sacn_instance_data* data = (sacn_instance_data*) inst->impl;
+	//number of dmx slots to transmit, excluding the start code
+	uint16_t slots = data->full_frames ? 512 : data->data.out_len;
 
 	//build sacn frame
 	sacn_data_pdu pdu = {
@@ -301,25 +479,25 @@ static int sacn_transmit(instance* inst, sacn_output_universe* output){
 			.preamble_size = htobe16(0x10),
 			.postamble_size = 0,
 			.magic = { 0 }, //memcpy'd
-			.flags = htobe16(0x7000 | 0x026e),
+			.flags = htobe16(0x7000 | (0x006e + slots)),
 			.vector = htobe32(ROOT_E131_DATA),
 			.sender_cid = { 0 }, //memcpy'd
-			.frame_flags = htobe16(0x7000 | 0x0258),
+			.frame_flags = htobe16(0x7000 | (0x0058 + slots)),
 			.frame_vector = htobe32(FRAME_E131_DATA)
 		},
 		.data = {
 			.source_name = "", //memcpy'd
 			.priority = data->xmit_prio,
-			.sync_addr = 0,
+			.sync_addr = htobe16(data->xmit_sync),
 			.sequence = data->data.last_seq++,
 			.options = 0,
 			.universe = htobe16(data->uni),
-			.flags = htobe16(0x7000 | 0x0205),
+			.flags = htobe16(0x7000 | (0x000b + slots)),
 			.vector = DMP_SET_PROPERTY,
 			.format = 0xA1,
 			.startcode_offset = 0,
 			.address_increment = htobe16(1),
-			.channels = htobe16(513),
+			.channels = htobe16(slots + 1),
 			.data = { 0 } //memcpy'd
 		}
 	};
@@ -327,29 +505,35 @@ static int sacn_transmit(instance* inst, sacn_output_universe* output){
 	memcpy(pdu.root.magic, SACN_PDU_MAGIC, sizeof(pdu.root.magic));
 	memcpy(pdu.root.sender_cid, global_cfg.cid, sizeof(pdu.root.sender_cid));
 	memcpy(pdu.data.source_name, global_cfg.source_name, sizeof(pdu.data.source_name));
-	memcpy((((uint8_t*)pdu.data.data) + 1), data->data.out, 512);
+	memcpy((((uint8_t*)pdu.data.data) + 1), data->data.out, slots);
 
-	if(sendto(global_cfg.fd[data->fd_index].fd, (uint8_t*) &pdu, sizeof(pdu), 0, (struct sockaddr*) &data->dest_addr, data->dest_len) < 0){
+	if(sendto(global_cfg.fd[data->fd_index].fd, (uint8_t*) &pdu, sizeof(pdu) - (512 - slots), 0, (struct sockaddr*) &data->dest_addr, data->dest_len) < 0){
 		#ifdef _WIN32
 		if(WSAGetLastError() != WSAEWOULDBLOCK){
 		#else
 		if(errno != EAGAIN){
 		#endif
 			LOGPF("Failed to output frame for instance %s: %s", inst->name, mmbackend_socket_strerror(errno));
+			sacn_schedule(output, mm_timestamp() + SACN_KEEPALIVE_INTERVAL);
 			return 1;
 		}
 
 		//reschedule output
 		output->mark = 1;
-		if(!global_cfg.next_frame || global_cfg.next_frame > SACN_SYNTHESIZE_MARGIN){
-			global_cfg.next_frame = SACN_SYNTHESIZE_MARGIN;
-		}
+		sacn_schedule(output, mm_timestamp() + SACN_SYNTHESIZE_MARGIN);
 		return 0;
 	}
 
 	//update last transmit timestamp, unmark instance
 	output->last_frame = mm_timestamp();
 	output->mark = 0;
+	sacn_schedule(output, output->last_frame + SACN_KEEPALIVE_INTERVAL);
+
+	//request a synchronization packet to be sent after all universes have been updated
+	if(data->xmit_sync){
+		global_cfg.fd[data->fd_index].sync[output->sync].mark = 1;
+		global_cfg.sync_pending = 1;
+	}
 	return 0;
 }
 
@@ -357,6 +541,7 @@ static int sacn_set(instance* inst, size_t num, channel** c, channel_value* v){
 	size_t u, mark = 0;
 	uint32_t frame_delta = 0;
 	sacn_instance_data* data = (sacn_instance_data*) inst->impl;
+	sacn_output_universe* output = NULL;
 
 	if(!data->xmit_prio){
 		LOGPF("Instance %s not enabled for output (%" PRIsize_t " channel events)", inst->name, num);
@@ -395,11 +580,12 @@ static int sacn_set(instance* inst, size_t num, channel** c, channel_value* v){
 		if(!data->realtime){
 			frame_delta = mm_timestamp() - global_cfg.fd[data->fd_index].universe[u].last_frame;
 
-			//check if ratelimiting engaged
+			//check if ratelimiting engaged, schedule synthesized frame
 			if(frame_delta < SACN_FRAME_TIMEOUT){
-				global_cfg.fd[data->fd_index].universe[u].mark = 1;
-				if(!global_cfg.next_frame || global_cfg.next_frame > (SACN_FRAME_TIMEOUT - frame_delta)){
-					global_cfg.next_frame = (SACN_FRAME_TIMEOUT - frame_delta);
+				output = global_cfg.fd[data->fd_index].universe + u;
+				output->mark = 1;
+				if(output->deadline > output->last_frame + SACN_FRAME_TIMEOUT + SACN_SYNTHESIZE_MARGIN){
+					sacn_schedule(output, output->last_frame + SACN_FRAME_TIMEOUT + SACN_SYNTHESIZE_MARGIN);
 				}
 				return 0;
 			}
@@ -410,54 +596,237 @@ static int sacn_set(instance* inst, size_t num, channel** c, channel_value* v){
 	return 0;
 }
 
-static int sacn_process_frame(instance* inst, sacn_frame_root* frame, sacn_frame_data* data){
-	size_t u, max_mark = 0;
-	channel* chan = NULL;
-	channel_value val;
+//multicast input for a universe is assigned to a fixed worker socket if the descriptor is sharded
+static int sacn_universe_socket(size_t fd, uint16_t universe){
+	if(global_cfg.fd[fd].workers){
+		return global_cfg.fd[fd].worker[universe % global_cfg.fd[fd].workers].fd;
+	}
+	return global_cfg.fd[fd].fd;
+}
+
+static int sacn_join_multicast(instance* inst, uint16_t universe){
+	sacn_instance_data* data = (sacn_instance_data*) inst->impl;
+	int fd = sacn_universe_socket(data->fd_index, universe);
+	struct sockaddr_storage bound_name = {
+		0
+	};
+	char mcast_ifaddr[INET_ADDRSTRLEN] = "";
+
+	#ifdef _WIN32
+	struct ip_mreq mcast_req = {
+		.imr_interface.s_addr = INADDR_ANY,
+	#else
+	struct ip_mreqn mcast_req = {
+		.imr_address.s_addr = INADDR_ANY,
+	#endif
+		.imr_multiaddr.s_addr = htobe32(((uint32_t) 0xefff0000) | ((uint32_t) universe))
+	};
+	socklen_t bound_length = sizeof(bound_name);
+
+	//select the specific interface to join the mcast group on based on the bind address
+	if(getsockname(fd, (struct sockaddr*) &bound_name, &bound_length)){
+		LOGPF("Failed to read back local bind address on socket %" PRIsize_t, data->fd_index);
+		return 1;
+	}
+	else if(bound_name.ss_family != AF_INET || !((struct sockaddr_in*) &bound_name)->sin_addr.s_addr){
+		LOGPF("Socket %" PRIsize_t " not bound to a specific IPv4 address, joining multicast input group for instance %s (universe %u) on default interface", data->fd_index, inst->name, universe);
+	}
+	else{
+		//this relies on the previous check for the socket family (AF_INET / IPv4)
+		#ifdef _WIN32
+		mcast_req.imr_interface = ((struct sockaddr_in*) &bound_name)->sin_addr;
+		#else
+		mcast_req.imr_address = ((struct sockaddr_in*) &bound_name)->sin_addr;
+		#endif
+
+		mmbackend_sockaddr_ntop((struct sockaddr*) &bound_name, mcast_ifaddr, sizeof(mcast_ifaddr));
+		LOGPF("Joining multicast input group for instance %s (universe %u) on interface for socket %" PRIsize_t " (%s)", inst->name, universe, data->fd_index, mcast_ifaddr);
+	}
+
+	//the group may already have been joined on this socket by another instance (e.g. for synchronization)
+	if(setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (uint8_t*) &mcast_req, sizeof(mcast_req))
+			#ifdef _WIN32
+			&& WSAGetLastError() != WSAEADDRINUSE){
+			#else
+			&& errno != EADDRINUSE){
+			#endif
+		LOGPF("Failed to join Multicast group for universe %u on instance %s: %s", universe, inst->name, mmbackend_socket_strerror(errno));
+	}
+
+	return 0;
+}
+
+static sacn_source* sacn_source_update(instance* inst, sacn_frame_root* frame, sacn_frame_data* data){
+	size_t u, slots = be16toh(data->channels) - 1;
+	uint64_t timestamp = sacn_clock();
 	sacn_instance_data* inst_data = (sacn_instance_data*) inst->impl;
+	sacn_source* source = NULL;
+	int8_t sequence_delta;
 
-	//source filtering
-	if(inst_data->filter_enabled && memcmp(inst_data->cid_filter, frame->sender_cid, 16)){
-		if(global_cfg.detect > 1){
-			LOGPF("Discarding data for instance %s due to source filter rule", inst->name);
+	for(u = 0; u < inst_data->data.sources; u++){
+		if(!memcmp(inst_data->data.source[u].cid, frame->sender_cid, 16)){
+			source = inst_data->data.source + u;
+			break;
 		}
-		return 0;
 	}
 
-	if(data->format != 0xa1
-			|| data->startcode_offset
-			|| be16toh(data->address_increment) != 1){
-		LOGPF("Framing not supported for incoming data on instance %s\n", inst->name);
-		return 1;
+	if(source){
+		//discard out-of-order frames
+		sequence_delta = data->sequence - source->sequence;
+		if(sequence_delta <= 0 && sequence_delta > -SACN_SEQUENCE_WINDOW){
+			if(global_cfg.detect > 1){
+				LOGPF("Discarding out-of-order frame from source %.*s on instance %s", 64, data->source_name, inst->name);
+			}
+			return NULL;
+		}
 	}
+	else{
+		if(inst_data->data.sources >= SACN_MAX_SOURCES){
+			if(global_cfg.detect){
+				LOGPF("Source limit reached on instance %s, ignoring source %.*s", inst->name, 64, data->source_name);
+			}
+			return NULL;
+		}
 
-	if(be16toh(data->channels) > 513){
-		LOGPF("Invalid frame channel count %d on instance %s", be16toh(data->channels), inst->name);
-		return 1;
+		inst_data->data.source = realloc(inst_data->data.source, (inst_data->data.sources + 1) * sizeof(sacn_source));
+		if(!inst_data->data.source){
+			inst_data->data.sources = 0;
+			LOG("Failed to allocate memory");
+			return NULL;
+		}
+
+		source = inst_data->data.source + inst_data->data.sources;
+		inst_data->data.sources++;
+		memcpy(source->cid, frame->sender_cid, sizeof(source->cid));
+
+		if(global_cfg.detect){
+			LOGPF("New source %.*s on instance %s (Universe %u), priority %d", 64, data->source_name, inst->name, inst_data->uni, data->priority);
+		}
 	}
 
-	//handle source priority (currently a 1-bit counter)
-	if(inst_data->data.last_priority > data->priority){
-		if(global_cfg.detect > 1){
-			LOGPF("Ignoring lower-priority (%d) source on %s, current source is %d", data->priority, inst->name, inst_data->data.last_priority);
+	source->priority = data->priority;
+	source->sequence = data->sequence;
+	source->last_seen = timestamp;
+
+	//slots not transmitted by a source do not contribute to the output
+	memcpy(source->data, data->data + 1, slots);
+	memset(source->data + slots, 0, sizeof(source->data) - slots);
+	return source;
+}
+
+static size_t sacn_source_expire(sacn_universe* universe, sacn_source* terminated){
+	size_t u, n = 0;
+	uint64_t timestamp = sacn_clock();
+
+	for(u = 0; u < universe->sources; u++){
+		if(universe->source + u == terminated
+				|| timestamp - universe->source[u].last_seen > SACN_SOURCE_TIMEOUT){
+			continue;
 		}
-		inst_data->data.last_priority = data->priority;
-		return 0;
+
+		if(n != u){
+			universe->source[n] = universe->source[u];
+		}
+		n++;
 	}
-	inst_data->data.last_priority = data->priority;
 
-	if(!inst_data->last_input && global_cfg.detect){
-		LOGPF("Valid data on instance %s (Universe %u): Source name %.*s, priority %d", inst->name, inst_data->uni, 64, data->source_name, data->priority);
+	u = universe->sources - n;
+	universe->sources = n;
+	return u;
+}
+
+static void sacn_merge_htp(uint8_t* dest, uint8_t* src){
+	size_t u;
+	sacn_simd* a, *b, mask;
+
+	//branchless per-slot maximum, compiled to vector instructions where available
+	for(u = 0; u < 512; u += sizeof(sacn_simd)){
+		a = (sacn_simd*) (dest + u);
+		b = (sacn_simd*) (src + u);
+		mask = (sacn_simd) (*a > *b);
+		*a = (*a & mask) | (*b & ~mask);
 	}
-	inst_data->last_input = mm_timestamp();
+}
 
-	//read data (except start code), mark changed channels
-	for(u = 1; u < be16toh(data->channels); u++){
-		if(IS_ACTIVE(inst_data->data.map[u - 1])
-				&& data->data[u] != inst_data->data.in[u - 1]){
-			inst_data->data.in[u - 1] = data->data[u];
-			inst_data->data.map[u - 1] |= MAP_MARK;
-			max_mark = u - 1;
+static uint8_t* sacn_select_input(sacn_instance_data* inst_data, uint8_t* merge_buffer, uint8_t* max_priority, size_t* merged){
+	size_t u;
+	uint8_t* input = NULL;
+
+	//priority arbitration
+	*max_priority = 0;
+	*merged = 0;
+	for(u = 0; u < inst_data->data.sources; u++){
+		*max_priority = max(*max_priority, inst_data->data.source[u].priority);
+	}
+
+	//the first (longest-running) source at the highest priority wins, optionally merging all other sources at that priority
+	for(u = 0; u < inst_data->data.sources; u++){
+		if(inst_data->data.source[u].priority != *max_priority){
+			continue;
+		}
+
+		if(!input){
+			input = inst_data->data.source[u].data;
+			if(!inst_data->merge){
+				break;
+			}
+		}
+		else{
+			if(!*merged){
+				memcpy(merge_buffer, input, 512);
+				input = merge_buffer;
+			}
+			sacn_merge_htp(merge_buffer, inst_data->data.source[u].data);
+			(*merged)++;
+		}
+	}
+
+	return input;
+}
+
+static void sacn_wake(){
+	#ifndef _WIN32
+	//the pipe being full already guarantees a wakeup
+	if(write(global_cfg.wake[1], "w", 1) < 0 && errno != EAGAIN){
+		LOGPF("Failed to wake main thread: %s", strerror(errno));
+	}
+	#endif
+}
+
+static int sacn_event(instance* inst, channel* chan, channel_value val){
+	#ifdef SACN_WORKERS
+	sacn_instance_data* inst_data = (sacn_instance_data*) inst->impl;
+	sacn_worker_event event = {
+		.chan = chan,
+		.value = val
+	};
+
+	if(worker_context){
+		//input for one universe may arrive on any worker, the instance queue keeps the events in processing order
+		//the caller holds the instance lock, so never wait for the core here
+		if(mmbackend_ring_push(&inst_data->queue, &event)){
+			__atomic_add_fetch(&inst_data->overflow, 1, __ATOMIC_RELAXED);
+		}
+		worker_context->pending = 1;
+		return 0;
+	}
+	#endif
+	return mm_channel_event(chan, val);
+}
+
+static int sacn_emit(instance* inst, uint8_t* input){
+	size_t u, max_mark = 0;
+	channel* chan = NULL;
+	channel_value val;
+	sacn_instance_data* inst_data = (sacn_instance_data*) inst->impl;
+
+	//read data, mark changed channels
+	for(u = 0; u < 512; u++){
+		if(IS_ACTIVE(inst_data->data.map[u])
+				&& input[u] != inst_data->data.in[u]){
+			inst_data->data.in[u] = input[u];
+			inst_data->data.map[u] |= MAP_MARK;
+			max_mark = u;
 		}
 	}
 
@@ -483,7 +852,7 @@ static int sacn_process_frame(instance* inst, sacn_frame_root* frame, sacn_frame
 				val.normalised = (double) val.raw.u64 / 255.0;
 			}
 
-			if(mm_channel_event(chan, val)){
+			if(sacn_event(inst, chan, val)){
 				LOG("Failed to push event to core");
 				return 1;
 			}
@@ -492,143 +861,392 @@ static int sacn_process_frame(instance* inst, sacn_frame_root* frame, sacn_frame
 	return 0;
 }
 
+static int sacn_process_frame(instance* inst, sacn_frame_root* frame, sacn_frame_data* data){
+	size_t expired = 0, merged = 0;
+	uint8_t max_priority = 0, merge_buffer[512];
+	uint8_t* input = NULL;
+	sacn_instance_data* inst_data = (sacn_instance_data*) inst->impl;
+	sacn_source* source = NULL;
+
+	//source filtering
+	if(inst_data->filter_enabled && memcmp(inst_data->cid_filter, frame->sender_cid, 16)){
+		if(global_cfg.detect > 1){
+			LOGPF("Discarding data for instance %s due to source filter rule", inst->name);
+		}
+		return 0;
+	}
+
+	if(data->format != 0xa1
+			|| data->startcode_offset
+			|| be16toh(data->address_increment) != 1){
+		LOGPF("Framing not supported for incoming data on instance %s\n", inst->name);
+		return 1;
+	}
+
+	if(!be16toh(data->channels) || be16toh(data->channels) > 513){
+		LOGPF("Invalid frame channel count %d on instance %s", be16toh(data->channels), inst->name);
+		return 1;
+	}
+
+	//ignore preview data and alternate start codes
+	if((data->options & OPTION_PREVIEW) || data->data[0]){
+		return 0;
+	}
+
+	//drop timed out sources before updating the sending source
+	expired = sacn_source_expire(&inst_data->data, NULL);
+	source = sacn_source_update(inst, frame, data);
+	if(source && (data->options & OPTION_TERMINATED)){
+		if(global_cfg.detect){
+			LOGPF("Source %.*s terminated its stream on instance %s", 64, data->source_name, inst->name);
+		}
+		expired += sacn_source_expire(&inst_data->data, source);
+		source = NULL;
+	}
+
+	if((!source && !expired) || !inst_data->data.sources){
+		return 0;
+	}
+
+	input = sacn_select_input(inst_data, merge_buffer, &max_priority, &merged);
+
+	//if nothing changed in the set of winning sources, skip the update
+	if(!expired && (!source || source->priority < max_priority || (!merged && input != source->data))){
+		if(source && global_cfg.detect > 1){
+			LOGPF("Ignoring source %.*s (priority %d) on instance %s, active priority is %d", 64, data->source_name, source->priority, inst->name, max_priority);
+		}
+		return 0;
+	}
+
+	if(!inst_data->last_input && global_cfg.detect){
+		LOGPF("Valid data on instance %s (Universe %u): Source name %.*s, priority %d", inst->name, inst_data->uni, 64, data->source_name, data->priority);
+	}
+	inst_data->last_input = sacn_clock();
+
+	if(source){
+		if(be16toh(data->sync_addr) != inst_data->data.sync_addr){
+			inst_data->data.sync_addr = be16toh(data->sync_addr);
+			inst_data->data.last_sync = 0;
+			if(inst_data->data.sync_addr && !inst_data->unicast_input){
+				sacn_join_multicast(inst, inst_data->data.sync_addr);
+			}
+		}
+
+		//hold synchronized data until the next synchronization packet, unless synchronization was lost
+		if(inst_data->data.sync_addr
+				&& inst_data->data.last_sync
+				&& inst_data->last_input - inst_data->data.last_sync <= SACN_SOURCE_TIMEOUT){
+			inst_data->data.sync_pending = 1;
+			return 0;
+		}
+	}
+
+	inst_data->data.sync_pending = 0;
+	return sacn_emit(inst, input);
+}
+
+//the instance tables are built in sacn_start and not modified afterwards, so workers may use them without locking
+static instance* sacn_find_instance(size_t fd, uint16_t universe){
+	size_t lower = 0, upper = global_cfg.fd[fd].inputs, pivot;
+	sacn_instance_data* data = NULL;
+
+	while(lower < upper){
+		pivot = lower + (upper - lower) / 2;
+		data = (sacn_instance_data*) global_cfg.fd[fd].input[pivot]->impl;
+		if(data->uni == universe){
+			return global_cfg.fd[fd].input[pivot];
+		}
+		else if(data->uni < universe){
+			lower = pivot + 1;
+		}
+		else{
+			upper = pivot;
+		}
+	}
+	return NULL;
+}
+
+static int sacn_process_sync(size_t fd, uint16_t sync_addr){
+	size_t u, merged = 0;
+	int rv = 0;
+	uint8_t max_priority = 0, merge_buffer[512];
+	uint8_t* input = NULL;
+	instance** instances = global_cfg.fd[fd].input;
+	sacn_instance_data* data = NULL;
+
+	//release all universes waiting for this synchronization address at once
+	for(u = 0; u < global_cfg.fd[fd].inputs && !rv; u++){
+		data = (sacn_instance_data*) instances[u]->impl;
+		if(data->data.sync_addr != sync_addr){
+			continue;
+		}
+
+		#ifdef SACN_WORKERS
+		pthread_mutex_lock(&data->lock);
+		#endif
+		data->data.last_sync = sacn_clock();
+		if(data->data.sync_pending){
+			data->data.sync_pending = 0;
+			input = sacn_select_input(data, merge_buffer, &max_priority, &merged);
+			if(input){
+				rv = sacn_emit(instances[u], input);
+			}
+		}
+		#ifdef SACN_WORKERS
+		pthread_mutex_unlock(&data->lock);
+		#endif
+	}
+
+	return rv;
+}
+
 static void sacn_discovery(size_t fd){
-	size_t page = 0, pages = (global_cfg.fd[fd].universes / 512) + 1, universes;
+	size_t page;
 	struct sockaddr_in discovery_dest = {
 		.sin_family = AF_INET,
 		.sin_port = htobe16(strtoul(SACN_PORT, NULL, 10)),
 		.sin_addr.s_addr = htobe32(((uint32_t) 0xefff0000) | 64214)
 	};
 
-	sacn_discovery_pdu pdu = {
+	//the pdus are prepared in sacn_start, the root layer length excludes the 16-byte preamble
+	for(page = 0; page < global_cfg.fd[fd].discovery_pages; page++){
+		if(sendto(global_cfg.fd[fd].fd, (uint8_t*) (global_cfg.fd[fd].discovery + page), (be16toh(global_cfg.fd[fd].discovery[page].root.flags) & 0x0FFF) + 16, 0, (struct sockaddr*) &discovery_dest, sizeof(discovery_dest)) < 0){
+			#ifdef _WIN32
+			if(WSAGetLastError() != WSAEWOULDBLOCK){
+			#else
+			if(errno != EAGAIN){
+			#endif
+				LOGPF("Failed to output universe discovery frame for interface %" PRIsize_t ": %s", fd, mmbackend_socket_strerror(errno));
+			}
+		}
+	}
+}
+
+static void sacn_synchronize(size_t fd){
+	size_t u;
+	sacn_sync_pdu pdu = {
 		.root = {
 			.preamble_size = htobe16(0x10),
 			.postamble_size = 0,
 			.magic = { 0 }, //memcpy'd
-			.flags = 0, //filled later
+			.flags = htobe16(0x7000 | 0x0021),
 			.vector = htobe32(ROOT_E131_EXTENDED),
 			.sender_cid = { 0 }, //memcpy'd
-			.frame_flags = 0, //filled later
-			.frame_vector = htobe32(FRAME_E131_DISCOVERY)
+			.frame_flags = htobe16(0x7000 | 0x000b),
+			.frame_vector = htobe32(FRAME_E131_SYNC)
 		},
 		.data = {
-			.source_name = "", //memcpy'd
-			.flags = 0, //filled later
-			.vector = htobe32(DISCOVERY_UNIVERSE_LIST),
-			.page = 0, //filled later
-			.max_page = pages - 1,
-			.data = { 0 } //memcpy'd
+			.sequence = 0, //filled later
+			.sync_addr = 0, //filled later
+			.reserved = 0
 		}
 	};
 
 	memcpy(pdu.root.magic, SACN_PDU_MAGIC, sizeof(pdu.root.magic));
 	memcpy(pdu.root.sender_cid, global_cfg.cid, sizeof(pdu.root.sender_cid));
-	memcpy(pdu.data.source_name, global_cfg.source_name, sizeof(pdu.data.source_name));
 
-	for(; page < pages; page++){
-		universes = (global_cfg.fd[fd].universes - page * 512 >= 512) ? 512 : (global_cfg.fd[fd].universes % 512);
-		pdu.root.flags = htobe16(0x7000 | (104 + universes * sizeof(uint16_t)));
-		pdu.root.frame_flags = htobe16(0x7000 | (82 + universes * sizeof(uint16_t)));
-		pdu.data.flags = htobe16(0x7000 | (8 + universes * sizeof(uint16_t)));
+	for(u = 0; u < global_cfg.fd[fd].syncs; u++){
+		if(!global_cfg.fd[fd].sync[u].mark){
+			continue;
+		}
 
-		pdu.data.page = page;
-		memcpy(pdu.data.data, global_cfg.fd[fd].universe + page * 512, universes * sizeof(uint16_t));
+		pdu.data.sequence = global_cfg.fd[fd].sync[u].seq++;
+		pdu.data.sync_addr = htobe16(global_cfg.fd[fd].sync[u].universe);
+		global_cfg.fd[fd].sync[u].mark = 0;
 
-		if(sendto(global_cfg.fd[fd].fd, (uint8_t*) &pdu, sizeof(pdu) - (512 - universes) * sizeof(uint16_t), 0, (struct sockaddr*) &discovery_dest, sizeof(discovery_dest)) < 0){
+		if(sendto(global_cfg.fd[fd].fd, (uint8_t*) &pdu, sizeof(pdu), 0, (struct sockaddr*) &global_cfg.fd[fd].sync[u].dest_addr, global_cfg.fd[fd].sync[u].dest_len) < 0){
 			#ifdef _WIN32
 			if(WSAGetLastError() != WSAEWOULDBLOCK){
 			#else
 			if(errno != EAGAIN){
 			#endif
-				LOGPF("Failed to output universe discovery frame for interface %" PRIsize_t ": %s", fd, mmbackend_socket_strerror(errno));
+				LOGPF("Failed to output synchronization frame for universe %u: %s", global_cfg.fd[fd].sync[u].universe, mmbackend_socket_strerror(errno));
 			}
 		}
 	}
 }
 
-static int sacn_handle(size_t num, managed_fd* fds){
-	size_t u, c;
-	uint64_t timestamp = mm_timestamp();
-	uint32_t synthesize_delta = 0;
+static int sacn_receive(int fd, size_t fd_index){
 	ssize_t bytes_read;
 	char recv_buf[SACN_RECV_BUF];
 	instance* inst = NULL;
-	sacn_instance_id instance_id = {
-		.label = 0
-	};
+	sacn_instance_data* inst_data = NULL;
 	sacn_frame_root* frame = (sacn_frame_root*) recv_buf;
 	sacn_frame_data* data = (sacn_frame_data*) (recv_buf + sizeof(sacn_frame_root));
+	sacn_frame_sync* sync = (sacn_frame_sync*) (recv_buf + sizeof(sacn_frame_root));
+
+	do{
+		bytes_read = recv(fd, recv_buf, sizeof(recv_buf), 0);
+		if(bytes_read > 0 && bytes_read > sizeof(sacn_frame_root)){
+			if(memcmp(frame->magic, SACN_PDU_MAGIC, 12)
+					|| be16toh(frame->preamble_size) != 0x10
+					|| frame->postamble_size != 0){
+				continue;
+			}
 
-	if(timestamp - global_cfg.last_announce > SACN_DISCOVERY_TIMEOUT){
-		//send universe discovery pdu
-		for(u = 0; u < global_cfg.fds; u++){
-			if(global_cfg.fd[u].universes){
-				sacn_discovery(u);
+			if(be32toh(frame->vector) == ROOT_E131_DATA
+					&& be32toh(frame->frame_vector) == FRAME_E131_DATA
+					&& data->vector == DMP_SET_PROPERTY){
+				inst = sacn_find_instance(fd_index, be16toh(data->universe));
+				if(inst){
+					inst_data = (sacn_instance_data*) inst->impl;
+					#ifdef SACN_WORKERS
+					//unicast input for one universe may arrive on any worker socket
+					pthread_mutex_lock(&inst_data->lock);
+					#endif
+					if(sacn_process_frame(inst, frame, data)){
+						LOG("Failed to process frame");
+					}
+					#ifdef SACN_WORKERS
+					pthread_mutex_unlock(&inst_data->lock);
+					#endif
+				}
+				else if(global_cfg.detect > 1){
+					//this will only happen with unicast input
+					LOGPF("Received data for unconfigured universe %d on socket %" PRIsize_t, be16toh(data->universe), fd_index);
+				}
+			}
+			else if(be32toh(frame->vector) == ROOT_E131_EXTENDED
+					&& be32toh(frame->frame_vector) == FRAME_E131_SYNC
+					&& bytes_read >= sizeof(sacn_sync_pdu)){
+				if(sacn_process_sync(fd_index, be16toh(sync->sync_addr))){
+					LOG("Failed to process synchronization frame");
+				}
 			}
 		}
-		global_cfg.last_announce = timestamp;
+	} while(bytes_read > 0);
+
+	#ifdef _WIN32
+	if(bytes_read < 0 && WSAGetLastError() != WSAEWOULDBLOCK){
+	#else
+	if(bytes_read < 0 && errno != EAGAIN){
+	#endif
+		LOGPF("Failed to receive data: %s", mmbackend_socket_strerror(errno));
+	}
+
+	if(bytes_read == 0){
+		LOG("Listener closed");
+		return 1;
+	}
+	return 0;
+}
+
+#ifdef SACN_WORKERS
+static void* sacn_worker_main(void* arg){
+	sacn_worker* worker = (sacn_worker*) arg;
+	struct pollfd fds[2] = {
+		{
+			.fd = worker->fd,
+			.events = POLLIN
+		},
+		{
+			//the control pipe becomes readable (hangs up) when the workers are to stop
+			.fd = global_cfg.control[0],
+			.events = POLLIN
+		}
+	};
+
+	worker_context = worker;
+	while(__atomic_load_n(&global_cfg.workers_running, __ATOMIC_ACQUIRE)){
+		if(poll(fds, 2, -1) < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			LOGPF("Worker failed to wait for data: %s", strerror(errno));
+			break;
+		}
+
+		if(fds[1].revents){
+			break;
+		}
+
+		if(fds[0].revents && sacn_receive(worker->fd, worker->fd_index)){
+			break;
+		}
+
+		//signal the main thread once per batch
+		if(worker->pending){
+			worker->pending = 0;
+			sacn_wake();
+		}
+	}
+	return NULL;
+}
+
+static int sacn_drain_workers(){
+	size_t u, p;
+	char drain[64];
+	sacn_worker_event event;
+	sacn_instance_data* data = NULL;
+	uint64_t overflow;
+
+	while(read(global_cfg.wake[0], drain, sizeof(drain)) > 0){
 	}
 
-	//check for keepalive frames, synthesize frames if necessary
-	global_cfg.next_frame = 0;
 	for(u = 0; u < global_cfg.fds; u++){
-		for(c = 0; c < global_cfg.fd[u].universes; c++){
-			synthesize_delta = timestamp - global_cfg.fd[u].universe[c].last_frame;
-
-			if((global_cfg.fd[u].universe[c].mark
-						&& synthesize_delta >= SACN_FRAME_TIMEOUT + SACN_SYNTHESIZE_MARGIN)
-					|| synthesize_delta >= SACN_KEEPALIVE_INTERVAL){
-				instance_id.fields.fd_index = u;
-				instance_id.fields.uni = global_cfg.fd[u].universe[c].universe;
-				inst = mm_instance_find(BACKEND_NAME, instance_id.label);
-				if(inst){
-					sacn_transmit(inst, global_cfg.fd[u].universe + c);
+		if(!global_cfg.fd[u].workers){
+			continue;
+		}
+
+		for(p = 0; p < global_cfg.fd[u].inputs; p++){
+			data = (sacn_instance_data*) global_cfg.fd[u].input[p]->impl;
+			while(!mmbackend_ring_pop(&data->queue, &event)){
+				if(mm_channel_event(event.chan, event.value)){
+					LOG("Failed to push event to core");
+					return 1;
 				}
 			}
 
-			//update next frame request
-			if(global_cfg.fd[u].universe[c].mark
-					&& (!global_cfg.next_frame || global_cfg.next_frame > SACN_FRAME_TIMEOUT + SACN_SYNTHESIZE_MARGIN - synthesize_delta)){
-				global_cfg.next_frame = SACN_FRAME_TIMEOUT + SACN_SYNTHESIZE_MARGIN - synthesize_delta;
+			overflow = __atomic_exchange_n(&data->overflow, 0, __ATOMIC_RELAXED);
+			if(overflow){
+				LOGPF("Dropped %" PRIu64 " input events on instance %s, queue full", overflow, global_cfg.fd[u].input[p]->name);
 			}
+		}
+	}
+	return 0;
+}
+#endif
+
+static int sacn_handle(size_t num, managed_fd* fds){
+	size_t u;
+	uint64_t timestamp = mm_timestamp();
 
+	if(global_cfg.timers && timestamp - global_cfg.last_announce > SACN_DISCOVERY_TIMEOUT){
+		//send universe discovery pdu
+		for(u = 0; u < global_cfg.fds; u++){
+			if(global_cfg.fd[u].discovery_pages){
+				sacn_discovery(u);
+			}
 		}
+		global_cfg.last_announce = timestamp;
 	}
 
-	for(u = 0; u < num; u++){
-		do{
-			bytes_read = recv(fds[u].fd, recv_buf, sizeof(recv_buf), 0);
-			if(bytes_read > 0 && bytes_read > sizeof(sacn_frame_root)){
-				if(!memcmp(frame->magic, SACN_PDU_MAGIC, 12)
-						&& be16toh(frame->preamble_size) == 0x10
-						&& frame->postamble_size == 0
-						&& be32toh(frame->vector) == ROOT_E131_DATA
-						&& be32toh(frame->frame_vector) == FRAME_E131_DATA
-						&& data->vector == DMP_SET_PROPERTY){
-					instance_id.fields.fd_index = ((uint64_t) fds[u].impl) & 0xFFFF;
-					instance_id.fields.uni = be16toh(data->universe);
-					inst = mm_instance_find(BACKEND_NAME, instance_id.label);
-					if(inst && sacn_process_frame(inst, frame, data)){
-						LOG("Failed to process frame");
-					}
-					else if(!inst && global_cfg.detect > 1){
-						//this will only happen with unicast input
-						LOGPF("Received data for unconfigured universe %d on socket %" PRIu64, be16toh(data->universe), ((uint64_t) fds[u].impl) & 0xFFFF);
-					}
-				}
+	//transmit keepalive & synthesized frames for all due universes, transmitting reschedules the universe
+	while(global_cfg.timers && global_cfg.timer[0]->deadline <= timestamp){
+		sacn_transmit(global_cfg.timer[0]->inst, global_cfg.timer[0]);
+	}
+
+	//release all universes transmitted since the last iteration with one packet per synchronization address
+	if(global_cfg.sync_pending){
+		for(u = 0; u < global_cfg.fds; u++){
+			if(global_cfg.fd[u].syncs){
+				sacn_synchronize(u);
 			}
-		} while(bytes_read > 0);
+		}
+		global_cfg.sync_pending = 0;
+	}
 
-		#ifdef _WIN32
-		if(bytes_read < 0 && WSAGetLastError() != WSAEWOULDBLOCK){
-		#else
-		if(bytes_read < 0 && errno != EAGAIN){
-		#endif
-			LOGPF("Failed to receive data: %s", mmbackend_socket_strerror(errno));
+	for(u = 0; u < num; u++){
+		#ifdef SACN_WORKERS
+		if(((uint64_t) fds[u].impl) == SACN_WAKE_FD){
+			if(sacn_drain_workers()){
+				return 1;
+			}
+			continue;
 		}
+		#endif
 
-		if(bytes_read == 0){
-			LOG("Listener closed");
+		if(sacn_receive(fds[u].fd, ((uint64_t) fds[u].impl) & 0xFFFF)){
 			return 1;
 		}
 	}
@@ -636,51 +1254,197 @@ static int sacn_handle(size_t num, managed_fd* fds){
 	return 0;
 }
 
-static int sacn_start_multicast(instance* inst){
-	sacn_instance_data* data = (sacn_instance_data*) inst->impl;
-	struct sockaddr_storage bound_name = {
+static int sacn_start_sync(sacn_instance_data* data, size_t* index){
+	size_t u;
+	sacn_fd* fd = global_cfg.fd + data->fd_index;
+	struct sockaddr_storage dest_addr = {
 		0
 	};
-	char mcast_ifaddr[INET_ADDRSTRLEN] = "";
+	socklen_t dest_len = sizeof(struct sockaddr_in);
+	struct sockaddr_in* dest_v4 = (struct sockaddr_in*) &dest_addr;
 
-	#ifdef _WIN32
-	struct ip_mreq mcast_req = {
-		.imr_interface.s_addr = INADDR_ANY,
-	#else
-	struct ip_mreqn mcast_req = {
-		.imr_address.s_addr = INADDR_ANY,
-	#endif
-		.imr_multiaddr.s_addr = htobe32(((uint32_t) 0xefff0000) | ((uint32_t) data->uni))
-	};
-	socklen_t bound_length = sizeof(bound_name);
+	//synchronization packets go to the unicast destination if one is set, to the synchronization universe multicast group otherwise
+	if(data->dest_len){
+		memcpy(&dest_addr, &data->dest_addr, sizeof(dest_addr));
+		dest_len = data->dest_len;
+	}
+	else{
+		dest_v4->sin_family = AF_INET;
+		dest_v4->sin_port = htobe16(strtoul(SACN_PORT, NULL, 10));
+		dest_v4->sin_addr.s_addr = htobe32(((uint32_t) 0xefff0000) | ((uint32_t) data->xmit_sync));
+	}
 
-	//select the specific interface to join the mcast group on based on the bind address
-	if(getsockname(global_cfg.fd[data->fd_index].fd, (struct sockaddr*) &bound_name, &bound_length)){
-		LOGPF("Failed to read back local bind address on socket %" PRIsize_t, data->fd_index);
+	//share synchronization packets between universes with the same address and destination
+	for(u = 0; u < fd->syncs; u++){
+		if(fd->sync[u].universe == data->xmit_sync
+				&& fd->sync[u].dest_len == dest_len
+				&& !memcmp(&fd->sync[u].dest_addr, &dest_addr, dest_len)){
+			*index = u;
+			return 0;
+		}
+	}
+
+	fd->sync = realloc(fd->sync, (fd->syncs + 1) * sizeof(sacn_output_sync));
+	if(!fd->sync){
+		fd->syncs = 0;
+		LOG("Failed to allocate memory");
 		return 1;
 	}
-	else if(bound_name.ss_family != AF_INET || !((struct sockaddr_in*) &bound_name)->sin_addr.s_addr){
-		LOGPF("Socket %" PRIsize_t " not bound to a specific IPv4 address, joining multicast input group for instance %s (universe %u) on default interface", data->fd_index, inst->name, data->uni);
+
+	fd->sync[fd->syncs].universe = data->xmit_sync;
+	fd->sync[fd->syncs].seq = 0;
+	fd->sync[fd->syncs].mark = 0;
+	memcpy(&fd->sync[fd->syncs].dest_addr, &dest_addr, sizeof(dest_addr));
+	fd->sync[fd->syncs].dest_len = dest_len;
+	*index = fd->syncs;
+	fd->syncs++;
+	return 0;
+}
+
+static int sacn_universe_compare(const void* a, const void* b){
+	return *((uint16_t*) a) - *((uint16_t*) b);
+}
+
+static int sacn_instance_compare(const void* a, const void* b){
+	return ((sacn_instance_data*) (*((instance**) a))->impl)->uni - ((sacn_instance_data*) (*((instance**) b))->impl)->uni;
+}
+
+static int sacn_start_discovery(size_t fd){
+	size_t u, page, universes;
+	uint16_t* list = calloc(global_cfg.fd[fd].universes, sizeof(uint16_t));
+	sacn_discovery_pdu* pdu = NULL;
+
+	if(!list){
+		LOG("Failed to allocate memory");
+		return 1;
 	}
-	else{
-		//this relies on the previous check for the socket family (AF_INET / IPv4)
-		#ifdef _WIN32
-		mcast_req.imr_interface = ((struct sockaddr_in*) &bound_name)->sin_addr;
-		#else
-		mcast_req.imr_address = ((struct sockaddr_in*) &bound_name)->sin_addr;
-		#endif
 
-		mmbackend_sockaddr_ntop((struct sockaddr*) &bound_name, mcast_ifaddr, sizeof(mcast_ifaddr));
-		LOGPF("Joining multicast input group for instance %s (universe %u) on interface for socket %" PRIsize_t " (%s)", inst->name, data->uni, data->fd_index, mcast_ifaddr);
+	//the universe list must be sorted
+	for(u = 0; u < global_cfg.fd[fd].universes; u++){
+		list[u] = global_cfg.fd[fd].universe[u].universe;
 	}
+	qsort(list, global_cfg.fd[fd].universes, sizeof(uint16_t), sacn_universe_compare);
 
-	if(setsockopt(global_cfg.fd[data->fd_index].fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (uint8_t*) &mcast_req, sizeof(mcast_req))){
-		LOGPF("Failed to join Multicast group for universe %u on instance %s: %s", data->uni, inst->name, mmbackend_socket_strerror(errno));
+	global_cfg.fd[fd].discovery_pages = (global_cfg.fd[fd].universes + 511) / 512;
+	global_cfg.fd[fd].discovery = calloc(global_cfg.fd[fd].discovery_pages, sizeof(sacn_discovery_pdu));
+	if(!global_cfg.fd[fd].discovery){
+		global_cfg.fd[fd].discovery_pages = 0;
+		free(list);
+		LOG("Failed to allocate memory");
+		return 1;
+	}
+
+	for(page = 0; page < global_cfg.fd[fd].discovery_pages; page++){
+		pdu = global_cfg.fd[fd].discovery + page;
+		universes = min(global_cfg.fd[fd].universes - page * 512, 512);
+
+		pdu->root.preamble_size = htobe16(0x10);
+		memcpy(pdu->root.magic, SACN_PDU_MAGIC, sizeof(pdu->root.magic));
+		pdu->root.flags = htobe16(0x7000 | (104 + universes * sizeof(uint16_t)));
+		pdu->root.vector = htobe32(ROOT_E131_EXTENDED);
+		memcpy(pdu->root.sender_cid, global_cfg.cid, sizeof(pdu->root.sender_cid));
+		pdu->root.frame_flags = htobe16(0x7000 | (82 + universes * sizeof(uint16_t)));
+		pdu->root.frame_vector = htobe32(FRAME_E131_DISCOVERY);
+
+		memcpy(pdu->data.source_name, global_cfg.source_name, sizeof(pdu->data.source_name));
+		pdu->data.flags = htobe16(0x7000 | (8 + universes * sizeof(uint16_t)));
+		pdu->data.vector = htobe32(DISCOVERY_UNIVERSE_LIST);
+		pdu->data.page = page;
+		pdu->data.max_page = global_cfg.fd[fd].discovery_pages - 1;
+		for(u = 0; u < universes; u++){
+			pdu->data.data[u] = htobe16(list[page * 512 + u]);
+		}
 	}
 
+	free(list);
 	return 0;
 }
 
+static int sacn_start_workers(){
+	#ifdef SACN_WORKERS
+	size_t u, w;
+	uint8_t sharded = 0;
+	sacn_instance_data* data = NULL;
+
+	for(u = 0; u < global_cfg.fds; u++){
+		sharded |= global_cfg.fd[u].workers ? 1 : 0;
+	}
+
+	if(!sharded){
+		return 0;
+	}
+
+	if(pipe(global_cfg.wake) || pipe(global_cfg.control)){
+		LOGPF("Failed to create worker pipes: %s", strerror(errno));
+		return 1;
+	}
+
+	//the workers must never block on the wakeup pipe
+	if(fcntl(global_cfg.wake[0], F_SETFL, fcntl(global_cfg.wake[0], F_GETFL, 0) | O_NONBLOCK) < 0
+			|| fcntl(global_cfg.wake[1], F_SETFL, fcntl(global_cfg.wake[1], F_GETFL, 0) | O_NONBLOCK) < 0){
+		LOGPF("Failed to set worker pipe mode: %s", strerror(errno));
+		return 1;
+	}
+
+	if(mm_manage_fd(global_cfg.wake[0], BACKEND_NAME, 1, (void*) SACN_WAKE_FD)){
+		return 1;
+	}
+
+	for(u = 0; u < global_cfg.fds; u++){
+		for(w = 0; global_cfg.fd[u].workers && w < global_cfg.fd[u].inputs; w++){
+			data = (sacn_instance_data*) global_cfg.fd[u].input[w]->impl;
+			if(mmbackend_ring_init(&data->queue, SACN_WORKER_QUEUE, sizeof(sacn_worker_event))){
+				LOG("Failed to allocate worker queue");
+				return 1;
+			}
+		}
+	}
+
+	__atomic_store_n(&global_cfg.workers_running, 1, __ATOMIC_RELEASE);
+	for(u = 0; u < global_cfg.fds; u++){
+		for(w = 0; w < global_cfg.fd[u].workers; w++){
+			if(pthread_create(&global_cfg.fd[u].worker[w].thread, NULL, sacn_worker_main, global_cfg.fd[u].worker + w)){
+				LOGPF("Failed to start worker %" PRIsize_t " for socket %" PRIsize_t, w, u);
+				return 1;
+			}
+			global_cfg.fd[u].worker[w].running = 1;
+		}
+	}
+	#endif
+	return 0;
+}
+
+static void sacn_stop_workers(){
+	#ifdef SACN_WORKERS
+	size_t u, w;
+
+	if(global_cfg.control[1] < 0){
+		return;
+	}
+
+	//closing the control pipe wakes up all workers blocked in poll
+	__atomic_store_n(&global_cfg.workers_running, 0, __ATOMIC_RELEASE);
+	close(global_cfg.control[1]);
+	for(u = 0; u < global_cfg.fds; u++){
+		for(w = 0; w < global_cfg.fd[u].workers; w++){
+			if(global_cfg.fd[u].worker[w].running){
+				pthread_join(global_cfg.fd[u].worker[w].thread, NULL);
+			}
+		}
+
+		for(w = 0; global_cfg.fd[u].workers && w < global_cfg.fd[u].inputs; w++){
+			mmbackend_ring_free(&((sacn_instance_data*) global_cfg.fd[u].input[w]->impl)->queue);
+		}
+	}
+
+	close(global_cfg.control[0]);
+	close(global_cfg.wake[0]);
+	close(global_cfg.wake[1]);
+	global_cfg.control[0] = global_cfg.control[1] = -1;
+	global_cfg.wake[0] = global_cfg.wake[1] = -1;
+	#endif
+}
+
 static int sacn_start(size_t n, instance** inst){
 	size_t u, p;
 	int rv = 1;
@@ -715,10 +1479,19 @@ static int sacn_start(size_t n, instance** inst){
 			}
 		}
 
-		if(!data->unicast_input && sacn_start_multicast(inst[u])){
+		if(!data->unicast_input && sacn_join_multicast(inst[u], data->uni)){
 			return 1;
 		}
 
+		global_cfg.fd[data->fd_index].input = realloc(global_cfg.fd[data->fd_index].input, (global_cfg.fd[data->fd_index].inputs + 1) * sizeof(instance*));
+		if(!global_cfg.fd[data->fd_index].input){
+			global_cfg.fd[data->fd_index].inputs = 0;
+			LOG("Failed to allocate memory");
+			goto bail;
+		}
+		global_cfg.fd[data->fd_index].input[global_cfg.fd[data->fd_index].inputs] = inst[u];
+		global_cfg.fd[data->fd_index].inputs++;
+
 		if(data->xmit_prio){
 			//add to list of advertised universes for this fd
 			global_cfg.fd[data->fd_index].universe = realloc(global_cfg.fd[data->fd_index].universe, (global_cfg.fd[data->fd_index].universes + 1) * sizeof(sacn_output_universe));
@@ -728,8 +1501,14 @@ static int sacn_start(size_t n, instance** inst){
 			}
 
 			global_cfg.fd[data->fd_index].universe[global_cfg.fd[data->fd_index].universes].universe = data->uni;
+			global_cfg.fd[data->fd_index].universe[global_cfg.fd[data->fd_index].universes].inst = inst[u];
+			global_cfg.fd[data->fd_index].universe[global_cfg.fd[data->fd_index].universes].deadline = 0;
 			global_cfg.fd[data->fd_index].universe[global_cfg.fd[data->fd_index].universes].last_frame = 0;
 			global_cfg.fd[data->fd_index].universe[global_cfg.fd[data->fd_index].universes].mark = 0;
+			global_cfg.fd[data->fd_index].universe[global_cfg.fd[data->fd_index].universes].sync = 0;
+			if(data->xmit_sync && sacn_start_sync(data, &global_cfg.fd[data->fd_index].universe[global_cfg.fd[data->fd_index].universes].sync)){
+				goto bail;
+			}
 			global_cfg.fd[data->fd_index].universes++;
 
 			//generate multicast destination address if none set
@@ -743,30 +1522,71 @@ static int sacn_start(size_t n, instance** inst){
 		}
 	}
 
+	//all output universes are initially due for a keepalive frame, which trivially satisfies the heap property
+	for(u = 0; u < global_cfg.fds; u++){
+		qsort(global_cfg.fd[u].input, global_cfg.fd[u].inputs, sizeof(instance*), sacn_instance_compare);
+
+		global_cfg.timer = realloc(global_cfg.timer, (global_cfg.timers + global_cfg.fd[u].universes) * sizeof(sacn_output_universe*));
+		if(!global_cfg.timer){
+			global_cfg.timers = 0;
+			LOG("Failed to allocate memory");
+			goto bail;
+		}
+
+		for(p = 0; p < global_cfg.fd[u].universes; p++){
+			global_cfg.fd[u].universe[p].timer = global_cfg.timers;
+			global_cfg.timer[global_cfg.timers] = global_cfg.fd[u].universe + p;
+			global_cfg.timers++;
+		}
+
+		if(global_cfg.fd[u].universes && sacn_start_discovery(u)){
+			goto bail;
+		}
+	}
+
 	LOGPF("Registering %" PRIsize_t " descriptors to core", global_cfg.fds);
 	for(u = 0; u < global_cfg.fds; u++){
-		if(mm_manage_fd(global_cfg.fd[u].fd, BACKEND_NAME, 1, (void*) u)){
+		//sharded sockets are read by their workers
+		if(!global_cfg.fd[u].workers && mm_manage_fd(global_cfg.fd[u].fd, BACKEND_NAME, 1, (void*) u)){
 			goto bail;
 		}
 	}
 
-	rv = 0;
+	rv = sacn_start_workers();
 bail:
 	return rv;
 }
 
 static int sacn_shutdown(size_t n, instance** inst){
-	size_t p;
+	size_t p, u;
+
+	//the workers access instance data, stop them first
+	sacn_stop_workers();
 
 	for(p = 0; p < n; p++){
+		#ifdef SACN_WORKERS
+		pthread_mutex_destroy(&((sacn_instance_data*) inst[p]->impl)->lock);
+		#endif
+		free(((sacn_instance_data*) inst[p]->impl)->data.source);
 		free(inst[p]->impl);
 	}
 
 	for(p = 0; p < global_cfg.fds; p++){
+		//the primary socket is also the first worker socket
+		for(u = 1; u < global_cfg.fd[p].workers; u++){
+			close(global_cfg.fd[p].worker[u].fd);
+		}
+		free(global_cfg.fd[p].worker);
+		free(global_cfg.fd[p].input);
 		close(global_cfg.fd[p].fd);
 		free(global_cfg.fd[p].universe);
+		free(global_cfg.fd[p].sync);
+		free(global_cfg.fd[p].discovery);
 	}
 	free(global_cfg.fd);
+	free(global_cfg.timer);
+	global_cfg.timer = NULL;
+	global_cfg.timers = 0;
 	LOG("Backend shut down");
 	return 0;
 }
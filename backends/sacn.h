@@ -1,4 +1,14 @@
 #include "midimonster.h"
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+//sharded input requires kernel load balancing and per-socket multicast group filtering
+#if defined(SO_REUSEPORT) && defined(IP_MULTICAST_ALL)
+	#define SACN_WORKERS
+	#include <pthread.h>
+#endif
 
 MM_PLUGIN_API int init();
 static uint32_t sacn_interval();
@@ -19,6 +29,15 @@ static int sacn_shutdown(size_t n, instance** inst);
 #define SACN_FRAME_TIMEOUT 20
 #define SACN_SYNTHESIZE_MARGIN 10
 #define SACN_DISCOVERY_TIMEOUT 9000
+//spec 6.7.1
+#define SACN_SOURCE_TIMEOUT 2500
+//spec 6.7.2
+#define SACN_SEQUENCE_WINDOW 20
+#define SACN_MAX_SOURCES 16
+#define SACN_MAX_WORKERS 64
+#define SACN_WORKER_QUEUE 8192
+//flag for the impl member of managed fds, marking the worker wakeup pipe
+#define SACN_WAKE_FD 0x10000
 #define SACN_PDU_MAGIC "ASC-E1.17\0\0\0"
 
 #define MAP_COARSE 0x0200
@@ -30,9 +49,25 @@ static int sacn_shutdown(size_t n, instance** inst);
 #define IS_WIDE(a) ((a) & (MAP_FINE | MAP_COARSE))
 #define IS_SINGLE(a) ((a) & MAP_SINGLE)
 
+//unaligned byte vector used for merging source data
+typedef uint8_t sacn_simd __attribute__((vector_size(16), aligned(1), __may_alias__));
+
+typedef struct /*_sacn_source*/ {
+	uint8_t cid[16];
+	uint8_t priority;
+	uint8_t sequence;
+	uint64_t last_seen;
+	uint8_t data[512];
+} sacn_source;
+
 typedef struct /*_sacn_universe_model*/ {
-	uint8_t last_priority;
+	size_t sources;
+	sacn_source* source;
+	uint16_t sync_addr;
+	uint8_t sync_pending;
+	uint64_t last_sync;
 	uint8_t last_seq;
+	uint16_t out_len;
 	uint8_t in[512];
 	uint8_t out[512];
 	uint16_t map[512];
@@ -43,7 +78,10 @@ typedef struct /*_sacn_instance_model*/ {
 	uint64_t last_input;
 	uint16_t uni;
 	uint8_t realtime;
+	uint8_t full_frames;
+	uint8_t merge;
 	uint8_t xmit_prio;
+	uint16_t xmit_sync;
 	uint8_t cid_filter[16];
 	uint8_t filter_enabled;
 	uint8_t unicast_input;
@@ -51,6 +89,13 @@ typedef struct /*_sacn_instance_model*/ {
 	socklen_t dest_len;
 	sacn_universe data;
 	size_t fd_index;
+	#ifdef SACN_WORKERS
+	pthread_mutex_t lock;
+	//events generated by workers, only pushed to while holding the lock to preserve their order
+	mmbackend_ring queue;
+	//events dropped because the queue was full
+	uint64_t overflow;
+	#endif
 } sacn_instance_data;
 
 typedef union /*_sacn_instance_id*/ {
@@ -64,14 +109,50 @@ typedef union /*_sacn_instance_id*/ {
 
 typedef struct /*_sacn_output_universe*/ {
 	uint16_t universe;
+	instance* inst;
 	uint64_t last_frame;
+	uint64_t deadline;
+	size_t timer;
 	uint8_t mark;
+	size_t sync;
 } sacn_output_universe;
 
+typedef struct /*_sacn_output_sync*/ {
+	uint16_t universe;
+	uint8_t seq;
+	uint8_t mark;
+	struct sockaddr_storage dest_addr;
+	socklen_t dest_len;
+} sacn_output_sync;
+
+typedef struct /*_sacn_worker_event*/ {
+	channel* chan;
+	channel_value value;
+} sacn_worker_event;
+
+typedef struct _sacn_worker {
+	int fd;
+	size_t fd_index;
+	uint8_t pending;
+	uint8_t running;
+	#ifdef SACN_WORKERS
+	pthread_t thread;
+	#endif
+} sacn_worker;
+
 typedef struct /*_sacn_socket*/ {
 	int fd;
+	size_t workers;
+	sacn_worker* worker;
+	//instances bound to this socket sorted by universe, read-only after start so workers can access it
+	size_t inputs;
+	instance** input;
 	size_t universes;
 	sacn_output_universe* universe;
+	size_t syncs;
+	sacn_output_sync* sync;
+	size_t discovery_pages;
+	struct _sacn_xmit_discovery* discovery;
 } sacn_fd;
 
 #pragma pack(push, 1)
@@ -117,21 +198,37 @@ typedef struct /*_sacn_frame_discovery*/ {
 	uint16_t data[512];
 } sacn_frame_discovery;
 
+typedef struct /*_sacn_frame_sync*/ {
+	//framing
+	uint8_t sequence;
+	uint16_t sync_addr;
+	uint16_t reserved;
+} sacn_frame_sync;
+
 typedef struct /*_sacn_xmit_data*/ {
 	sacn_frame_root root;
 	sacn_frame_data data;
 } sacn_data_pdu;
 
-typedef struct /*_sacn_xmit_discovery*/ {
+typedef struct _sacn_xmit_discovery {
 	sacn_frame_root root;
 	sacn_frame_discovery data;
 } sacn_discovery_pdu;
+
+typedef struct /*_sacn_xmit_sync*/ {
+	sacn_frame_root root;
+	sacn_frame_sync data;
+} sacn_sync_pdu;
 #pragma pack(pop)
 
+#define OPTION_PREVIEW 0x80
+#define OPTION_TERMINATED 0x40
+
 #define ROOT_E131_DATA 0x4
 #define FRAME_E131_DATA 0x2
 #define DMP_SET_PROPERTY 0x2
 
 #define ROOT_E131_EXTENDED 0x8
+#define FRAME_E131_SYNC 0x1
 #define FRAME_E131_DISCOVERY 0x2
 #define DISCOVERY_UNIVERSE_LIST 0x1
@@ -12,8 +12,8 @@
 	#include <IOKit/serial/ioss.h>
 #endif
 
-#include "visca.h"
 #include "libmmbackend.h"
+#include "visca.h"
 
 /* TODO
  *	VISCA server
@@ -80,6 +80,7 @@ static int ptz_configure_instance(instance* inst, char* option, char* value){
 			LOGPF("Failed to connect instance %s", inst->name);
 			return 1;
 		}
+		data->tcp = mode ? 0 : 1;
 		return 0;
 	}
 	else if(!strcmp(option, "device")){
@@ -408,7 +409,11 @@ static int ptz_set(instance* inst, size_t num, channel** c, channel_value* v){
 		if(data->direct_device && bytes && ptz_write_serial(data->fd, tx, bytes)){
 			LOGPF("Failed to write %s command on instance %s", ptz_channels[command].name, inst->name);	
 		}
-		else if(!data->direct_device && bytes && mmbackend_send(data->fd, tx, bytes)){
+		//a command still queued for a slow camera is replaced with the current one
+		else if(data->tcp && bytes && mmbackend_queue_send(&(data->queue), tx, bytes, command + 1) == 1){
+			LOGPF("Failed to push %s command on instance %s", ptz_channels[command].name, inst->name);
+		}
+		else if(!data->direct_device && !data->tcp && bytes && mmbackend_send(data->fd, tx, bytes)){
 			LOGPF("Failed to push %s command on instance %s", ptz_channels[command].name, inst->name);
 		}
 	}
@@ -420,10 +425,22 @@ static int ptz_handle(size_t num, managed_fd* fds){
 	size_t u;
 	ssize_t bytes_read;
 	instance* inst = NULL;
+	ptz_instance_data* data = NULL;
 
 	//read and ignore any responses for now
 	for(u = 0; u < num; u++){
 		inst = (instance*) fds[u].impl;
+		data = (ptz_instance_data*) inst->impl;
+
+		//continue writing queued commands
+		if((fds[u].ready & mmfd_write) && mmbackend_queue_flush(&(data->queue))){
+			LOGPF("Failed to push queued commands on instance %s", inst->name);
+		}
+
+		if(!(fds[u].ready & mmfd_read)){
+			continue;
+		}
+
 		bytes_read = recv(fds[u].fd, recv_buf, sizeof(recv_buf), 0);
 		if(bytes_read <= 0){
 			LOGPF("Failed to receive on signaled fd for instance %s", inst->name);
@@ -448,6 +465,7 @@ static int ptz_start(size_t n, instance** inst){
 				LOGPF("Failed to register descriptor for instance %s", inst[u]->name);
 				return 1;
 			}
+			mmbackend_queue_init(&(data->queue), data->fd, BACKEND_NAME, inst[u], VISCA_XMIT_LIMIT, mmbackend_queue_drop);
 			fds++;
 		}
 	}
@@ -465,6 +483,7 @@ static int ptz_shutdown(size_t n, instance** inst){
 		if(data->fd >= 0){
 			close(data->fd);
 		}
+		mmbackend_queue_free(&(data->queue));
 		free(data);
 		inst[u]->impl = NULL;
 	}
@@ -11,6 +11,8 @@ static int ptz_start(size_t n, instance** inst);
 static int ptz_shutdown(size_t n, instance** inst);
 
 #define VISCA_BUFFER_LENGTH 50
+//maximum amount of commands queued for a slow camera connected via TCP
+#define VISCA_XMIT_LIMIT 4096
 
 enum /*_ptz_relmove_channel */ {
 	rel_up = 1,
@@ -31,6 +33,8 @@ typedef struct /*_ptz_instance_data*/ {
 	uint8_t relative_movement;
 	double deadzone;
 	uint8_t direct_device;
+	uint8_t tcp;
+	mmbackend_queue queue;
 } ptz_instance_data;
 
 enum /*ptz_channels*/ {
@@ -25,6 +25,7 @@ static struct {
 	managed_fd* fd;
 	managed_fd* signaled;
 	fd_set read;
+	fd_set write;
 } fds = {
 	.max = -1
 };
@@ -50,26 +51,25 @@ static void core_timestamp(){
 	#endif
 }
 
-static fd_set core_collect(int* max_fd){
+static void core_collect(){
 	size_t u = 0;
-	fd_set rv_fds;
 
-	if(max_fd){
-		*max_fd = -1;
-	}
+	fds.max = -1;
 
-	DBGPF("Building selector set from %" PRIsize_t " FDs registered to core", fds);
-	FD_ZERO(&rv_fds);
+	DBGPF("Building selector sets from %" PRIsize_t " FDs registered to core", fds.n);
+	FD_ZERO(&(fds.read));
+	FD_ZERO(&(fds.write));
 	for(u = 0; u < fds.n; u++){
 		if(fds.fd[u].fd >= 0){
-			FD_SET(fds.fd[u].fd, &rv_fds);
-			if(max_fd){
-				*max_fd = max(*max_fd, fds.fd[u].fd);
+			if(fds.fd[u].interest & mmfd_read){
+				FD_SET(fds.fd[u].fd, &(fds.read));
 			}
+			if(fds.fd[u].interest & mmfd_write){
+				FD_SET(fds.fd[u].fd, &(fds.write));
+			}
+			fds.max = max(fds.max, fds.fd[u].fd);
 		}
 	}
-
-	return rv_fds;
 }
 
 MM_API int mm_manage_fd(int new_fd, char* back, int manage, void* impl){
@@ -89,6 +89,11 @@ MM_API int mm_manage_fd(int new_fd, char* back, int manage, void* impl){
 				fds.fd[u].fd = -1;
 				fds.fd[u].backend = NULL;
 				fds.fd[u].impl = NULL;
+				fds.fd[u].interest = 0;
+				fd_set_dirty = 1;
+			}
+			else if(fds.fd[u].interest != manage){
+				fds.fd[u].interest = manage;
 				fd_set_dirty = 1;
 			}
 			return 0;
@@ -131,12 +136,15 @@ MM_API int mm_manage_fd(int new_fd, char* back, int manage, void* impl){
 	fds.fd[u].fd = new_fd;
 	fds.fd[u].backend = b;
 	fds.fd[u].impl = impl;
+	fds.fd[u].interest = manage;
+	fds.fd[u].ready = 0;
 	fd_set_dirty = 1;
 	return 0;
 }
 
 int core_initialize(){
 	FD_ZERO(&(fds.read));
+	FD_ZERO(&(fds.write));
 
 	//load initial timestamp
 	core_timestamp();
@@ -174,7 +182,7 @@ int core_start(){
 }
 
 int core_iteration(){
-	fd_set read_fds;
+	fd_set read_fds, write_fds;
 	struct timeval tv;
 	int error;
 	size_t n, u;
@@ -186,17 +194,18 @@ int core_iteration(){
 
 	//rebuild fd set if necessary
 	if(fd_set_dirty){
-		fds.read = core_collect(&(fds.max));
+		core_collect();
 		fd_set_dirty = 0;
 	}
 
 	//wait for & translate events
 	read_fds = fds.read;
+	write_fds = fds.write;
 	tv = backend_timeout();
 
 	//check whether there are any fds active, windows does not like select() without descriptors
 	if(fds.max >= 0){
-		error = select(fds.max + 1, &read_fds, NULL, NULL, &tv);
+		error = select(fds.max + 1, &read_fds, &write_fds, NULL, &tv);
 		if(error < 0){
 			#ifndef _WIN32
 			LOGPF("select failed: %s", strerror(errno));
@@ -227,9 +236,13 @@ int core_iteration(){
 	//find all signaled fds
 	n = 0;
 	for(u = 0; u < fds.n; u++){
-		if(fds.fd[u].fd >= 0 && FD_ISSET(fds.fd[u].fd, &read_fds)){
-			fds.signaled[n] = fds.fd[u];
-			n++;
+		if(fds.fd[u].fd >= 0){
+			fds.fd[u].ready = (FD_ISSET(fds.fd[u].fd, &read_fds) ? mmfd_read : 0)
+				| (FD_ISSET(fds.fd[u].fd, &write_fds) ? mmfd_write : 0);
+			if(fds.fd[u].ready){
+				fds.signaled[n] = fds.fd[u];
+				n++;
+			}
 		}
 	}
 
@@ -157,6 +157,12 @@ typedef enum {
 	mmchannel_output = 0x2
 } mmbe_channel_flags;
 
+/* Bit masks for the `manage` parameter to mm_manage_fd and the `ready` member of managed_fd */
+typedef enum {
+	mmfd_read = 0x1,
+	mmfd_write = 0x2
+} mmbe_fd_flags;
+
 /* Channel event value, .normalised is used by backends to determine channel values */
 typedef struct _channel_value {
 	union {
@@ -209,11 +215,15 @@ typedef struct _backend_channel {
 /*
  * File descriptor structure passed for backend handling
  * Register for the core event loop using mm_manage_fd()
+ * `interest` holds the mmfd_* conditions the descriptor was registered for,
+ * `ready` the subset of those signaled in the current iteration.
  */
 typedef struct _managed_fd {
 	int fd;
 	backend* backend;
 	void* impl;
+	uint8_t interest;
+	uint8_t ready;
 } managed_fd;
 
 /*
@@ -267,6 +277,11 @@ MM_API void mm_channel_update(channel* c, uint64_t ident);
  * selected on. The backend will be notified when the descriptor becomes ready
  * to read via its registered mmbackend_process_fd call. The `impl` argument
  * will be provided within the corresponding managed_fd structure upon callback.
+ * `manage` may also be a combination of the mmfd_read / mmfd_write flags to
+ * additionally (or only) be notified when the descriptor becomes writable.
+ * Calling this function for an already registered descriptor replaces the
+ * interest flags. Backends requesting write notifications need to check the
+ * `ready` member of the signaled managed_fd structures.
  */
 MM_API int mm_manage_fd(int fd, char* backend, int manage, void* impl);
 